@@ -0,0 +1,27 @@
+#include "expression.h"
+
+#define UNBOUNDED_BACKSTEP_DEPTH -1
+#define MAX_ANALYSIS_DEPTH 1024 // deepest nesting of braces the analysis follows. Deeper programs are treated as unbounded
+
+// what a run of instructions does to the position stack, measured from the height it starts at. Every FD, LT and RT pushes one
+// position and BKSTP n pops n, ignoring that BKSTP stops at the first position, so the heights may be lower than they really are
+struct stackEffect {
+    int64_t net; // the height at the end
+    int64_t depth; // how far below the start the height goes
+    int64_t peakAboveEnd; // how far the highest point is above the end
+    int64_t drawdown; // the furthest the height falls from a high point to a later low point. This is the rewind depth the run needs
+    int unbounded; // set if a loop can go down further each time round, or a BKSTP is given a variable
+} ;
+typedef struct stackEffect StackEffect;
+
+// ANALYSIS FUNCTIONS
+int64_t     findMaxBackstepDepth(TokenStream ts);
+StackEffect noStackEffect();
+StackEffect combineStackEffects(StackEffect first, StackEffect second);
+StackEffect repeatStackEffect(StackEffect body);
+
+// WHITE BOX TESTING FUNCTIONS
+void runAnalysisWhiteBoxTests();
+void testStackEffects();
+void testBackstepDepth();
+
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ARENA_BLOCK_SIZE (1 << 20) // the size of each block the arena hands out memory from. Larger allocations get a block to themselves
+#define HUGE_PAGE_SIZE (1 << 21) // blocks backed by huge pages are rounded up to a multiple of this
+#define ARENA_ALIGNMENT 16 // every allocation starts on a multiple of this
+
+// the part of the program memory is counted against in the memory report
+enum memoryTag {
+    memTokens, memVariables, memParser, memTurtle, memPositions, memExpressions, memDisplayList, memSegmentIndex, memDisplay, memProfile,
+    NUM_MEMORY_TAGS
+} ;
+typedef enum memoryTag MemoryTag;
+
+// the memory counted against one tag. Bytes are what was asked for, not what the allocator or arena set aside for it
+struct memoryUsage {
+    int64_t current;
+    int64_t peak;
+    int64_t allocations; // the number of times memory was allocated or grown
+} ;
+typedef struct memoryUsage MemoryUsage;
+
+typedef struct arena *Arena;
+typedef struct arenaBlock *ArenaBlock;
+
+// SETUP/SHUTDOWN FUNCTIONS
+Arena createArena(size_t blockSize, int hugePages);
+void  resetArena(Arena arena);
+void  freeArena(Arena arena);
+
+// ALLOCATION FUNCTIONS
+void      *arenaAlloc(Arena arena, size_t size);
+void      *arenaCalloc(Arena arena, size_t size);
+void      *arenaAllocAligned(Arena arena, size_t size, size_t alignment);
+void      *arenaGrow(Arena arena, void *old, size_t oldSize, size_t newSize);
+ArenaBlock newArenaBlock(Arena arena, size_t minSize);
+void       freeArenaBlock(ArenaBlock block);
+size_t     getArenaUsed(Arena arena);
+size_t     getArenaReserved(Arena arena);
+
+// RUN ARENA FUNCTIONS
+Arena getRunArena();
+void  *runAlloc(size_t size, MemoryTag tag);
+void  *runCalloc(size_t size, MemoryTag tag);
+void  *runAllocAligned(size_t size, size_t alignment, MemoryTag tag);
+void  *runGrow(void *old, size_t oldSize, size_t newSize, MemoryTag tag);
+void  resetRunArena();
+void  releaseRunArena();
+void  setHugePages(int hugePages);
+
+// MEMORY ACCOUNTING FUNCTIONS
+void        trackMemory(MemoryTag tag, size_t oldSize, size_t newSize);
+void        trackRunMemory(MemoryTag tag, size_t oldSize, size_t newSize);
+void        countMemoryChange(MemoryTag tag, size_t oldSize, size_t newSize);
+void        releaseRunMemory();
+MemoryUsage getMemoryUsage(MemoryTag tag);
+const char *getMemoryTagName(MemoryTag tag);
+long        getPeakResidentKilobytes();
+void        printMemoryReport(FILE *out, char *title);
+void        countInstructionForMemoryReport();
+void        setMemoryReport(int report);
+int         getMemoryReport();
+void        setMemoryReportInterval(int64_t instructions);
+int64_t     getMemoryReportInterval();
+
+// WHITE BOX TESTING FUNCTIONS
+void runArenaWhiteBoxTests();
+void testArenaAllocation();
+void testArenaReset();
+void testMemoryAccounting();
+
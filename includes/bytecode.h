@@ -0,0 +1,56 @@
+#include "lexer.h"
+#include <inttypes.h>
+
+#define TBC_MAGIC "TBC"
+#define TBC_VERSION 3 // bump whenever the layout of the header or of a Token changes, so old files are ignored rather than misread
+#define TBC_BYTE_ORDER_MARK 0x01020304u // read back in a different order on a machine with a different byte order
+#define TBC_EXTENSION ".tbc"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+// the start of a .tbc file. It is followed by the program's tokens, stored exactly as the lexer produces them, then by where the name of
+// each named variable is in the text, and then by the source text the tokens point into, with every token null terminated
+struct bytecodeHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t tokenSize; // sizeof(Token) on the machine that wrote the file
+    uint64_t sourceHash; // FNV-1a hash of the source file the program was compiled from
+    uint64_t sourceSize;
+    int64_t numOfTokens;
+    uint64_t tokensOffset; // where the tokens start, from the start of the file
+    int64_t numOfNames;
+    uint64_t namesOffset; // where the text offsets of the variable names start, from the start of the file
+    uint64_t textOffset; // where the text starts, from the start of the file
+    uint64_t textSize;
+    int32_t braceBalance;
+    int32_t padding;
+} ;
+typedef struct bytecodeHeader BytecodeHeader;
+
+// LOADING FUNCTIONS
+TokenStream openProgram(char *filePath, int numOfThreads, uint64_t *sourceHash);
+TokenStream loadBytecodeFile(char *filePath, uint64_t *sourceHash, size_t *sourceSize);
+int         checkBytecodeHeader(BytecodeHeader *header, size_t fileSize);
+int         checkBytecodeTokens(Token *tokens, int64_t numOfTokens, uint64_t textSize, int numOfSlots);
+SymbolTable loadBytecodeNames(int64_t *nameOffsets, int64_t numOfNames, char *text, uint64_t textSize);
+int         checkForBytecodeExtension(char *filePath);
+
+// SAVING FUNCTIONS
+void        saveValidatedProgram(TokenStream ts, uint64_t sourceHash);
+int         writeBytecodeFile(TokenStream ts, uint64_t sourceHash, char *filePath);
+uint64_t    hashSource(char *source, size_t sourceSize);
+void        makeCachePath(char *cachePath, size_t length, uint64_t sourceHash);
+
+// BYTECODE SETTINGS
+void  setCacheDirectory(char *directory);
+char *getCacheDirectory();
+void  setEmitPath(char *filePath);
+
+// WHITE BOX TESTING FUNCTIONS
+void runBytecodeWhiteBoxTests();
+void testBytecodeRoundTrip();
+void testBytecodeRejection();
+void testCompileCache();
+
@@ -1,15 +1,17 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include "segmentring.h"
 #include <SDL.h>
 
 
 
-#define MILLISECOND_DELAY 25
-#define TURTLE_SPEED 10
+#define DEFAULT_REVEAL_RATE 100 // segments drawn a second as the drawing is revealed, unless a rate or duration is given
+#define NO_REVEAL_DURATION -1 // the reveal duration while the drawing is revealed at a rate instead
+#define SKIP_REVEAL_KEY SDLK_SPACE // shows the rest of the drawing at once
+#define DEFAULT_REFRESH_RATE 60 // frames a second, if the display's rate can't be found
+#define MAX_BATCH_POINTS 1024 // the most points queued before the lines joining them are sent to the renderer
 
 #define SCREEN_WIDTH 1000
 #define SCREEN_HEIGHT 700
+#define FIT_MARGIN 0.05 // the share of the window left empty round a drawing that has been fitted to it
 
 #define WHITE_R 255
 #define WHITE_G 255
@@ -46,12 +48,38 @@ void setUpDisplay();
 void createSDL_Simplewin();
 SDL_Simplewin getSDL_SimplewinPointer(SDL_Simplewin newSimplewin);
 void initialiseSDL();
-void shutDownDisplay();
+void setImageOutput(char *filePath, int width, int height);
+char *getImageOutput();
 
 // SDL DRAWING FUNCTIONS
 void drawBlackBackground();
-void drawLine();
+void queueLine(SDL_Simplewin sw, int xFrom, int yFrom, int xTo, int yTo);
+void submitLineBatch(SDL_Simplewin sw);
+void presentFrame(SDL_Simplewin sw);
+void mapToWindow(double x, double y, int *windowX, int *windowY);
 void setDrawColour(Clr colour);
+int  getColourRGB(Clr colour, Uint8 *r, Uint8 *g, Uint8 *b);
 void setSDLDrawColour(SDL_Simplewin sw, Uint8 r, Uint8 g, Uint8 b);
 void Neill_SDL_Events(SDL_Simplewin sw);
 void holdScreenUntilUserInput();
+
+// REVEAL FUNCTIONS
+int64_t takeFromSegmentRing(SegmentRing ring, int *runFinished);
+void    drawFromSegmentRing(SegmentRing ring);
+void    revealDisplayList();
+void    revealSegments(SDL_Simplewin sw, int64_t available);
+void    setRevealRate(double segmentsPerSecond);
+double  getRevealRate();
+void    setRevealDuration(double seconds);
+double  getRevealDuration();
+double  getRevealSeconds(int64_t numOfSegments);
+
+// VIEW FUNCTIONS
+void fitViewToDrawing(Box drawing);
+void resetView();
+Box  getView();
+void setFitToWindow(int fit);
+int  getFitToWindow();
+
+// SDL REDRAWING FUNCTIONS
+int64_t redrawRegion(Box area);
@@ -0,0 +1,70 @@
+#include "arena.h"
+#include <math.h>
+
+#define SEGMENT_BLOCK 16 // capacity is always a multiple of this, so loops over the arrays can work on whole vectors of floats or doubles
+#define DISPLAY_LIST_ALIGNMENT 64 // every array starts on a cache line
+#define INITIAL_SEGMENT_CAPACITY 4096
+#define NO_SEGMENT -1
+#define COLLINEAR_TOLERANCE 1e-9 // segments whose directions differ by less than this (as the sine of the angle between them) are merged
+
+typedef struct displayList *DisplayList;
+
+// every line segment the turtle has drawn, in the order it drew them, kept as one array per field. Coordinates are in the full arrays
+// (x0, y0, x1, y1) or, in compact mode, the float arrays (fx0, fy0, fx1, fy1) - the other set is NULL. Entries from numOfSegments up to
+// capacity are zero, so they can be read (but not used) by loops that run over whole SEGMENT_BLOCKs
+struct displayList {
+    int64_t numOfSegments;
+    int64_t segmentsAppended; // the number of segments drawn, before any were merged
+    int64_t duplicatesRemoved;
+    int64_t capacity;
+    int compact; // set from compactSegments when the list is created
+    int coalesce; // set from coalesceSegments when the list is created
+    double *x0, *y0, *x1, *y1;
+    float *fx0, *fy0, *fx1, *fy1;
+    uint8_t *colour; // the Clr the segment was drawn in
+    int64_t *sequence; // the order the segment was drawn in, counted before merging. Stays with the segment if the list is reordered
+    int64_t generation; // counts the times segments have been removed or moved, so anything holding indexes into the list knows to redo them
+    struct segmentIndex *index; // the spatial index over the list, NULL until something asks for it
+} ;
+
+// one segment read back from a DisplayList
+struct segment {
+    double x0, y0, x1, y1;
+    uint8_t colour;
+    int64_t sequence;
+} ;
+typedef struct segment Segment;
+
+// SETUP FUNCTIONS
+void        createDisplayList();
+DisplayList getDisplayListPointer(DisplayList newList);
+void        setCompactSegments(int compact);
+int         getCompactSegments();
+void        setCoalescing(int coalesce);
+void        setDeduplication(int dedup);
+int         getDeduplication();
+void        setSegmentCapacityHint(int64_t segments);
+
+// SEGMENT FUNCTIONS
+void    appendSegment(double x0, double y0, double x1, double y1, uint8_t colour);
+int     extendLastSegment(DisplayList dl, double x0, double y0, double x1, double y1, uint8_t colour);
+int     checkCollinear(double ax, double ay, double bx, double by);
+void    growDisplayList(DisplayList dl);
+void    resizeDisplayList(DisplayList dl, int64_t newCapacity);
+void   *growSegmentArray(void *old, int64_t oldCapacity, int64_t newCapacity, size_t elementSize);
+void    getSegment(DisplayList dl, int64_t index, Segment *segment);
+int64_t getNumberOfSegments();
+int64_t getSegmentsAppended();
+
+// DUPLICATE REMOVAL FUNCTIONS
+int64_t  removeDuplicateSegments(DisplayList dl);
+void     makeSegmentKey(DisplayList dl, int64_t index, int64_t key[5]);
+uint64_t hashSegmentKey(int64_t key[5]);
+
+// WHITE BOX TESTING FUNCTIONS
+void runDisplayListWhiteBoxTests();
+void testDisplayListAppending();
+void testCompactDisplayList();
+void testSegmentCoalescing();
+void testDuplicateRemoval();
+
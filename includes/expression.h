@@ -0,0 +1,57 @@
+#include "profiler.h"
+
+#define NO_EXPRESSION -1
+#define INITIAL_EXPRESSION_BUCKETS 64 // must be a power of 2
+#define EVAL_STACK_SIZE 64 // expressions that never hold more values than this are evaluated in a buffer on the C stack
+
+// the three things a reverse polish expression can do
+enum exprOpType {
+    pushNumber, pushVariable, applyOperator
+} ;
+typedef enum exprOpType ExprOpType;
+
+struct exprOp {
+    ExprOpType type;
+    int slot; // the variable slot of pushVariable ops, the mathSymbol of applyOperator ops
+    double val; // the value of pushNumber ops
+    int64_t tokenIndex; // where the op was written, so an unassigned variable can be reported at the right token
+} ;
+typedef struct exprOp ExprOp;
+
+// a reverse polish expression compiled into a flat list of ops. If it could not be compiled, error says why and errorIndex is the token
+// the error was found at
+struct expression {
+    int64_t startIndex; // the index of the ":=" token before the expression
+    int64_t endIndex; // the index of the ";" token that ends the expression
+    int firstOp;
+    int numOfOps;
+    int maxDepth; // the most values the expression holds at once, worked out as it is compiled
+    int depth; // while compiling: the number of values held after the last op
+    char *error;
+    int64_t errorIndex;
+} ;
+typedef struct expression Expression;
+
+typedef struct expressionTable *ExpressionTable;
+
+// SETUP FUNCTIONS
+ExpressionTable createExpressionTable();
+
+// COMPILING FUNCTIONS
+int         findExpression(ExpressionTable table, int64_t startIndex);
+int         beginExpression(ExpressionTable table, int64_t startIndex);
+int         addExpressionOp(ExpressionTable table, int id, ExprOpType type, int slot, double val, int64_t tokenIndex);
+int         finishExpression(ExpressionTable table, int id, int64_t endIndex);
+int         failExpression(ExpressionTable table, int id, char *error, int64_t errorIndex);
+Expression *getExpression(ExpressionTable table, int id);
+void        growExpressionBuckets(ExpressionTable table);
+
+// EVALUATING FUNCTIONS
+int evaluateExpression(ExpressionTable table, int id, int interpret, double *result, int64_t *failedIndex);
+int runExpressionOps(ExprOp *ops, int numOfOps, double *stack, int interpret, double *result, int64_t *failedIndex);
+
+// WHITE BOX TESTING FUNCTIONS
+void runExpressionWhiteBoxTests();
+void testExpressionCompiling();
+void testExpressionEvaluation();
+
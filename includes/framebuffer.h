@@ -0,0 +1,90 @@
+#include "segmentindex.h"
+
+#define BYTES_PER_PIXEL 3 // red, green and blue
+#define MAX_IMAGE_SIDE 16384 // the widest or tallest image that can be asked for
+#define PNG_STORED_BLOCK 65535 // the most bytes one uncompressed deflate block can hold
+#define PNG_COLOUR_TYPE_RGB 2
+#define SPAN_PATTERN_PIXELS 32 // the drawing colour repeated, as many pixels as the widest span kernel stores in one step
+#define WU_BATCH 16 // steps along an anti-aliased line worked out by each call to the coverage kernel
+#define COVERAGE_ONE 256 // the share of a pixel's colour that is all of it
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_LINE_KERNELS
+#include <immintrin.h>
+#endif
+
+// the ways lines can be drawn, slowest first
+enum lineKernel {
+    kernelAuto, kernelScalar, kernelSSE2, kernelAVX2
+} ;
+typedef enum lineKernel LineKernel;
+
+typedef void (*SpanKernel)(uint8_t *row, int numOfPixels, uint8_t *pattern);
+typedef void (*CoverageKernel)(float gradient, int first, int count, int *rows, int *coverage);
+
+typedef struct framebuffer *Framebuffer;
+
+// what lines are drawn with: the colour, and the rectangle of pixels (edges included) they may be drawn in. Threads drawing
+// different parts of the framebuffer at once each have their own
+struct pen {
+    int left, top, right, bottom;
+    uint8_t r, g, b;
+    uint8_t pattern[SPAN_PATTERN_PIXELS * BYTES_PER_PIXEL]; // the colour repeated, for the span kernels to copy from
+} ;
+typedef struct pen Pen;
+
+// an image drawn in memory, for running without a window. Pixels are stored a row at a time from the top, BYTES_PER_PIXEL each
+struct framebuffer {
+    int width, height;
+    uint8_t *pixels;
+    Pen pen; // draws over the whole framebuffer, in the colour last set
+} ;
+
+// SETUP FUNCTIONS
+void        createFramebuffer(int width, int height);
+Framebuffer getFramebufferPointer(Framebuffer newFramebuffer);
+
+// DRAWING FUNCTIONS
+void clearFramebuffer(Framebuffer fb, uint8_t r, uint8_t g, uint8_t b);
+void setFramebufferColour(Framebuffer fb, uint8_t r, uint8_t g, uint8_t b);
+void setPenColour(Pen *pen, uint8_t r, uint8_t g, uint8_t b);
+void setPenArea(Pen *pen, int left, int top, int right, int bottom);
+void drawFramebufferLine(Framebuffer fb, int x0, int y0, int x1, int y1);
+void drawPenLine(Framebuffer fb, Pen *pen, int x0, int y0, int x1, int y1);
+void drawBresenhamLine(Framebuffer fb, Pen *pen, int x0, int y0, int x1, int y1);
+void drawWuLine(Framebuffer fb, Pen *pen, int x0, int y0, int x1, int y1);
+void blendPixel(Framebuffer fb, Pen *pen, int x, int y, int coverage);
+void plotPixel(Framebuffer fb, Pen *pen, int x, int y);
+
+// LINE KERNEL FUNCTIONS
+LineKernel selectLineKernel(LineKernel kernel);
+LineKernel getLineKernel();
+void       setAntialiasing(int antialias);
+int        getAntialiasing();
+void       fillSpanScalar(uint8_t *row, int numOfPixels, uint8_t *pattern);
+void       findCoverageScalar(float gradient, int first, int count, int *rows, int *coverage);
+#ifdef X86_LINE_KERNELS
+void       fillSpanSSE2(uint8_t *row, int numOfPixels, uint8_t *pattern);
+void       fillSpanAVX2(uint8_t *row, int numOfPixels, uint8_t *pattern);
+void       findCoverageSSE2(float gradient, int first, int count, int *rows, int *coverage);
+#endif
+
+// IMAGE WRITING FUNCTIONS
+int      writeFramebufferImage(Framebuffer fb, char *filePath);
+int      writePPM(Framebuffer fb, FILE *file);
+int      writePNG(Framebuffer fb, FILE *file);
+int      writePNGChunk(FILE *file, char *type, uint8_t *data, size_t length);
+uint32_t updateCRC32(uint32_t crc, uint8_t *data, size_t length);
+void     putBigEndian32(uint8_t *buffer, uint32_t value);
+int      checkForExtension(char *filePath, char *extension);
+
+// WHITE BOX TESTING FUNCTIONS
+void runFramebufferWhiteBoxTests();
+void testFramebufferLines();
+void drawTestLines(Framebuffer fb);
+void testLineKernels();
+void testAntialiasing();
+void testImageWriting();
+int  countLitPixels(Framebuffer fb);
+void testHeadlessDrawing();
+
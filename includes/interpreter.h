@@ -1,11 +1,15 @@
-#include "display.h"
+#include "seglog.h"
 #include "../includes/sput.h"
 #include <math.h>
+#include <stdint.h>
 
 #define DRAW_SDL_IN_TESTS 0 // set to 1 to draw SDL during testing
 
 #define MAX_ANGLE 360 // used to mod turtle's angle so it never goes beyond 360 degrees. Technically not necessary but useful in testing
-#define NUMBER_OF_VARIABLES 26 // the number of variables in the variable list (26 as A-Z)
+#define NUMBER_OF_VARIABLES 26 // the number of single letter variables (26 as A-Z). Named variables take the slots after these
+#define BITS_PER_WORD 64 // bits in each word of the assigned variable bitset
+#define INITIAL_POSITION_CAPACITY 1024 // number of positions the position stack starts with room for. Must be a power of 2
+#define MAX_POSITION_RING (1 << 24) // programs that can go back further than this keep every position
 
 #define INTERPRET 1 
 #define DONT_INTERPRET 0
@@ -16,17 +20,13 @@
 
 
 typedef struct positionStack *PositionStack ;
-typedef struct positionNode *PositionNode ;
 typedef struct turtle *Turtle ;
-typedef struct variable *Variable;
-typedef struct valStack *ValStack;
-typedef struct valNode *ValNode;
 
 // all possible tokens
 enum tokenType {
   fd, lt, rt, varnum, var, set, polish, op, equals, val, semicolon,
   from, to, openBrace, closeBrace, doToken, whileToken, num, noToken, assignedVar, unassignedVar, bkStep,
-  moreThan, lessThan, penChange, colour, randomColour, advanceColour
+  moreThan, lessThan, penChange, colour, randomColour, advanceColour, colourName
 } ;
 typedef enum tokenType TokenType;
 
@@ -40,6 +40,30 @@ enum penUpDown {
 } ;
 typedef enum penUpDown PenUpDown;
 
+// a position and angle the turtle can be moved back to with BKSTP
+struct positionRecord {
+    double x, y;
+    int32_t angle;
+} ;
+typedef struct positionRecord PositionRecord;
+
+// the same as a PositionRecord at half the size, used when compact positions are switched on
+struct compactPositionRecord {
+    float x, y;
+    int32_t angle;
+} ;
+typedef struct compactPositionRecord CompactPositionRecord;
+
+// what a run that only follows the turtle's geometry found out about a program. Filled in by measureProgram()
+struct measurement {
+    int64_t segments; // the segments FD drew with the pen down, before any were merged
+    Box bounds; // round every segment drawn. Only set if segments is above 0
+    int64_t positions; // the positions stored and not yet gone back through, however many the position stack keeps
+    int64_t maxPositions; // the most positions BKSTP could go back through at once
+    double seconds; // how long the measuring run took
+} ;
+typedef struct measurement Measurement;
+
 // SETUP/SHUTDOWN FUNCTIONS
 void setUpForInterpreting(int testMode, int interpretMode);
 void shutDownInterpreting();
@@ -49,26 +73,20 @@ void   createTurtle();
 Turtle getTurtlePointer(Turtle newTurtle);
 void   initialiseTurtle(int testMode, int interpretMode);
 void   initialiseVariableList(Turtle t);
-void   freeTurtle();
+void   reserveVariableSlots(int numOfSlots);
 
 // POSITION STACK FUNCTIONS
 void          createPositionStack();
 PositionStack getPositionStackPointer(PositionStack newStack);
-void          freePositionStack();
-
-// POSITION NODE FUNCTIONS
-PositionNode newPositionNode();
-void         pushToPositionStack(PositionNode pNode);
-PositionNode popFromPositionStack();
-
-// VAL STACK FUNCTIONS
-void     createValStack();
-ValStack getValStackPointer(ValStack newStack);
-void     pushToValStack(double val);
-ValNode  newValNode();
-int      popFromValStack(double *poppedVal);
-int      getNumberOfValsOnStack();
-void     freeValStack();
+void          setCompactPositions(int compact);
+int           getCompactPositions();
+void          limitPositionHistory(int64_t maxSteps);
+
+// POSITION RECORD FUNCTIONS
+void    pushToPositionStack(double x, double y, int angle);
+void    growPositionStack(PositionStack pStack);
+int     popFromPositionStack(int64_t steps, double *x, double *y, int *angle);
+int64_t getNumberOfPositions();
 
 // MOVE HANDLING FUNCTIONS
 void doAction(TokenType actionType, double val);
@@ -76,6 +94,11 @@ void moveTurtle(int moveLength);
 void storeTurtlePosition(Turtle t);
 void backstep(Turtle t, int steps);
 
+// MEASURING FUNCTIONS
+void         setMeasurement(Measurement *m);
+Measurement *getMeasurement();
+void         measureSegment(Measurement *m, double x0, double y0, double x1, double y1);
+
 // DRAWING STYLE FUNCTIONS
 void switchPenStatus();
 void advanceTurtleColour();
@@ -85,24 +108,32 @@ void applyTurtleColour(Clr colour);
 
 // MATHS FUNCTIONS
 double degreesToRad(int deg);
+void   buildTrigTables();
+double getSinOfAngle(int deg);
+double getCosOfAngle(int deg);
 double doMaths(double a, double b, mathSymbol op);
 
 // INFORMATION RETURNING FUNCTIONS
 double getVariableVal(char c);
+double getSlotVal(int slot);
 int    checkValidVariable(char c);
 int    checkVariableAssigned(char c, int interpret, double *valToSet);
+int    checkSlotAssigned(int slot, int interpret, double *valToSet);
 int    checkForNumber(char *token, double *valToSet);
 void   assignValToVariable(char varToSet, double val, int interpret);
+void   assignValToSlot(int slot, double val, int interpret);
 int    getTurtleX();
 int    getTurtleY();
 int    getTurtleAngle();
 Clr    getTurtleColour();
+int    getDrawTurtle();
+int64_t getSegmentsDrawn();
+int64_t getPositionsStored();
 
 // WHITE BOX TESTING FUNCTIONS
 void runInterpreterWhiteBoxTests();
 void testTurtleInitialisation();
 void testTurtleActions();
-void testValStack();
 void testPositionStack();
 
 
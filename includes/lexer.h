@@ -0,0 +1,112 @@
+#include "interpreter.h"
+#include <pthread.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#define LEX_PARALLEL_THRESHOLD 1048576 // files smaller than this (in bytes) are always lexed on one thread
+#define MAX_LEX_THREADS 64 // upper limit on the number of chunks a file is split into
+
+#define AUTO_LEX_THREADS 0 // passed to setLexThreads() to pick the thread count from the file size and number of cores
+
+#define STREAM_BLOCK_SIZE 65536 // bytes read from the file at a time when streaming
+#define INITIAL_WINDOW_SIZE 256 // number of tokens the window starts with room for when streaming
+
+#define KEYWORD_TABLE_SIZE 64 // number of slots in the keyword hash table (must be 2^KEYWORD_HASH_BITS)
+#define KEYWORD_HASH_BITS 6
+#define KEYWORD_HASH_MULTIPLIER 2654446863u // chosen by searching for a multiplier that gives every keyword and colour its own slot
+#define KEYWORD_MAX_LENGTH 5 // no keyword is longer than this, so longer tokens skip the hash table
+
+#define UNRESOLVED_SLOT -1 // the slot classifyToken() gives named variables. The lexer then looks the name up in its symbol table
+#define INITIAL_SYMBOL_BUCKETS 64 // must be a power of 2
+#define EMPTY_BUCKET -1
+
+// results of checkBraceBalance()
+enum braceBalance {
+    bracesOK, bracesUnclosed, bracesExtraInput, bracesUnchecked
+} ;
+typedef enum braceBalance BraceBalance;
+
+// a token classified once by the lexer, so the parser only has to switch on its type
+struct token {
+    TokenType type; // var, num, op, colourName, noToken or any keyword type
+    int slot; // the variable slot of var tokens, the mathSymbol of op tokens or the Clr of colourName tokens
+    double val; // the value of num tokens
+    int64_t textOffset; // where the token as written in the file starts in the stream's text. Used in syntax errors
+    int32_t line, column; // where the token starts in the source file, counting from 1
+} ;
+typedef struct token Token;
+
+// an entry in the keyword hash table
+struct keyword {
+    char *text;
+    TokenType type;
+    int slot;
+} ;
+
+typedef struct tokenStream *TokenStream;
+typedef struct lexChunk *LexChunk;
+typedef struct symbolTable *SymbolTable;
+
+// LEXING FUNCTIONS
+TokenStream lexFile(char *filePath, int numOfThreads);
+TokenStream createTokenStream();
+void        lexSource(TokenStream ts, int numOfThreads);
+void        loadSourceFile(TokenStream ts, char *filePath);
+int         chooseNumberOfChunks(TokenStream ts, int numOfThreads);
+void        splitIntoChunks(TokenStream ts, LexChunk chunks, int numOfChunks);
+void       *lexChunk(void *chunkPointer);
+void        addTokenToChunk(LexChunk chunk, char *text, int32_t line, char *lineStart);
+void        stitchChunks(TokenStream ts, LexChunk chunks, int numOfChunks);
+TokenStream wrapBytecodeTokens(void *bytecode, size_t bytecodeSize, Token *tokens, int64_t numOfTokens, char *text, BraceBalance braceBalance, SymbolTable symbols);
+void        freeTokenStream(TokenStream ts);
+
+// STREAMING FUNCTIONS
+TokenStream openTokenStream(char *filePath);
+int         refillReadBuffer(TokenStream ts);
+int         lexNextStreamToken(TokenStream ts);
+void        makeRoomInWindow(TokenStream ts, size_t textLength);
+void        dropReleasedTokens(TokenStream ts);
+
+// TOKEN CLASSIFYING FUNCTIONS
+void        classifyToken(Token *token, char *text);
+uint32_t    keywordHash(char *text);
+int         checkForKeyword(Token *token, char *text);
+int         checkForOperator(Token *token, char *text);
+int         checkForIdentifier(char *text);
+
+// SYMBOL TABLE FUNCTIONS
+SymbolTable createSymbolTable(int copyNames);
+int         internSymbol(SymbolTable symbols, char *name);
+int         findSymbol(SymbolTable symbols, char *name);
+uint32_t    symbolHash(char *name);
+void        growSymbolBuckets(SymbolTable symbols);
+void        freeSymbolTable(SymbolTable symbols);
+int         getNumberOfSlots(TokenStream ts);
+char       *getSlotName(TokenStream ts, int slot);
+int         findVariableSlot(TokenStream ts, char *name);
+
+// TOKEN STREAM FUNCTIONS
+int64_t     getNumberOfTokens(TokenStream ts);
+Token      *getStreamToken(TokenStream ts, int64_t index);
+char       *getTokenText(TokenStream ts, Token *token);
+void        releaseTokensBefore(TokenStream ts, int64_t index);
+char       *getTextBuffer(TokenStream ts, size_t *textSize);
+char       *getSourceBuffer(TokenStream ts, size_t *sourceSize);
+int         checkLoadedFromBytecode(TokenStream ts);
+int64_t     getLargestWindow(TokenStream ts);
+BraceBalance checkBraceBalance(TokenStream ts);
+
+// LEXER SETTINGS
+void setLexThreads(int numOfThreads);
+int  getLexThreads();
+
+// WHITE BOX TESTING FUNCTIONS
+void runLexerWhiteBoxTests();
+void testChunkedLexing();
+void testBraceBalance();
+void testStreamingWindow();
+void testKeywordTable();
+void testTokenClassification();
+void testTokenPositions();
+void testSymbolTable();
+
@@ -1,8 +1,7 @@
-#include "interpreter.h"
-
-#define TOKEN_LENGTH 100 // maximum token length
+#include "analysis.h"
 
 #define TEST_WITH_SYNTAX_ERRORS 0 //set to 1 to display syntax errors during testing
+#define NO_EXPRESSION_START -1 // the ParseHandler's expressionStart while no SET expression is being compiled
 
 typedef struct parseHandler *ParseHandler;
 
@@ -10,19 +9,28 @@ typedef struct parseHandler *ParseHandler;
 void         setUpForParsing(char *filePath, int testMode, int interpretMode);
 void         createParseHandler();
 ParseHandler getParseHandlerPointer(ParseHandler newHandler);
-void         initialiseParseHandler(char *filePath, int testMode);
+void         initialiseParseHandler(char *filePath, int testMode, int interpretMode);
 void         shutDownParsing();
 
 // PARSE HANDLER FUNCTIONS
-void resizeTokenArray(ParseHandler pH);
 void freeParseHandler();
+void openLoop(ParseHandler pH, int64_t loopStartIndex);
+void countLoopPass(ParseHandler pH);
+int  closeLoop(ParseHandler pH, int loopResult);
+void setStreamingValidation(int streaming);
+int  getStreamingValidation();
+void setEstimateOnly(int estimate);
+int  getEstimateOnly();
 
 // PARSING FUNCTIONS
 int       parse(char * filePath, int testMode);
 int       interpret(char *filePath, int testMode);
+int       interpretOnProducerThread(ParseHandler pH);
+void     *runProducerThread(void *data);
+int       measureProgram(char *filePath, Measurement *m);
+void      printMeasurement(FILE *out, char *filePath, Measurement *m);
 int       getToken(ParseHandler pH);
-TokenType whatToken(char *token);
-int       sameString(char *a, char *b);
+TokenType whatToken(Token *token);
 int       checkForEndOfCode(ParseHandler pH);
 int       syntaxError(ParseHandler pH, char *message);
 
@@ -30,25 +38,24 @@ int       syntaxError(ParseHandler pH, char *message);
 int  processMain(ParseHandler pH);
 int  processInstructionList(ParseHandler pH);
 int  processInstruction(ParseHandler pH);
+int  runInstruction(ParseHandler pH);
 int  processAction(ParseHandler pH);
 int  processSet(ParseHandler pH);
 int  processPolish(ParseHandler pH);
-int  processOperator(ParseHandler pH);
-int  finishPolish(ParseHandler pH);
+int  compilePolish(ParseHandler pH, int id);
 int  processDo(ParseHandler pH);
-int  executeUpwardsDoLoop(ParseHandler pH, int doLoopStartIndex, char loopVariable, int loopVal, int loopTargetVal);
-int  executeDownwardsDoLoop(ParseHandler pH, int doLoopStartIndex, char loopVariable, int loopVal, int loopTargetVal);
+int  executeUpwardsDoLoop(ParseHandler pH, int64_t doLoopStartIndex, int loopSlot, int loopVal, int loopTargetVal);
+int  executeDownwardsDoLoop(ParseHandler pH, int64_t doLoopStartIndex, int loopSlot, int loopVal, int loopTargetVal);
 int  processWhile(ParseHandler pH);
-int  executeWhileLoop(ParseHandler pH, TokenType loopType, char loopVariable, double loopTargetVal, int loopStartIndex);
+int  executeWhileLoop(ParseHandler pH, TokenType loopType, int loopSlot, double loopTargetVal, int64_t loopStartIndex);
 int  skipLoop(ParseHandler pH);
 int  processColour(ParseHandler pH);
 
 // TOKEN CHECKING FUNCTIONS
-int    checkForVarNum(char * token);
-int    checkForAnyVar(char * token);
-int    checkForInstruction(char *chkToken);
-int    checkForValidOperator(char *c, ParseHandler pH);
-int    checkForColour(char *token, ParseHandler pH);
+int    checkForVarNum(Token *token);
+int    checkForAnyVar(Token *token);
+int    checkForInstruction(Token *token);
+int    checkForColour(Token *token, ParseHandler pH);
 double getCurrentTokenVal(ParseHandler pH);
 
 // TESTING FUNCTIONS
@@ -56,6 +63,8 @@ double getCurrentTokenVal(ParseHandler pH);
 void runParserWhiteBoxTests();
 void testHandlerInitialisation();
 void testSetAssignment();
+void testStreamingValidation();
+void testProgramMeasurement();
 
 // BLACK
 void runInterpreterBlackBoxTests();
@@ -0,0 +1,65 @@
+#include "bytecode.h"
+#include <time.h>
+
+#define INITIAL_PROFILE_LINES 256 // number of source lines the profile starts with room for
+#define NO_LOOP -1
+
+typedef struct profile *Profile;
+
+// everything attributed to one line of the source. Loop instructions only count their own executions here - what runs inside the loop is
+// counted against the lines it is written on, and against the loop in its LoopProfile
+struct lineProfile {
+    int64_t executions; // the number of instructions starting on this line that have been run
+    int64_t nanoseconds;
+    int64_t segments;
+    int64_t positions; // pushes to the position stack
+    int firstLoop; // the first loop starting on this line, or NO_LOOP
+} ;
+typedef struct lineProfile LineProfile;
+
+// totals for everything run inside one DO or WHILE loop, including any loops nested in it
+struct loopProfile {
+    int32_t line, column;
+    TokenType type;
+    int64_t entries; // the number of times the loop instruction was reached
+    int64_t passes; // the number of times the loop body was run
+    int64_t nanoseconds;
+    int64_t segments;
+    int64_t positions;
+    int nextOnLine; // the next loop starting on the same line, or NO_LOOP
+} ;
+typedef struct loopProfile LoopProfile;
+
+// the counters when an instruction started, so its cost can be found when it finishes
+struct profileMark {
+    struct timespec start;
+    int64_t segments;
+    int64_t positions;
+} ;
+typedef struct profileMark ProfileMark;
+
+// SETUP/SHUTDOWN FUNCTIONS
+void    startProfile();
+Profile getProfilePointer(Profile newProfile);
+void    freeProfile();
+
+// RECORDING FUNCTIONS
+void         markInstructionStart(ProfileMark *mark);
+void         recordInstruction(ProfileMark *mark, Token *instruction, int64_t loopPasses);
+LineProfile *getLineProfile(int32_t line);
+LoopProfile *getLoopProfile(int32_t line, int32_t column, TokenType type);
+int64_t      nanosecondsSince(struct timespec *start);
+
+// REPORTING FUNCTIONS
+void printProfile(FILE *out, char *filePath);
+void printLoopProfiles(FILE *out);
+
+// PROFILER SETTINGS
+void setProfiling(int profiling);
+int  getProfiling();
+
+// WHITE BOX TESTING FUNCTIONS
+void runProfilerWhiteBoxTests();
+void testLineProfile();
+void testLoopProfile();
+
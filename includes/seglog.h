@@ -0,0 +1,66 @@
+#include "tilerender.h"
+
+#define SEGLOG_MAGIC "TSL"
+#define SEGLOG_VERSION 1 // bump whenever the layout of the header, the blocks or the index changes
+#define SEGLOG_BYTE_ORDER_MARK 0x01020304u
+#define SEGLOG_QUANTUM 256 // coordinates are stored as whole multiples of 1/SEGLOG_QUANTUM of a pixel
+#define SEGLOG_BLOCK_SEGMENTS 4096 // segments in each block. Each block can be decoded without any of the others
+#define SEGLOG_MAX_COORDINATE 1e15 // coordinates further out than this can't be stored
+#define SEGLOG_MAX_QUANTIZED ((int64_t) (SEGLOG_MAX_COORDINATE * SEGLOG_QUANTUM))
+#define SEGLOG_MOVE_FLAG 0x08 // set in a segment's tag when it doesn't start where the one before it ended (the pen was lifted between them)
+#define SEGLOG_COLOUR_MASK 0x07
+
+typedef struct segmentLog *SegmentLog;
+
+// the start of a segment log. It is followed by the blocks of segments and then by the block index, one SegmentLogBlock per block.
+// Each segment in a block is a tag byte holding its colour and SEGLOG_MOVE_FLAG then, if the flag is set, the distance from the end of
+// the previous segment (or from the origin, for the first in a block) to its start, then the distance from its start to its end. Every
+// distance is an x and a y, zigzag encoded into unsigned numbers and written 7 bits a byte
+struct segmentLogHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t quantum;
+    int64_t numOfSegments;
+    int64_t numOfBlocks;
+    uint64_t indexOffset; // where the block index starts, from the start of the file. It runs to the end of the file
+} ;
+typedef struct segmentLogHeader SegmentLogHeader;
+
+// an entry in the block index at the end of a segment log
+struct segmentLogBlock {
+    uint64_t offset; // from the start of the file
+    uint64_t size;
+    int64_t firstSegment;
+    int64_t numOfSegments;
+    double minX, minY, maxX, maxY; // round every segment in the block, so a reader can skip blocks outside the area it wants
+} ;
+typedef struct segmentLogBlock SegmentLogBlock;
+
+// SAVING FUNCTIONS
+int     writeSegmentLog(DisplayList dl, char *filePath);
+size_t  encodeSegmentBlock(DisplayList dl, int64_t first, int64_t last, uint8_t *buffer, SegmentLogBlock *block);
+int64_t quantizeCoordinate(double coordinate);
+size_t  writeVarint(uint8_t *buffer, int64_t value);
+void    setSegmentLogPath(char *filePath);
+char   *getSegmentLogPath();
+
+// LOADING FUNCTIONS
+SegmentLog       openSegmentLog(char *filePath);
+int              checkSegmentLogHeader(SegmentLogHeader *header, size_t fileSize);
+void             closeSegmentLog(SegmentLog log);
+int64_t          getNumberOfBlocks(SegmentLog log);
+SegmentLogBlock *getSegmentLogBlock(SegmentLog log, int64_t block);
+int              decodeSegmentBlock(SegmentLog log, int64_t block);
+int              addQuantizedDelta(int64_t *coordinate, int64_t delta);
+size_t           readVarint(uint8_t *buffer, size_t available, int64_t *value);
+
+// REPLAY FUNCTIONS
+int  loadSegmentLog(char *filePath);
+void replaySegmentLog(char *filePath);
+
+// WHITE BOX TESTING FUNCTIONS
+void runSegmentLogWhiteBoxTests();
+void testSegmentLogRoundTrip();
+void testSegmentLogRejection();
+
@@ -0,0 +1,50 @@
+#include "displaylist.h"
+
+#define INDEX_FANOUT 16 // the number of segments in each leaf, and of children in each node above
+#define MAX_INDEX_LEVELS 16 // enough for INDEX_FANOUT^16 segments
+#define MORTON_BITS 16 // bits of each coordinate in the keys segments are sorted on
+
+typedef struct segmentIndex *SegmentIndex;
+
+// an axis aligned rectangle. Used for the area a query covers and for the boxes round nodes of the index
+struct box {
+    double minX, minY, maxX, maxY;
+} ;
+typedef struct box Box;
+
+// called with the display list index of each segment a query finds
+typedef void (*SegmentVisitor)(int64_t segment, void *data);
+
+// SETUP FUNCTIONS
+SegmentIndex getSegmentIndex(DisplayList dl);
+
+// BUILDING FUNCTIONS
+void     updateSegmentIndex(SegmentIndex si);
+void     buildSegmentIndex(SegmentIndex si, int64_t numOfSegments);
+void     reserveIndexSpace(SegmentIndex si, int64_t numOfSegments, int64_t numOfNodes);
+void     sortSegmentsByMortonKey(SegmentIndex si, int64_t numOfSegments, Box world);
+uint32_t interleaveBits(uint32_t x, uint32_t y);
+Box      getSegmentBox(DisplayList dl, int64_t index);
+void     addToBox(Box *box, Box *other);
+
+// QUERY FUNCTIONS
+int64_t querySegmentIndex(SegmentIndex si, Box area, SegmentVisitor visit, void *data);
+int64_t findSegmentsInArea(SegmentIndex si, Box area, int64_t **segments);
+void    markFoundSegment(int64_t segment, void *data);
+void    freeFoundSegments(int64_t *segments, int64_t numOfSegments);
+int     checkBoxesOverlap(Box *a, Box *b);
+int64_t getNumberIndexed(SegmentIndex si);
+
+// CLIPPING FUNCTIONS
+int clipSegmentToBox(double *x0, double *y0, double *x1, double *y1, Box *box);
+int clipAgainstEdge(double p, double q, double *tEnter, double *tLeave);
+
+// WHITE BOX TESTING FUNCTIONS
+void runSegmentIndexWhiteBoxTests();
+void testSegmentIndexBuilding();
+void testSegmentIndexQueries();
+void testSegmentClipping();
+void addSegmentGrid(int gridSize);
+void countVisit(int64_t segment, void *data);
+void markVisit(int64_t segment, void *data);
+
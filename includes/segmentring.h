@@ -0,0 +1,35 @@
+#include "framebuffer.h"
+#include <time.h>
+
+#define SEGMENT_RING_SIZE 65536 // segments the ring holds, enough for the drawing thread to take them once a frame. Must be a power of 2
+#define SEGMENT_RING_BATCH 64 // the most segments the drawing side takes from the ring at once
+#define RING_WAIT_NANOSECONDS 100000 // how long a side sleeps before looking again when the ring is full (or empty)
+#define CACHE_LINE 64
+
+typedef struct segmentRing *SegmentRing;
+
+// a segment on its way from the interpreter to the window, with the colour it is drawn in
+struct ringSegment {
+    double x0, y0, x1, y1;
+    uint8_t colour;
+} ;
+typedef struct ringSegment RingSegment;
+
+// SETUP FUNCTIONS
+SegmentRing createSegmentRing();
+void        setSegmentRing(SegmentRing ring);
+SegmentRing getSegmentRing();
+
+// RING FUNCTIONS
+void pushToSegmentRing(SegmentRing ring, RingSegment *segment);
+int  popFromSegmentRing(SegmentRing ring, RingSegment *batch, int maxSegments);
+void closeSegmentRing(SegmentRing ring);
+int  checkSegmentRingClosed(SegmentRing ring);
+void waitForSegmentRing();
+
+// WHITE BOX TESTING FUNCTIONS
+void  runSegmentRingWhiteBoxTests();
+void  testSegmentRingOrder();
+void  testSegmentRingThreads();
+void *pushTestSegments(void *data);
+
@@ -0,0 +1,38 @@
+#include "display.h"
+
+#define TILE_SIZE 64 // tiles are TILE_SIZE pixels square, apart from those along the right and bottom edges
+#define TILE_MARGIN 2 // pixels either side of a line's path that it may touch, so it is binned into every tile it can draw in
+#define AUTO_RENDER_THREADS 0 // passed to setRenderThreads() to pick the thread count from the number of segments and cores
+#define MAX_RENDER_THREADS 64
+#define RENDER_PARALLEL_THRESHOLD 4096 // drawings with fewer segments than this are rendered on one thread
+#define OUT_OF_VIEW 0xFF // the colour given to segments that miss the view, so they aren't binned
+
+typedef struct tileRender *TileRender;
+
+// a display list segment in pixels, once it has been clipped to the view and mapped to the framebuffer
+struct rasterSegment {
+    int x0, y0, x1, y1;
+    uint8_t colour;
+} ;
+typedef struct rasterSegment RasterSegment;
+
+// SETUP FUNCTIONS
+void setRenderThreads(int numOfThreads);
+int  getRenderThreads();
+int  chooseRenderThreads(int64_t numOfSegments);
+
+// RENDERING FUNCTIONS
+int64_t renderDisplayList(Framebuffer fb, DisplayList dl, Box view);
+void    runRenderPhase(TileRender render, void *(*phase)(void*));
+void   *mapAndCountSegments(void *data);
+void   *fillTileBins(void *data);
+void   *drawTiles(void *data);
+void    binSegment(TileRender render, RasterSegment *s, int64_t segment, int64_t *cursor, int64_t *bins);
+void    drawTile(TileRender render, int tile, Pen *pen);
+void    mapToImage(Box view, int width, int height, double x, double y, int *imageX, int *imageY);
+
+// WHITE BOX TESTING FUNCTIONS
+void runTileRenderWhiteBoxTests();
+void testTileBinning();
+void testTiledRendering();
+
@@ -8,10 +8,13 @@
 #define TEST_BLACKBOX 2
 #define TEST_SYSTEM 3
 #define TEST_ALL 4
+#define REPLAY 5
 
 void runFullProgram(char *filePath);
 int  checkInput(int argc, char *argv[], int testMode);
 void exitWithCommandLineError();
+int  processOptions(int argc, char *argv[]);
+int  readOptionNumber(char *text, long long min, long long max, long long *value);
 int  getStartMode(int argc, char *argv[]);
 
 
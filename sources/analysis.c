@@ -0,0 +1,180 @@
+#include "../includes/analysis.h"
+
+
+
+//  ANALYSIS FUNCTIONS  //////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// returns the most positions any BKSTP in the program can need to go back through, or UNBOUNDED_BACKSTEP_DEPTH if there is no limit.
+// The tokens are scanned without being validated - anything after a syntax error is never run, so it can only make the answer larger
+int64_t findMaxBackstepDepth(TokenStream ts)
+{
+    StackEffect blocks[MAX_ANALYSIS_DEPTH];
+    int isLoop[MAX_ANALYSIS_DEPTH];
+    int numOfBlocks = 1;
+    int loopPending = 0; // set between a DO or WHILE and the brace opening its body
+    blocks[0] = noStackEffect();
+    isLoop[0] = 0;
+
+    int64_t numOfTokens = getNumberOfTokens(ts);
+    for(int64_t i = 0; i < numOfTokens; i++) {
+        Token *token = getStreamToken(ts, i);
+        StackEffect step = noStackEffect();
+
+        switch(token->type) {
+            case fd :
+            case lt :
+            case rt :
+                step.net = 1;
+                break;
+            case bkStep : {
+                Token *steps = (i+1 < numOfTokens) ? getStreamToken(ts, i+1) : NULL;
+                if(steps == NULL || steps->type != num || steps->val >= INT32_MAX || steps->val <= INT32_MIN) {
+                    return UNBOUNDED_BACKSTEP_DEPTH;
+                }
+                int64_t n = (int64_t) (int) steps->val;
+                if(n > 0) {
+                    step.net = -n;
+                    step.depth = n;
+                    step.drawdown = n;
+                }
+                break;
+            }
+            case doToken :
+            case whileToken :
+                loopPending = 1;
+                continue;
+            case openBrace :
+                if(numOfBlocks == MAX_ANALYSIS_DEPTH) {
+                    return UNBOUNDED_BACKSTEP_DEPTH;
+                }
+                blocks[numOfBlocks] = noStackEffect();
+                isLoop[numOfBlocks] = loopPending;
+                numOfBlocks++;
+                loopPending = 0;
+                continue;
+            case closeBrace :
+                if(numOfBlocks == 1) {
+                    continue;
+                }
+                numOfBlocks--;
+                step = isLoop[numOfBlocks] ? repeatStackEffect(blocks[numOfBlocks]) : blocks[numOfBlocks];
+                break;
+            default :
+                continue;
+        }
+        blocks[numOfBlocks-1] = combineStackEffects(blocks[numOfBlocks-1], step);
+        if(blocks[numOfBlocks-1].unbounded) {
+            return UNBOUNDED_BACKSTEP_DEPTH;
+        }
+    }
+
+      // blocks left open by a missing brace still ran up to the end of the file
+    StackEffect program = blocks[0];
+    for(int b = 1; b < numOfBlocks; b++) {
+        program = combineStackEffects(program, blocks[b]);
+    }
+    return program.unbounded ? UNBOUNDED_BACKSTEP_DEPTH : program.drawdown;
+}
+
+StackEffect noStackEffect()
+{
+    StackEffect effect = {0, 0, 0, 0, 0};
+    return effect;
+}
+
+// the effect of running first and then second
+StackEffect combineStackEffects(StackEffect first, StackEffect second)
+{
+    StackEffect both;
+    both.net = first.net + second.net;
+    both.depth = (first.depth > second.depth - first.net) ? first.depth : second.depth - first.net;
+    both.peakAboveEnd = (second.peakAboveEnd > first.peakAboveEnd - second.net) ? second.peakAboveEnd : first.peakAboveEnd - second.net;
+    both.drawdown = first.drawdown;
+    if(second.drawdown > both.drawdown) {
+        both.drawdown = second.drawdown;
+    }
+      // falling from the high point of first to the low point of second
+    if(first.peakAboveEnd + second.depth > both.drawdown) {
+        both.drawdown = first.peakAboveEnd + second.depth;
+    }
+    both.unbounded = first.unbounded || second.unbounded;
+    return both;
+}
+
+// the effect of running body any number of times. If each pass ends higher (or level), every pass is no worse than the first two run
+// together. If each pass ends lower, enough passes can fall any distance
+StackEffect repeatStackEffect(StackEffect body)
+{
+    StackEffect loop = body;
+    if(body.net < 0) {
+        loop.unbounded = 1;
+        return loop;
+    }
+    if(body.peakAboveEnd + body.depth > loop.drawdown) {
+        loop.drawdown = body.peakAboveEnd + body.depth;
+    }
+      // zero passes leaves the height where it started
+    loop.net = 0;
+    return loop;
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runAnalysisWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testStackEffects(): Checking position stack effects are combined and repeated correctly");
+    sput_run_test(testStackEffects);
+    sput_leave_suite();
+
+    sput_enter_suite("testBackstepDepth(): Checking the rewind depth programs need is found");
+    sput_run_test(testBackstepDepth);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testStackEffects()
+{
+    StackEffect push = {1, 0, 0, 0, 0};
+    StackEffect backTwo = {-2, 2, 0, 2, 0};
+
+    StackEffect threePushes = combineStackEffects(combineStackEffects(push, push), push);
+    sput_fail_unless(threePushes.net == 3 && threePushes.peakAboveEnd == 0 && threePushes.drawdown == 0, "Pushes raise the height without any drawdown");
+
+    StackEffect run = combineStackEffects(threePushes, backTwo);
+    sput_fail_unless(run.net == 1 && run.peakAboveEnd == 2 && run.drawdown == 2, "BKSTP after pushes falls from the high point");
+
+    StackEffect fall = combineStackEffects(run, combineStackEffects(push, backTwo));
+    sput_fail_unless(fall.drawdown == 3 && fall.depth == 0, "Drawdown measured from the earlier high point");
+
+    StackEffect loop = repeatStackEffect(run);
+    sput_fail_unless(!loop.unbounded && loop.drawdown == 2, "Loop ending higher each pass is bounded");
+    sput_fail_unless(repeatStackEffect(backTwo).unbounded, "Loop ending lower each pass is unbounded");
+}
+
+void testBackstepDepth()
+{
+    TokenStream ts = lexFile("testingFiles/ANALYSIS_Testing/test_noBackstep.txt", 1);
+    sput_fail_unless(findMaxBackstepDepth(ts) == 0, "Program without BKSTP needs no history");
+    freeTokenStream(ts);
+
+    ts = lexFile("testingFiles/ANALYSIS_Testing/test_boundedBackstep.txt", 1);
+    sput_fail_unless(findMaxBackstepDepth(ts) == 3, "Consecutive BKSTPs after a loop need their combined depth");
+    freeTokenStream(ts);
+
+    ts = lexFile("testingFiles/ANALYSIS_Testing/test_loopedBackstep.txt", 1);
+    sput_fail_unless(findMaxBackstepDepth(ts) == UNBOUNDED_BACKSTEP_DEPTH, "BKSTP repeated in a loop without moves is unbounded");
+    freeTokenStream(ts);
+
+    ts = lexFile("testingFiles/ANALYSIS_Testing/test_variableBackstep.txt", 1);
+    sput_fail_unless(findMaxBackstepDepth(ts) == UNBOUNDED_BACKSTEP_DEPTH, "BKSTP given a variable is unbounded");
+    freeTokenStream(ts);
+}
@@ -0,0 +1,515 @@
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS and madvise(), which _POSIX_C_SOURCE hides
+#include "../includes/arena.h"
+#include "../includes/sput.h"
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+// a chunk of memory that allocations are bumped out of. Blocks are kept in a list, newest first
+struct arenaBlock {
+    char *memory;
+    size_t size;
+    size_t used;
+    int mapped; // set if the memory came from mmap() rather than malloc()
+    ArenaBlock next;
+} ;
+
+// owns every allocation made through it. Nothing is freed on its own - the whole arena is reset or freed at once
+struct arena {
+    ArenaBlock blocks; // the block allocations are currently made from, followed by the ones before it
+    size_t blockSize;
+    int hugePages;
+    void *last; // the most recent allocation, which arenaGrow() can extend in place
+} ;
+
+static Arena runArena = NULL;
+static int useHugePages = 0;
+
+static MemoryUsage memoryUsage[NUM_MEMORY_TAGS];
+static int64_t runMemory[NUM_MEMORY_TAGS]; // the part of each tag's current bytes that is in the run arena
+static pthread_mutex_t memoryLock = PTHREAD_MUTEX_INITIALIZER; // the lexer's threads count their tokens and names as they go
+static pthread_mutex_t runArenaLock = PTHREAD_MUTEX_INITIALIZER; // held for every change to the run arena and every look at its blocks
+static int memoryReport = 0;
+static int64_t memoryReportInterval = 0; // if set, the report is also printed every this many instructions
+static int64_t instructionsSinceReport = 0;
+static const char *memoryTagNames[NUM_MEMORY_TAGS] = {
+    "tokens", "variables", "parser", "turtle", "positions", "expressions", "display list", "segment index", "display", "profile"
+};
+
+
+
+//  SETUP/SHUTDOWN FUNCTIONS  ////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// if hugePages is set, blocks are mapped and the kernel is asked to back them with huge pages
+Arena createArena(size_t blockSize, int hugePages)
+{
+    Arena arena = (Arena) malloc(sizeof(struct arena));
+    if(arena == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for Arena in createArena()\n");
+        exit(1);
+    }
+    arena->blocks = NULL;
+    arena->blockSize = blockSize;
+    arena->hugePages = hugePages;
+    arena->last = NULL;
+    return arena;
+}
+
+// throws away every allocation, keeping the first block for the next run so a run of small programs never goes back to the system
+void resetArena(Arena arena)
+{
+    ArenaBlock block = arena->blocks;
+    while(block != NULL && block->next != NULL) {
+        ArenaBlock next = block->next;
+        freeArenaBlock(block);
+        block = next;
+    }
+    arena->blocks = block;
+    if(block != NULL) {
+        block->used = 0;
+    }
+    arena->last = NULL;
+}
+
+void freeArena(Arena arena)
+{
+    ArenaBlock block = arena->blocks;
+    while(block != NULL) {
+        ArenaBlock next = block->next;
+        freeArenaBlock(block);
+        block = next;
+    }
+    free(arena);
+}
+
+
+
+//  ALLOCATION FUNCTIONS  ////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// returns size bytes, aligned to ARENA_ALIGNMENT. The memory is not cleared
+void *arenaAlloc(Arena arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+    ArenaBlock block = arena->blocks;
+    if(block == NULL || block->size - block->used < size) {
+        block = newArenaBlock(arena, size);
+    }
+    void *memory = block->memory + block->used;
+    block->used += size;
+    arena->last = memory;
+    return memory;
+}
+
+void *arenaCalloc(Arena arena, size_t size)
+{
+    void *memory = arenaAlloc(arena, size);
+    memset(memory, 0, size);
+    return memory;
+}
+
+// returns size bytes starting on a multiple of alignment, which must be a power of 2. The memory is not cleared
+void *arenaAllocAligned(Arena arena, size_t size, size_t alignment)
+{
+    if(alignment <= ARENA_ALIGNMENT) {
+        return arenaAlloc(arena, size);
+    }
+    char *memory = (char*) arenaAlloc(arena, size + alignment - ARENA_ALIGNMENT);
+    char *aligned = (char*) (((uintptr_t) memory + alignment - 1) & ~((uintptr_t) alignment - 1));
+    arena->last = NULL; // the start has moved, so arenaGrow() mustn't extend it in place
+    return aligned;
+}
+
+// the arena's realloc. If old was the last allocation and there is room after it, it is extended where it is. Otherwise its contents
+// are copied to a new allocation and the old space is left unused until the arena is reset. Growing by doubling wastes at most as much
+// as the final size
+void *arenaGrow(Arena arena, void *old, size_t oldSize, size_t newSize)
+{
+    if(old == NULL) {
+        return arenaAlloc(arena, newSize);
+    }
+    size_t alignedOld = (oldSize + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+    size_t alignedNew = (newSize + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+    ArenaBlock block = arena->blocks;
+    if(old == arena->last && block->size - block->used + alignedOld >= alignedNew) {
+        block->used += alignedNew - alignedOld;
+        return old;
+    }
+    void *memory = arenaAlloc(arena, newSize);
+    memcpy(memory, old, oldSize < newSize ? oldSize : newSize);
+    return memory;
+}
+
+// adds a block big enough for minSize bytes to the front of the arena's list
+ArenaBlock newArenaBlock(Arena arena, size_t minSize)
+{
+    ArenaBlock block = (ArenaBlock) malloc(sizeof(struct arenaBlock));
+    if(block == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for ArenaBlock in newArenaBlock()\n");
+        exit(1);
+    }
+    block->size = (minSize > arena->blockSize) ? minSize : arena->blockSize;
+    block->used = 0;
+    block->mapped = 0;
+    block->memory = NULL;
+
+#if defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+    if(arena->hugePages) {
+        block->size = (block->size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+        void *memory = mmap(NULL, block->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(memory != MAP_FAILED) {
+              // only advice - if huge pages aren't available the block is still usable
+            madvise(memory, block->size, MADV_HUGEPAGE);
+            block->memory = (char*) memory;
+            block->mapped = 1;
+        }
+    }
+#endif
+    if(block->memory == NULL) {
+        block->memory = (char*) malloc(block->size);
+        if(block->memory == NULL) {
+            fprintf(stderr, "ERROR - unable to malloc %zu bytes for arena block in newArenaBlock()\n", block->size);
+            exit(1);
+        }
+    }
+
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return block;
+}
+
+void freeArenaBlock(ArenaBlock block)
+{
+    if(block->mapped) {
+        munmap(block->memory, block->size);
+    } else {
+        free(block->memory);
+    }
+    free(block);
+}
+
+// the number of bytes handed out since the arena was last reset, including space left behind by arenaGrow()
+size_t getArenaUsed(Arena arena)
+{
+    size_t used = 0;
+    for(ArenaBlock block = arena->blocks; block != NULL; block = block->next) {
+        used += block->used;
+    }
+    return used;
+}
+
+// the number of bytes the arena holds in its blocks
+size_t getArenaReserved(Arena arena)
+{
+    size_t reserved = 0;
+    for(ArenaBlock block = arena->blocks; block != NULL; block = block->next) {
+        reserved += block->size;
+    }
+    return reserved;
+}
+
+
+
+//  RUN ARENA FUNCTIONS  /////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// the run arena holds the parse handler, turtle, position stack, compiled expressions and display state of the program being run.
+// It is reset by shutDownInterpreting(), so all of them are released in one go. While a program is drawn in a window, the interpreter's
+// thread allocates from it as it compiles expressions and grows its stacks while the drawing thread grows the display list, so every
+// run arena function holds runArenaLock
+
+// returns the run arena, creating it the first time (or the first time after it was released)
+Arena getRunArena()
+{
+    if(runArena == NULL) {
+        runArena = createArena(ARENA_BLOCK_SIZE, useHugePages);
+    }
+    return runArena;
+}
+
+// every run arena allocation is counted against the part of the program it is for
+void *runAlloc(size_t size, MemoryTag tag)
+{
+    trackRunMemory(tag, 0, size);
+    pthread_mutex_lock(&runArenaLock);
+    void *memory = arenaAlloc(getRunArena(), size);
+    pthread_mutex_unlock(&runArenaLock);
+    return memory;
+}
+
+void *runCalloc(size_t size, MemoryTag tag)
+{
+    trackRunMemory(tag, 0, size);
+    pthread_mutex_lock(&runArenaLock);
+    void *memory = arenaCalloc(getRunArena(), size);
+    pthread_mutex_unlock(&runArenaLock);
+    return memory;
+}
+
+void *runAllocAligned(size_t size, size_t alignment, MemoryTag tag)
+{
+    trackRunMemory(tag, 0, size);
+    pthread_mutex_lock(&runArenaLock);
+    void *memory = arenaAllocAligned(getRunArena(), size, alignment);
+    pthread_mutex_unlock(&runArenaLock);
+    return memory;
+}
+
+void *runGrow(void *old, size_t oldSize, size_t newSize, MemoryTag tag)
+{
+    trackRunMemory(tag, oldSize, newSize);
+    pthread_mutex_lock(&runArenaLock);
+    void *memory = arenaGrow(getRunArena(), old, oldSize, newSize);
+    pthread_mutex_unlock(&runArenaLock);
+    return memory;
+}
+
+void resetRunArena()
+{
+    pthread_mutex_lock(&runArenaLock);
+    if(runArena != NULL) {
+        resetArena(runArena);
+    }
+    pthread_mutex_unlock(&runArenaLock);
+    releaseRunMemory();
+}
+
+// gives all of the run arena's memory back. The next allocation creates it again
+void releaseRunArena()
+{
+    pthread_mutex_lock(&runArenaLock);
+    if(runArena != NULL) {
+        freeArena(runArena);
+        runArena = NULL;
+    }
+    pthread_mutex_unlock(&runArenaLock);
+    releaseRunMemory();
+}
+
+// chooses whether run arenas created from now on ask for huge pages
+void setHugePages(int hugePages)
+{
+    useHugePages = hugePages;
+}
+
+
+
+//  MEMORY ACCOUNTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// records that an allocation counted against tag has changed size from oldSize to newSize. A new allocation has an oldSize of 0 and
+// a freed one a newSize of 0
+void trackMemory(MemoryTag tag, size_t oldSize, size_t newSize)
+{
+    pthread_mutex_lock(&memoryLock);
+    countMemoryChange(tag, oldSize, newSize);
+    pthread_mutex_unlock(&memoryLock);
+}
+
+// as trackMemory(), for memory in the run arena, which is released all at once by releaseRunMemory()
+void trackRunMemory(MemoryTag tag, size_t oldSize, size_t newSize)
+{
+    pthread_mutex_lock(&memoryLock);
+    countMemoryChange(tag, oldSize, newSize);
+    runMemory[tag] += (int64_t) newSize - (int64_t) oldSize;
+    pthread_mutex_unlock(&memoryLock);
+}
+
+// updates tag's counts. Called with memoryLock held
+void countMemoryChange(MemoryTag tag, size_t oldSize, size_t newSize)
+{
+    MemoryUsage *usage = &memoryUsage[tag];
+    usage->current += (int64_t) newSize - (int64_t) oldSize;
+    if(newSize > oldSize) {
+        usage->allocations++;
+    }
+    if(usage->current > usage->peak) {
+        usage->peak = usage->current;
+    }
+}
+
+// called when the run arena is reset or freed
+void releaseRunMemory()
+{
+    pthread_mutex_lock(&memoryLock);
+    for(int tag = 0; tag < NUM_MEMORY_TAGS; tag++) {
+        memoryUsage[tag].current -= runMemory[tag];
+        runMemory[tag] = 0;
+    }
+    pthread_mutex_unlock(&memoryLock);
+}
+
+MemoryUsage getMemoryUsage(MemoryTag tag)
+{
+    pthread_mutex_lock(&memoryLock);
+    MemoryUsage usage = memoryUsage[tag];
+    pthread_mutex_unlock(&memoryLock);
+    return usage;
+}
+
+const char *getMemoryTagName(MemoryTag tag)
+{
+    return memoryTagNames[tag];
+}
+
+// the most physical memory the process has held at once, as reported by the kernel. Returns -1 if it isn't available
+long getPeakResidentKilobytes()
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+// prints the current and peak bytes and the allocation count of every tag, the run arena's size, and the process's peak resident memory
+void printMemoryReport(FILE *out, char *title)
+{
+    fprintf(out, "\nMEMORY REPORT: %s\n", title);
+    fprintf(out, "%-14s %16s %16s %12s\n", "part", "current bytes", "peak bytes", "allocations");
+    int64_t totalCurrent = 0;
+    for(int tag = 0; tag < NUM_MEMORY_TAGS; tag++) {
+        MemoryUsage usage = getMemoryUsage((MemoryTag) tag);
+        fprintf(out, "%-14s %16" PRId64 " %16" PRId64 " %12" PRId64 "\n", memoryTagNames[tag], usage.current, usage.peak, usage.allocations);
+        totalCurrent += usage.current;
+    }
+    fprintf(out, "%-14s %16" PRId64 "\n", "total", totalCurrent);
+      // the report may be printed from the interpreter's thread while the drawing thread is adding blocks to the run arena
+    pthread_mutex_lock(&runArenaLock);
+    int haveRunArena = runArena != NULL;
+    size_t runArenaUsed = haveRunArena ? getArenaUsed(runArena) : 0;
+    size_t runArenaReserved = haveRunArena ? getArenaReserved(runArena) : 0;
+    pthread_mutex_unlock(&runArenaLock);
+    if(haveRunArena) {
+        fprintf(out, "run arena: %zu bytes used of %zu reserved\n", runArenaUsed, runArenaReserved);
+    }
+    fprintf(out, "peak resident memory: %ld KB\n", getPeakResidentKilobytes());
+}
+
+// called for every instruction run while a memory report interval is set. Prints the report each time the interval is reached
+void countInstructionForMemoryReport()
+{
+    instructionsSinceReport++;
+    if(instructionsSinceReport >= memoryReportInterval) {
+        instructionsSinceReport = 0;
+        printMemoryReport(stdout, "during run");
+    }
+}
+
+void setMemoryReport(int report)
+{
+    memoryReport = report;
+}
+
+int getMemoryReport()
+{
+    return memoryReport;
+}
+
+// sets how many instructions are run between reports while the program runs. 0 only reports at the end
+void setMemoryReportInterval(int64_t instructions)
+{
+    memoryReportInterval = instructions > 0 ? instructions : 0;
+    instructionsSinceReport = 0;
+}
+
+int64_t getMemoryReportInterval()
+{
+    return memoryReportInterval;
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runArenaWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testArenaAllocation(): Checking memory is bumped out of arena blocks and grown in place");
+    sput_run_test(testArenaAllocation);
+    sput_leave_suite();
+
+    sput_enter_suite("testArenaReset(): Checking an arena is reused after a reset");
+    sput_run_test(testArenaReset);
+    sput_leave_suite();
+
+    sput_enter_suite("testMemoryAccounting(): Checking memory is counted against the right part of the program");
+    sput_run_test(testMemoryAccounting);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testArenaAllocation()
+{
+    Arena arena = createArena(4096, 0);
+    char *a = (char*) arenaAlloc(arena, 10);
+    char *b = (char*) arenaAlloc(arena, 100);
+    sput_fail_unless(b - a == ARENA_ALIGNMENT && (uintptr_t) b % ARENA_ALIGNMENT == 0, "Allocations are bumped along a block and aligned");
+    sput_fail_unless(getArenaUsed(arena) == ARENA_ALIGNMENT + 112 && getArenaReserved(arena) == 4096, "Used and reserved sizes counted");
+
+    memset(b, 7, 100);
+    char *grown = (char*) arenaGrow(arena, b, 100, 1000);
+    sput_fail_unless(grown == b && getArenaUsed(arena) == ARENA_ALIGNMENT + 1008, "Last allocation grown in place");
+    grown = (char*) arenaGrow(arena, a, 10, 20);
+    sput_fail_unless(grown != a && getArenaUsed(arena) == ARENA_ALIGNMENT + 1008 + 32, "Earlier allocation copied when grown");
+
+    char *big = (char*) arenaGrow(arena, b, 1000, 10000);
+    sput_fail_unless(big[0] == 7 && big[99] == 7 && getArenaReserved(arena) == 4096 + 10000, "Allocation too big for a block gets its own block");
+
+    char *aligned = (char*) arenaAllocAligned(arena, 100, 64);
+    sput_fail_unless((uintptr_t) aligned % 64 == 0, "Aligned allocation starts on the alignment");
+
+    int *zeroed = (int*) arenaCalloc(arena, 64 * sizeof(int));
+    int allZero = 1;
+    for(int i = 0; i < 64; i++) {
+        allZero = allZero && zeroed[i] == 0;
+    }
+    sput_fail_unless(allZero, "Calloc clears its allocation");
+    freeArena(arena);
+}
+
+void testArenaReset()
+{
+    Arena arena = createArena(4096, 0);
+    char *first = (char*) arenaAlloc(arena, 64);
+    arenaAlloc(arena, 8192);
+    arenaAlloc(arena, 8192);
+    resetArena(arena);
+    sput_fail_unless(getArenaUsed(arena) == 0 && getArenaReserved(arena) == 4096, "Reset keeps only the first block");
+    sput_fail_unless(arenaAlloc(arena, 64) == first, "Allocations after a reset reuse the first block");
+    freeArena(arena);
+
+    arena = createArena(4096, 1);
+    char *mapped = (char*) arenaAlloc(arena, 100);
+    mapped[99] = 1;
+    sput_fail_unless(mapped[99] == 1 && getArenaReserved(arena) >= 4096, "Arena asking for huge pages still allocates");
+    freeArena(arena);
+}
+
+void testMemoryAccounting()
+{
+    MemoryUsage before = getMemoryUsage(memProfile);
+    trackMemory(memProfile, 0, 1000);
+    trackMemory(memProfile, 1000, 3000);
+    trackMemory(memProfile, 3000, 0);
+    MemoryUsage after = getMemoryUsage(memProfile);
+    sput_fail_unless(after.current == before.current && after.allocations == before.allocations + 2, "Allocations counted and freed");
+    sput_fail_unless(after.peak >= before.current + 3000, "Peak kept after memory is freed");
+
+    resetRunArena();
+    before = getMemoryUsage(memTurtle);
+    runAlloc(100, memTurtle);
+    void *grown = runAlloc(10, memTurtle);
+    runGrow(grown, 10, 50, memTurtle);
+    sput_fail_unless(getMemoryUsage(memTurtle).current == before.current + 150, "Run arena allocations counted against their tag");
+    resetRunArena();
+    sput_fail_unless(getMemoryUsage(memTurtle).current == before.current, "Run arena memory released by a reset");
+    sput_fail_unless(getPeakResidentKilobytes() > 0, "Peak resident memory read");
+}
@@ -0,0 +1,468 @@
+#include "../includes/bytecode.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+
+#define CACHE_PATH_LENGTH 4096
+
+static char *cacheDirectory = NULL; // if set, validated programs are saved here and looked up by the hash of their source
+static char *emitPath = NULL; // if set, the next validated program is also saved to this file
+
+
+
+//  LOADING FUNCTIONS  ///////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// returns the tokens of the program at filePath. A .tbc file is mapped straight in. For a source file, the cache directory is checked for a
+// program compiled from the same source, and the file is only lexed if there isn't one. sourceHash is set to the hash of the source
+TokenStream openProgram(char *filePath, int numOfThreads, uint64_t *sourceHash)
+{
+    uint64_t storedHash = 0;
+    size_t storedSize = 0;
+
+    if(checkForBytecodeExtension(filePath)) {
+        TokenStream ts = loadBytecodeFile(filePath, sourceHash, &storedSize);
+        if(ts == NULL) {
+            fprintf(stderr, "ERROR: '%s' is not a bytecode file for this version of turtle\n", filePath);
+            exit(1);
+        }
+        return ts;
+    }
+
+    TokenStream ts = createTokenStream();
+    loadSourceFile(ts, filePath);
+    size_t sourceSize;
+    char *source = getSourceBuffer(ts, &sourceSize);
+    *sourceHash = hashSource(source, sourceSize);
+
+    if(cacheDirectory != NULL) {
+        char cachePath[CACHE_PATH_LENGTH];
+        makeCachePath(cachePath, CACHE_PATH_LENGTH, *sourceHash);
+        TokenStream cached = loadBytecodeFile(cachePath, &storedHash, &storedSize);
+        if(cached != NULL && storedHash == *sourceHash && storedSize == sourceSize) {
+            freeTokenStream(ts);
+            return cached;
+        }
+        if(cached != NULL) {
+            freeTokenStream(cached);
+        }
+    }
+
+    lexSource(ts, numOfThreads);
+    return ts;
+}
+
+// maps a .tbc file into memory and wraps its tokens in a TokenStream. Returns NULL if the file doesn't exist, was written by a different
+// version or on a different kind of machine, or is damaged. The hash and size of the source it was compiled from are passed back
+TokenStream loadBytecodeFile(char *filePath, uint64_t *sourceHash, size_t *sourceSize)
+{
+    int fd = open(filePath, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct stat fileInfo;
+    if(fstat(fd, &fileInfo) != 0 || (size_t) fileInfo.st_size < sizeof(BytecodeHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t fileSize = (size_t) fileInfo.st_size;
+    void *mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    BytecodeHeader *header = (BytecodeHeader*) mapping;
+    if(!checkBytecodeHeader(header, fileSize)) {
+        munmap(mapping, fileSize);
+        return NULL;
+    }
+    Token *tokens = (Token*) ((char*) mapping + header->tokensOffset);
+    char *text = (char*) mapping + header->textOffset;
+    SymbolTable symbols = loadBytecodeNames((int64_t*) ((char*) mapping + header->namesOffset), header->numOfNames, text, header->textSize);
+    if(symbols == NULL || !checkBytecodeTokens(tokens, header->numOfTokens, header->textSize, NUMBER_OF_VARIABLES + (int) header->numOfNames)) {
+        freeSymbolTable(symbols);
+        munmap(mapping, fileSize);
+        return NULL;
+    }
+
+    *sourceHash = header->sourceHash;
+    *sourceSize = (size_t) header->sourceSize;
+    return wrapBytecodeTokens(mapping, fileSize, tokens, header->numOfTokens, text, (BraceBalance) header->braceBalance, symbols);
+}
+
+// returns 1 if the header belongs to a file this build can read and every section it describes lies inside the file
+int checkBytecodeHeader(BytecodeHeader *header, size_t fileSize)
+{
+    if(memcmp(header->magic, TBC_MAGIC, sizeof(header->magic)) != 0 || header->version != TBC_VERSION) {
+        return 0;
+    }
+    if(header->byteOrderMark != TBC_BYTE_ORDER_MARK || header->tokenSize != sizeof(Token)) {
+        return 0;
+    }
+    if(header->numOfTokens < 0 || header->tokensOffset % sizeof(int64_t) != 0 || header->tokensOffset > fileSize) {
+        return 0;
+    }
+    if((uint64_t) header->numOfTokens > (fileSize - header->tokensOffset) / sizeof(Token)) {
+        return 0;
+    }
+    if(header->numOfNames < 0 || header->numOfNames > INT_MAX - NUMBER_OF_VARIABLES || header->namesOffset % sizeof(int64_t) != 0 ||
+       header->namesOffset < header->tokensOffset + header->numOfTokens * sizeof(Token) || header->namesOffset > fileSize) {
+        return 0;
+    }
+    if((uint64_t) header->numOfNames > (fileSize - header->namesOffset) / sizeof(int64_t)) {
+        return 0;
+    }
+    if(header->textOffset < header->namesOffset + header->numOfNames * sizeof(int64_t) || header->textOffset > fileSize) {
+        return 0;
+    }
+    if(header->textSize == 0 || header->textSize != fileSize - header->textOffset) {
+        return 0;
+    }
+      // the text must end with a null so the last token's text is terminated
+    char *text = (char*) header + header->textOffset;
+    return text[header->textSize - 1] == '\0';
+}
+
+// returns 1 if every token points into the text, has a type the parser knows and, if it is a variable, operator or colour name, has a
+// slot the interpreter can use: a slot in the symbol table, a mathSymbol or a Clr
+int checkBytecodeTokens(Token *tokens, int64_t numOfTokens, uint64_t textSize, int numOfSlots)
+{
+    for(int64_t i = 0; i < numOfTokens; i++) {
+        if(tokens[i].textOffset < 0 || (uint64_t) tokens[i].textOffset >= textSize) {
+            return 0;
+        }
+        if(tokens[i].type < 0 || tokens[i].type > colourName) {
+            return 0;
+        }
+        if(tokens[i].type == var && (tokens[i].slot < 0 || tokens[i].slot >= numOfSlots)) {
+            return 0;
+        }
+        if(tokens[i].type == op && (tokens[i].slot < add || tokens[i].slot > multiply)) {
+            return 0;
+        }
+        if(tokens[i].type == colourName && (tokens[i].slot < 0 || tokens[i].slot >= NUM_OF_COLOURS)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// rebuilds the symbol table from the names in the text, so each name gets back the slot it was saved with. Returns NULL if any name is
+// out of range or repeated
+SymbolTable loadBytecodeNames(int64_t *nameOffsets, int64_t numOfNames, char *text, uint64_t textSize)
+{
+    SymbolTable symbols = createSymbolTable(0);
+    for(int64_t i = 0; i < numOfNames; i++) {
+        if(nameOffsets[i] < 0 || (uint64_t) nameOffsets[i] >= textSize ||
+           internSymbol(symbols, text + nameOffsets[i]) != NUMBER_OF_VARIABLES + i) {
+            freeSymbolTable(symbols);
+            return NULL;
+        }
+    }
+    return symbols;
+}
+
+int checkForBytecodeExtension(char *filePath)
+{
+    size_t length = strlen(filePath);
+    size_t extensionLength = strlen(TBC_EXTENSION);
+    return length > extensionLength && strcmp(filePath + length - extensionLength, TBC_EXTENSION) == 0;
+}
+
+
+
+//  SAVING FUNCTIONS  ////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// called once a program has been validated. Saves it to the cache (unless it came from there) and to the emit path if one was given
+void saveValidatedProgram(TokenStream ts, uint64_t sourceHash)
+{
+    size_t textSize;
+    if(getTextBuffer(ts, &textSize) == NULL) {
+        return; // streamed, so the whole program was never held at once
+    }
+    if(cacheDirectory != NULL && !checkLoadedFromBytecode(ts)) {
+        char cachePath[CACHE_PATH_LENGTH];
+        makeCachePath(cachePath, CACHE_PATH_LENGTH, sourceHash);
+        if(!writeBytecodeFile(ts, sourceHash, cachePath)) {
+            fprintf(stderr, "WARNING: unable to write '%s' to the cache\n", cachePath);
+        }
+    }
+    if(emitPath != NULL && !writeBytecodeFile(ts, sourceHash, emitPath)) {
+        fprintf(stderr, "WARNING: unable to write bytecode file '%s'\n", emitPath);
+    }
+}
+
+// writes the header, tokens and text to a temporary file next to filePath and then renames it, so a reader never maps a half written file.
+// Returns 0 if the file couldn't be written
+int writeBytecodeFile(TokenStream ts, uint64_t sourceHash, char *filePath)
+{
+    size_t textSize;
+    char *text = getTextBuffer(ts, &textSize);
+    int64_t numOfTokens = getNumberOfTokens(ts);
+    Token *tokens = getStreamToken(ts, 0);
+
+    BytecodeHeader header;
+    memset(&header, 0, sizeof(BytecodeHeader));
+    memcpy(header.magic, TBC_MAGIC, sizeof(header.magic));
+    header.version = TBC_VERSION;
+    header.byteOrderMark = TBC_BYTE_ORDER_MARK;
+    header.tokenSize = sizeof(Token);
+    header.sourceHash = sourceHash;
+    header.sourceSize = textSize - 1;
+    header.numOfTokens = numOfTokens;
+    header.tokensOffset = sizeof(BytecodeHeader);
+    header.numOfNames = getNumberOfSlots(ts) - NUMBER_OF_VARIABLES;
+    header.namesOffset = header.tokensOffset + numOfTokens * sizeof(Token);
+    header.textOffset = header.namesOffset + header.numOfNames * sizeof(int64_t);
+    header.textSize = textSize;
+    header.braceBalance = checkBraceBalance(ts);
+
+    size_t tempLength = strlen(filePath) + 8;
+    char *tempPath = (char*) malloc(tempLength);
+    if(tempPath == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for temporary file name in writeBytecodeFile()\n");
+        exit(1);
+    }
+    snprintf(tempPath, tempLength, "%s.XXXXXX", filePath);
+    int fd = mkstemp(tempPath);
+    if(fd < 0) {
+        free(tempPath);
+        return 0;
+    }
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH); // mkstemp() only lets the owner read the file
+
+    FILE *file = fdopen(fd, "wb");
+    int written = file != NULL;
+    written = written && fwrite(&header, sizeof(BytecodeHeader), 1, file) == 1;
+    written = written && (numOfTokens == 0 || fwrite(tokens, sizeof(Token), numOfTokens, file) == (size_t) numOfTokens);
+    for(int64_t i = 0; written && i < header.numOfNames; i++) {
+        int64_t nameOffset = getSlotName(ts, NUMBER_OF_VARIABLES + (int) i) - text;
+        written = fwrite(&nameOffset, sizeof(int64_t), 1, file) == 1;
+    }
+    written = written && fwrite(text, 1, textSize, file) == textSize;
+    if(file != NULL) {
+        written = (fclose(file) == 0) && written;
+    } else {
+        close(fd);
+    }
+
+    written = written && rename(tempPath, filePath) == 0;
+    if(!written) {
+        unlink(tempPath);
+    }
+    free(tempPath);
+    return written;
+}
+
+// 64 bit FNV-1a hash of the source file, used as the cache key
+uint64_t hashSource(char *source, size_t sourceSize)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for(size_t i = 0; i < sourceSize; i++) {
+        hash ^= (unsigned char) source[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+void makeCachePath(char *cachePath, size_t length, uint64_t sourceHash)
+{
+    snprintf(cachePath, length, "%s/%016" PRIx64 TBC_EXTENSION, cacheDirectory, sourceHash);
+}
+
+
+
+//  BYTECODE SETTINGS  ///////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// sets the directory compiled programs are cached in. Passing NULL switches caching off
+void setCacheDirectory(char *directory)
+{
+    cacheDirectory = directory;
+}
+
+char *getCacheDirectory()
+{
+    return cacheDirectory;
+}
+
+// sets a file the next validated program is written to. Passing NULL switches this off
+void setEmitPath(char *filePath)
+{
+    emitPath = filePath;
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runBytecodeWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testBytecodeRoundTrip(): Checking programs saved as bytecode load back with the same tokens");
+    sput_run_test(testBytecodeRoundTrip);
+    sput_leave_suite();
+
+    sput_enter_suite("testBytecodeRejection(): Checking damaged or out of date bytecode files are not loaded");
+    sput_run_test(testBytecodeRejection);
+    sput_leave_suite();
+
+    sput_enter_suite("testCompileCache(): Checking validated programs are cached and found again by their source");
+    sput_run_test(testCompileCache);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testBytecodeRoundTrip()
+{
+    char directory[] = "/tmp/turtleTbcXXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        fprintf(stderr, "ERROR - unable to make temporary directory in testBytecodeRoundTrip()\n");
+        exit(1);
+    }
+    char path[CACHE_PATH_LENGTH];
+    snprintf(path, CACHE_PATH_LENGTH, "%s/program" TBC_EXTENSION, directory);
+
+    TokenStream lexed = lexFile("examples/dandelion.txt", 1);
+    sput_fail_unless(writeBytecodeFile(lexed, 42, path) == 1, "Lexed program written as bytecode");
+
+    uint64_t hash = 0;
+    size_t size = 0;
+    TokenStream loaded = loadBytecodeFile(path, &hash, &size);
+    sput_fail_unless(loaded != NULL && checkLoadedFromBytecode(loaded), "Bytecode file loaded");
+    sput_fail_unless(hash == 42, "Source hash read back from the bytecode file");
+
+    int allMatch = loaded != NULL && getNumberOfTokens(loaded) == getNumberOfTokens(lexed);
+    for(int64_t i = 0; allMatch && i < getNumberOfTokens(lexed); i++) {
+        Token *a = getStreamToken(lexed, i);
+        Token *b = getStreamToken(loaded, i);
+        if(strcmp(getTokenText(lexed, a), getTokenText(loaded, b)) != 0 || a->type != b->type || a->slot != b->slot || a->val != b->val) {
+            allMatch = 0;
+        }
+    }
+    sput_fail_unless(allMatch, "Loaded tokens match the lexed tokens");
+    sput_fail_unless(loaded != NULL && checkBraceBalance(loaded) == checkBraceBalance(lexed), "Brace balance kept in the bytecode file");
+
+    freeTokenStream(lexed);
+    if(loaded != NULL) {
+        freeTokenStream(loaded);
+    }
+
+    lexed = lexFile("testingFiles/VarNum_Testing/test_namedVariables.txt", 1);
+    writeBytecodeFile(lexed, 42, path);
+    loaded = loadBytecodeFile(path, &hash, &size);
+    sput_fail_unless(loaded != NULL && getNumberOfSlots(loaded) == getNumberOfSlots(lexed), "Named variables kept in the bytecode file");
+    sput_fail_unless(loaded != NULL && findVariableSlot(loaded, "STEP_2") == findVariableSlot(lexed, "STEP_2"), "Named variables keep their slots");
+    freeTokenStream(lexed);
+    if(loaded != NULL) {
+        freeTokenStream(loaded);
+    }
+
+    unlink(path);
+    rmdir(directory);
+}
+
+void testBytecodeRejection()
+{
+    char directory[] = "/tmp/turtleTbcXXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        fprintf(stderr, "ERROR - unable to make temporary directory in testBytecodeRejection()\n");
+        exit(1);
+    }
+    char path[CACHE_PATH_LENGTH];
+    snprintf(path, CACHE_PATH_LENGTH, "%s/program" TBC_EXTENSION, directory);
+    uint64_t hash;
+    size_t size;
+
+    sput_fail_unless(loadBytecodeFile(path, &hash, &size) == NULL, "Missing bytecode file not loaded");
+
+    TokenStream lexed = lexFile("testingFiles/parserTesting.txt", 1);
+    writeBytecodeFile(lexed, 0, path);
+    freeTokenStream(lexed);
+
+      // overwrite one field of the header at a time and check the file is refused
+    BytecodeHeader header;
+    FILE *file = fopen(path, "r+b");
+    if(file == NULL || fread(&header, sizeof(BytecodeHeader), 1, file) != 1) {
+        fprintf(stderr, "ERROR - unable to read back bytecode file in testBytecodeRejection()\n");
+        exit(1);
+    }
+    BytecodeHeader changed = header;
+    changed.version = TBC_VERSION + 1;
+    rewind(file);
+    fwrite(&changed, sizeof(BytecodeHeader), 1, file);
+    fflush(file);
+    sput_fail_unless(loadBytecodeFile(path, &hash, &size) == NULL, "Bytecode file from a different version not loaded");
+
+    changed = header;
+    changed.magic[0] = 'X';
+    rewind(file);
+    fwrite(&changed, sizeof(BytecodeHeader), 1, file);
+    fflush(file);
+    sput_fail_unless(loadBytecodeFile(path, &hash, &size) == NULL, "File without the bytecode magic number not loaded");
+
+    changed = header;
+    changed.numOfTokens = header.numOfTokens * 1000;
+    rewind(file);
+    fwrite(&changed, sizeof(BytecodeHeader), 1, file);
+    fflush(file);
+    sput_fail_unless(loadBytecodeFile(path, &hash, &size) == NULL, "Bytecode file with more tokens than it holds not loaded");
+
+    fclose(file);
+
+      // slots the interpreter would index with are checked against the range of what they name
+    Token tokens[1] = {{op, multiply, 0, 0, 1, 1}};
+    sput_fail_unless(checkBytecodeTokens(tokens, 1, 1, 0) == 1, "Operator token with a known operator accepted");
+    tokens[0].slot = multiply + 1;
+    sput_fail_unless(checkBytecodeTokens(tokens, 1, 1, 0) == 0, "Operator token with an unknown operator refused");
+    tokens[0].slot = -1;
+    sput_fail_unless(checkBytecodeTokens(tokens, 1, 1, 0) == 0, "Operator token with a negative slot refused");
+    tokens[0].type = colourName;
+    tokens[0].slot = purple;
+    sput_fail_unless(checkBytecodeTokens(tokens, 1, 1, 0) == 1, "Colour token with a known colour accepted");
+    tokens[0].slot = NUM_OF_COLOURS;
+    sput_fail_unless(checkBytecodeTokens(tokens, 1, 1, 0) == 0, "Colour token with an unknown colour refused");
+
+    unlink(path);
+    rmdir(directory);
+}
+
+void testCompileCache()
+{
+    char directory[] = "/tmp/turtleTbcXXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        fprintf(stderr, "ERROR - unable to make temporary directory in testCompileCache()\n");
+        exit(1);
+    }
+    setCacheDirectory(directory);
+
+    uint64_t firstHash, secondHash;
+    TokenStream first = openProgram("testingFiles/parserTesting.txt", 1, &firstHash);
+    sput_fail_unless(!checkLoadedFromBytecode(first), "Program lexed when it isn't in the cache");
+    saveValidatedProgram(first, firstHash);
+
+    TokenStream second = openProgram("testingFiles/parserTesting.txt", 1, &secondHash);
+    sput_fail_unless(checkLoadedFromBytecode(second), "Program loaded from the cache the second time");
+    sput_fail_unless(firstHash == secondHash && getNumberOfTokens(first) == getNumberOfTokens(second), "Cached program matches the source");
+
+    TokenStream other = openProgram("examples/dandelion.txt", 1, &secondHash);
+    sput_fail_unless(!checkLoadedFromBytecode(other) && secondHash != firstHash, "Different source not found in the cache");
+
+    char cachePath[CACHE_PATH_LENGTH];
+    makeCachePath(cachePath, CACHE_PATH_LENGTH, firstHash);
+    freeTokenStream(first);
+    freeTokenStream(second);
+    freeTokenStream(other);
+    unlink(cachePath);
+    rmdir(directory);
+    setCacheDirectory(NULL);
+}
@@ -1,5 +1,5 @@
 
-#include "../includes/display.h"
+#include "../includes/tilerender.h"
 
 
 // All info required for windows / renderer & event loop
@@ -7,22 +7,54 @@ struct sdl_Simplewin {
    SDL_bool finished;
    SDL_Window *win;
    SDL_Renderer *renderer;
+   SDL_Texture *canvas; // everything drawn so far, copied to the window each frame. NULL if the renderer can't draw into textures
+   int vsync; // set if presenting waits for the display, so frames don't have to be timed here
+   Uint32 frameMilliseconds;
+   Uint32 lastFrame; // SDL_GetTicks() when the last frame was presented
+   int64_t revealed; // the number of display list segments drawn so far
+   int revealColour; // the colour of the last segment drawn, or -1 before the first
+   Uint32 revealStart; // SDL_GetTicks() when the drawing began to be revealed
+   int skipReveal; // set when SKIP_REVEAL_KEY is pressed, so the rest of the drawing is shown at once
+   int exposed; // set when the window has been uncovered and has to be shown again
+   SDL_Point batch[MAX_BATCH_POINTS]; // the lines queued since the last submit, as points each joined to the one before
+   int numOfPoints;
 };
 
+static Box view = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT}; // the area of the turtle's world shown in the window while it draws
+static int fitToWindow = 0;
+static char *imagePath = NULL; // when set, lines are drawn into a framebuffer saved here at the end, and no window is opened
+static int windowWidth = SCREEN_WIDTH, windowHeight = SCREEN_HEIGHT;
+static double revealRate = DEFAULT_REVEAL_RATE; // segments drawn a second while the drawing is revealed
+static double revealSeconds = NO_REVEAL_DURATION; // if 0 or more, the whole drawing is revealed over this many seconds instead
+
 void setUpDisplay()
 {
+    if(imagePath != NULL) {
+        createFramebuffer(windowWidth, windowHeight);
+        return;
+    }
     createSDL_Simplewin();
     initialiseSDL();
     drawBlackBackground();
 }
 
+// chooses to draw into an image of the given size saved to filePath instead of into a window. Passing NULL goes back to the window
+void setImageOutput(char *filePath, int width, int height)
+{
+    imagePath = filePath;
+    windowWidth = (filePath != NULL) ? width : SCREEN_WIDTH;
+    windowHeight = (filePath != NULL) ? height : SCREEN_HEIGHT;
+    resetView();
+}
+
+char *getImageOutput()
+{
+    return imagePath;
+}
+
 void createSDL_Simplewin()
 {
-    SDL_Simplewin sw = (SDL_Simplewin) malloc(sizeof(struct sdl_Simplewin));
-    if(sw == NULL) {
-        fprintf(stderr, "ERROR - malloc failed for SDL_Simplewin in createSDL_Simplewin()\n");
-        exit(1);
-    }
+    SDL_Simplewin sw = (SDL_Simplewin) runAlloc(sizeof(struct sdl_Simplewin), memDisplay);
     
     getSDL_SimplewinPointer(sw);
     
@@ -62,25 +94,46 @@ void initialiseSDL()
       exit(1);
    }
 
-   sw->renderer = SDL_CreateRenderer(sw->win, -1, 0);
+     // presenting in step with the display paces the animation, but not every driver can, so fall back to timing frames here
+   sw->renderer = SDL_CreateRenderer(sw->win, -1, SDL_RENDERER_PRESENTVSYNC);
+   if(sw->renderer == NULL) {
+      sw->renderer = SDL_CreateRenderer(sw->win, -1, 0);
+   }
    if(sw->renderer == NULL){
       fprintf(stderr, "\nUnable to initialize SDL Renderer:  %s\n", SDL_GetError());
       SDL_Quit();
       exit(1);
    }
+   SDL_RendererInfo info;
+   sw->vsync = SDL_GetRendererInfo(sw->renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC);
 
-   SDL_RenderClear(sw->renderer);
-   SDL_RenderPresent(sw->renderer);
+     // what is in the window after a present can't be relied on, so lines are drawn into a texture that is copied to it every frame
+   sw->canvas = NULL;
+   if(SDL_RenderTargetSupported(sw->renderer)) {
+      sw->canvas = SDL_CreateTexture(sw->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+   }
+   if(sw->canvas != NULL) {
+      SDL_SetRenderTarget(sw->renderer, sw->canvas);
+   }
 
-}
+   SDL_DisplayMode mode;
+   int refreshRate = DEFAULT_REFRESH_RATE;
+   if(SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(sw->win), &mode) == 0 && mode.refresh_rate > 0) {
+      refreshRate = mode.refresh_rate;
+   }
+   sw->frameMilliseconds = 1000 / refreshRate;
+   sw->numOfPoints = 0;
+   sw->lastFrame = SDL_GetTicks();
+   sw->revealed = 0;
+   sw->revealColour = -1;
+   sw->revealStart = SDL_GetTicks();
+   sw->skipReveal = 0;
+   sw->exposed = 0;
 
-void shutDownDisplay()
-{
-    SDL_Simplewin sw = getSDL_SimplewinPointer(NULL);
-    
-    free(sw);
-}
+   SDL_RenderClear(sw->renderer);
+   presentFrame(sw);
 
+}
 
 //  SDL DRAWING FUNCTIONS  ////////////////////////////////////////////////////////////
 /*...................................................................................*/
@@ -99,53 +152,107 @@ void drawBlackBackground()
       // draw a black rectangle over the whle window
     setSDLDrawColour(sw, BLACK_R, BLACK_G, BLACK_R);
     SDL_RenderFillRect(sw->renderer, &rect);
-    SDL_RenderPresent(sw->renderer);
-    SDL_UpdateWindowSurface(sw->win);
+    presentFrame(sw);
     
       // initially set the draw colour to white
     setSDLDrawColour(sw, WHITE_R, WHITE_G, WHITE_B);
 }
 
-void drawLine(int xFrom, int yFrom, int xTo, int yTo)
+// adds a line to the batch. A line starting where the last one ended only adds its end point, so a whole path goes to the renderer
+// in one SDL_RenderDrawLines() call
+void queueLine(SDL_Simplewin sw, int xFrom, int yFrom, int xTo, int yTo)
 {
-    SDL_Simplewin sw = getSDL_SimplewinPointer(NULL);
-    if(!sw->finished) {
-        SDL_Delay(MILLISECOND_DELAY);
-        
-        SDL_RenderDrawLine(sw->renderer, xFrom, yFrom, xTo, yTo);
+    int joined = sw->numOfPoints > 0 && sw->batch[sw->numOfPoints - 1].x == xFrom && sw->batch[sw->numOfPoints - 1].y == yFrom;
+    if(!joined || sw->numOfPoints == MAX_BATCH_POINTS) {
+        submitLineBatch(sw);
+        sw->batch[0].x = xFrom;
+        sw->batch[0].y = yFrom;
+        sw->numOfPoints = 1;
+    }
+    sw->batch[sw->numOfPoints].x = xTo;
+    sw->batch[sw->numOfPoints].y = yTo;
+    sw->numOfPoints++;
+}
+
+// draws the queued lines in the current draw colour
+void submitLineBatch(SDL_Simplewin sw)
+{
+    if(sw->numOfPoints > 1) {
+        SDL_RenderDrawLines(sw->renderer, sw->batch, sw->numOfPoints);
+    }
+    sw->numOfPoints = 0;
+}
+
+// shows everything drawn so far, waiting for the display (or the frame time, if presenting doesn't wait), then handles the events that
+// came in during the frame
+void presentFrame(SDL_Simplewin sw)
+{
+    submitLineBatch(sw);
+    if(sw->canvas != NULL) {
+        SDL_SetRenderTarget(sw->renderer, NULL);
+        SDL_RenderCopy(sw->renderer, sw->canvas, NULL, NULL);
         SDL_RenderPresent(sw->renderer);
-        SDL_UpdateWindowSurface(sw->win);
-        
-        Neill_SDL_Events(sw);
+        SDL_SetRenderTarget(sw->renderer, sw->canvas);
+    } else {
+          // with nothing to keep the drawing in between frames, each frame is drawn afresh from what the index finds in view
+        redrawRegion(view);
+        submitLineBatch(sw);
+        SDL_RenderPresent(sw->renderer);
+    }
+    Uint32 elapsed = SDL_GetTicks() - sw->lastFrame;
+    if(!sw->vsync && elapsed < sw->frameMilliseconds) {
+        SDL_Delay(sw->frameMilliseconds - elapsed);
     }
+    sw->lastFrame = SDL_GetTicks();
+    Neill_SDL_Events(sw);
 }
 
+// converts a point in the turtle's world to a pixel in the window, using the current view
+void mapToWindow(double x, double y, int *windowX, int *windowY)
+{
+    mapToImage(view, windowWidth, windowHeight, x, y, windowX, windowY);
+}
 
 void setDrawColour(Clr colour)
 {
-    SDL_Simplewin sw = getSDL_SimplewinPointer(NULL);
-    
+    Uint8 r, g, b;
+    if(!getColourRGB(colour, &r, &g, &b)) {
+        fprintf(stderr, "ERROR - incorrect colour passed to setDrawColour\n");
+        return;
+    }
+    if(imagePath != NULL) {
+        setFramebufferColour(getFramebufferPointer(NULL), r, g, b);
+    } else {
+        SDL_Simplewin sw = getSDL_SimplewinPointer(NULL);
+        submitLineBatch(sw); // the queued lines are in the old colour
+        setSDLDrawColour(sw, r, g, b);
+    }
+}
+
+// looks up the red, green and blue a colour is drawn in. Returns 0 if it isn't a colour
+int getColourRGB(Clr colour, Uint8 *r, Uint8 *g, Uint8 *b)
+{
     switch(colour) {
         case white :
-            setSDLDrawColour(sw, WHITE_R, WHITE_G, WHITE_B);
-            break;
+            *r = WHITE_R; *g = WHITE_G; *b = WHITE_B;
+            return 1;
         case red :
-            setSDLDrawColour(sw, RED_R, RED_G, RED_B);
-            break;
+            *r = RED_R; *g = RED_G; *b = RED_B;
+            return 1;
         case blue :
-            setSDLDrawColour(sw, BLUE_R, BLUE_G, BLUE_B);
-            break;
+            *r = BLUE_R; *g = BLUE_G; *b = BLUE_B;
+            return 1;
         case green :
-            setSDLDrawColour(sw, GREEN_R, GREEN_G, GREEN_B);
-            break;
+            *r = GREEN_R; *g = GREEN_G; *b = GREEN_B;
+            return 1;
         case yellow :
-            setSDLDrawColour(sw, YELLOW_R, YELLOW_G, YELLOW_B);
-            break;
+            *r = YELLOW_R; *g = YELLOW_G; *b = YELLOW_B;
+            return 1;
         case purple :
-            setSDLDrawColour(sw, PURPLE_R, PURPLE_G, PURPLE_B);
-            break;
+            *r = PURPLE_R; *g = PURPLE_G; *b = PURPLE_B;
+            return 1;
         default :
-            fprintf(stderr, "ERROR - incorrect colour passed to setDrawColour\n");
+            return 0;
     }
 }
 
@@ -166,16 +273,34 @@ void Neill_SDL_Events(SDL_Simplewin sw)
          if(event.type == SDL_QUIT || event.key.keysym.sym == SDLK_ESCAPE) {
              sw->finished = 1;
              SDL_Quit();
+         } else if(event.type == SDL_KEYDOWN && event.key.keysym.sym == SKIP_REVEAL_KEY) {
+             sw->skipReveal = 1;
+         } else if(event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+             sw->exposed = 1;
          }
     }
 }
 
-// continuous loop to hold SDL window open until user closes it
+// continuous loop to hold SDL window open until user closes it. With no window, renders the drawing and saves the image instead
 void holdScreenUntilUserInput()
 {
+    if(imagePath != NULL) {
+        redrawRegion(view);
+        if(!writeFramebufferImage(getFramebufferPointer(NULL), imagePath)) {
+            fprintf(stderr, "WARNING: unable to save image to '%s'\n", imagePath);
+        }
+        return;
+    }
     SDL_Simplewin sw = getSDL_SimplewinPointer(NULL);
+    if(!sw->finished) {
+        presentFrame(sw);
+    }
     while(!sw->finished) {
         Neill_SDL_Events(sw);
+        if(sw->exposed && !sw->finished) {
+            sw->exposed = 0;
+            presentFrame(sw);
+        }
     }
 }
 
@@ -199,3 +324,219 @@ void holdScreenUntilUserInput()
 
 
 
+
+
+
+//  REVEAL FUNCTIONS  ////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// takes the segments the interpreter's thread has pushed into the ring and adds them to the display list, which only this thread
+// touches while the program runs. Takes at most a ring's worth, so a fast interpreter can't hold up the frame. Sets runFinished once the
+// ring is closed and empty. Returns the number of segments taken
+int64_t takeFromSegmentRing(SegmentRing ring, int *runFinished)
+{
+    RingSegment batch[SEGMENT_RING_BATCH];
+    int64_t taken = 0;
+    *runFinished = 0;
+    while(taken < SEGMENT_RING_SIZE) {
+          // read before popping, so a closed ring found empty can't have had a segment pushed in between
+        int closed = checkSegmentRingClosed(ring);
+        int numOfSegments = popFromSegmentRing(ring, batch, SEGMENT_RING_BATCH);
+        if(numOfSegments == 0) {
+            *runFinished = closed;
+            break;
+        }
+        for(int i = 0; i < numOfSegments; i++) {
+            appendSegment(batch[i].x0, batch[i].y0, batch[i].x1, batch[i].y1, batch[i].colour);
+        }
+        taken += numOfSegments;
+    }
+    return taken;
+}
+
+// draws the program as the interpreter's thread runs it. Each frame takes what the interpreter has drawn since the last one and reveals
+// as much of the display list as the time since the start allows, so the interpreter runs as fast as it can however slowly the drawing
+// is shown, and the window answers events throughout. Once the window has been closed the ring is still emptied, so the interpreter is
+// never left waiting on it. Returns once the program has finished and the drawing has been revealed (or the window closed)
+void drawFromSegmentRing(SegmentRing ring)
+{
+    SDL_Simplewin sw = getSDL_SimplewinPointer(NULL);
+    int runFinished = 0;
+    while(!runFinished || (!sw->finished && sw->revealed < getNumberOfSegments())) {
+        int64_t taken = takeFromSegmentRing(ring, &runFinished);
+        if(!sw->finished) {
+              // the interpreter may still join its next move onto the last segment, so that one waits until the run has finished
+            int64_t available = getNumberOfSegments();
+            revealSegments(sw, (runFinished || available == 0) ? available : available - 1);
+            presentFrame(sw);
+        } else if(taken == 0 && !runFinished) {
+            waitForSegmentRing();
+        }
+    }
+}
+
+// draws every segment of a finished display list, such as a replayed segment log, at the reveal speed
+void revealDisplayList()
+{
+    SDL_Simplewin sw = getSDL_SimplewinPointer(NULL);
+    while(!sw->finished && sw->revealed < getNumberOfSegments()) {
+        revealSegments(sw, getNumberOfSegments());
+        presentFrame(sw);
+    }
+}
+
+// draws the display list on from the last segment revealed, as far as the reveal has got since it started (or up to available, if the
+// rest of the drawing has been asked for). Only the part of each segment inside the view is drawn. With no canvas the next frame draws
+// everything revealed so far, so the segments are only counted as revealed here
+void revealSegments(SDL_Simplewin sw, int64_t available)
+{
+    int64_t target = available;
+    if(!sw->skipReveal) {
+        double seconds = (SDL_GetTicks() - sw->revealStart) / 1000.0;
+        double due = (revealSeconds >= 0) ? ((seconds >= revealSeconds) ? available : available * seconds / revealSeconds)
+                                          : seconds * revealRate;
+        target = (due < (double) available) ? (int64_t) due : available;
+    }
+    if(sw->canvas == NULL) {
+        sw->revealed = (target > sw->revealed) ? target : sw->revealed;
+        return;
+    }
+    DisplayList dl = getDisplayListPointer(NULL);
+    for(; sw->revealed < target; sw->revealed++) {
+        Segment s;
+        getSegment(dl, sw->revealed, &s);
+        if(!clipSegmentToBox(&s.x0, &s.y0, &s.x1, &s.y1, &view)) {
+            continue;
+        }
+        if(s.colour != sw->revealColour) {
+            sw->revealColour = s.colour;
+            setDrawColour((Clr) s.colour);
+        }
+        int x0, y0, x1, y1;
+        mapToWindow(s.x0, s.y0, &x0, &y0);
+        mapToWindow(s.x1, s.y1, &x1, &y1);
+        queueLine(sw, x0, y0, x1, y1);
+    }
+}
+
+// sets the number of segments revealed each second. Clears any reveal duration
+void setRevealRate(double segmentsPerSecond)
+{
+    revealRate = segmentsPerSecond;
+    revealSeconds = NO_REVEAL_DURATION;
+}
+
+double getRevealRate()
+{
+    return revealRate;
+}
+
+// reveals the whole drawing over the given number of seconds, whatever its size. 0 shows it at once
+void setRevealDuration(double seconds)
+{
+    revealSeconds = seconds;
+}
+
+double getRevealDuration()
+{
+    return revealSeconds;
+}
+
+// how long revealing a drawing of numOfSegments segments takes, if it isn't skipped
+double getRevealSeconds(int64_t numOfSegments)
+{
+    return (revealSeconds >= 0) ? revealSeconds : numOfSegments / revealRate;
+}
+
+
+
+//  VIEW FUNCTIONS  //////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// sets the view so the whole drawing fits in the window with a FIT_MARGIN border, at the same scale across and down, and centred
+void fitViewToDrawing(Box drawing)
+{
+    double width = fmax(drawing.maxX - drawing.minX, 1);
+    double height = fmax(drawing.maxY - drawing.minY, 1);
+    double scale = fmin(windowWidth / width, windowHeight / height) * (1 - 2 * FIT_MARGIN);
+    double centreX = (drawing.minX + drawing.maxX) / 2;
+    double centreY = (drawing.minY + drawing.maxY) / 2;
+    view.minX = centreX - windowWidth / (2 * scale);
+    view.maxX = centreX + windowWidth / (2 * scale);
+    view.minY = centreY - windowHeight / (2 * scale);
+    view.maxY = centreY + windowHeight / (2 * scale);
+}
+
+// shows the turtle's world one pixel to a unit, centred where the turtle starts, as it is at the start
+void resetView()
+{
+    view.minX = (SCREEN_WIDTH - windowWidth) / 2.0;
+    view.minY = (SCREEN_HEIGHT - windowHeight) / 2.0;
+    view.maxX = view.minX + windowWidth;
+    view.maxY = view.minY + windowHeight;
+}
+
+Box getView()
+{
+    return view;
+}
+
+// chooses whether programs are measured before they are drawn, so the view can be fitted to them
+void setFitToWindow(int fit)
+{
+    fitToWindow = fit;
+}
+
+int getFitToWindow()
+{
+    return fitToWindow;
+}
+
+
+
+//  SDL REDRAWING FUNCTIONS  /////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// draws every segment of the display list that crosses area, scaled so area fills the window, over a cleared window. Only the segments
+// the spatial index finds are touched, so zooming into a small part of a large drawing costs time in proportion to what is on screen.
+// In a window, only the segments revealed so far are drawn, and the lines are queued for the next present. With no window, the image is
+// rendered in tiles. Returns the number of segments drawn
+int64_t redrawRegion(Box area)
+{
+    DisplayList dl = getDisplayListPointer(NULL);
+    if(imagePath != NULL) {
+        Framebuffer fb = getFramebufferPointer(NULL);
+        clearFramebuffer(fb, BLACK_R, BLACK_G, BLACK_B);
+        return renderDisplayList(fb, dl, area);
+    }
+    SDL_Simplewin sw = getSDL_SimplewinPointer(NULL);
+    submitLineBatch(sw);
+    setSDLDrawColour(sw, BLACK_R, BLACK_G, BLACK_B);
+    SDL_RenderClear(sw->renderer);
+    sw->revealColour = -1;
+    if(dl == NULL) {
+        return 0;
+    }
+    int64_t *segments;
+    int64_t numFound = findSegmentsInArea(getSegmentIndex(dl), area, &segments);
+    int64_t drawn = 0;
+    for(int64_t i = 0; i < numFound && segments[i] < sw->revealed; i++) {
+        Segment s;
+        getSegment(dl, segments[i], &s);
+          // the index only knows the segment's box overlaps the area, so the segment itself may still miss it
+        if(!clipSegmentToBox(&s.x0, &s.y0, &s.x1, &s.y1, &area)) {
+            continue;
+        }
+        if(s.colour != sw->revealColour) {
+            sw->revealColour = s.colour;
+            setDrawColour((Clr) s.colour);
+        }
+        int x0, y0, x1, y1;
+        mapToImage(area, windowWidth, windowHeight, s.x0, s.y0, &x0, &y0);
+        mapToImage(area, windowWidth, windowHeight, s.x1, s.y1, &x1, &y1);
+        queueLine(sw, x0, y0, x1, y1);
+        drawn++;
+    }
+    freeFoundSegments(segments, numFound);
+    return drawn;
+}
@@ -0,0 +1,440 @@
+#include "../includes/parser.h" // the tests interpret example programs, and parser.h includes displaylist.h
+
+static int compactSegments = 0;
+static int coalesceSegments = 1;
+static int removeDuplicates = 0;
+static int64_t segmentCapacityHint = 0; // if set, the next display list made starts with room for this many segments
+
+
+
+//  SETUP FUNCTIONS  /////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// the display list is made in the run arena, so it lasts until the run is shut down. Renderers and exporters read it before then
+void createDisplayList()
+{
+    DisplayList dl = (DisplayList) runCalloc(sizeof(struct displayList), memDisplayList);
+    dl->compact = compactSegments;
+    dl->coalesce = coalesceSegments;
+    getDisplayListPointer(dl);
+    if(segmentCapacityHint > INITIAL_SEGMENT_CAPACITY) {
+        resizeDisplayList(dl, (segmentCapacityHint + SEGMENT_BLOCK - 1) / SEGMENT_BLOCK * SEGMENT_BLOCK);
+    }
+    segmentCapacityHint = 0;
+}
+
+// if passed NULL, returns pointer to the DisplayList. If passed pointer, sets static pointer to the new pointer
+DisplayList getDisplayListPointer(DisplayList newList)
+{
+    static DisplayList dl = NULL;
+    if(newList != NULL) {
+        dl = newList;
+    }
+    return dl;
+}
+
+// chooses whether display lists created from now on keep coordinates as floats, halving the memory they use
+void setCompactSegments(int compact)
+{
+    compactSegments = compact;
+}
+
+int getCompactSegments()
+{
+    return compactSegments;
+}
+
+// chooses whether display lists created from now on merge each segment into the one before it when it carries straight on from it
+void setCoalescing(int coalesce)
+{
+    coalesceSegments = coalesce;
+}
+
+
+// chooses whether duplicate segments are removed from the display list once a program has been interpreted
+void setDeduplication(int dedup)
+{
+    removeDuplicates = dedup;
+}
+
+int getDeduplication()
+{
+    return removeDuplicates;
+}
+
+// makes the next display list start with room for the given number of segments (usually from measureProgram()), so it never has
+// to be copied as it grows
+void setSegmentCapacityHint(int64_t segments)
+{
+    segmentCapacityHint = segments;
+}
+
+
+
+//  SEGMENT FUNCTIONS  ///////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// adds a segment to the end of the list. Programs often move forward several
+// times in a row, so if coalescing is on a segment that carries straight on from the last one in the same colour just extends it.
+// Only the last segment is ever extended, so the list is still in the order the segments were drawn
+void appendSegment(double x0, double y0, double x1, double y1, uint8_t colour)
+{
+    DisplayList dl = getDisplayListPointer(NULL);
+    int64_t sequence = dl->segmentsAppended;
+    dl->segmentsAppended++;
+    if(dl->coalesce && extendLastSegment(dl, x0, y0, x1, y1, colour)) {
+        return;
+    }
+    if(dl->numOfSegments == dl->capacity) {
+        growDisplayList(dl);
+    }
+    int64_t i = dl->numOfSegments;
+    if(dl->compact) {
+        dl->fx0[i] = (float) x0;
+        dl->fy0[i] = (float) y0;
+        dl->fx1[i] = (float) x1;
+        dl->fy1[i] = (float) y1;
+    } else {
+        dl->x0[i] = x0;
+        dl->y0[i] = y0;
+        dl->x1[i] = x1;
+        dl->y1[i] = y1;
+    }
+    dl->colour[i] = colour;
+    dl->sequence[i] = sequence;
+    dl->numOfSegments++;
+}
+
+// moves the end of the last segment to (x1, y1) if the new segment starts where it ends, heads the same way and is the same colour.
+// Returns 1 if it was extended
+int extendLastSegment(DisplayList dl, double x0, double y0, double x1, double y1, uint8_t colour)
+{
+    int64_t last = dl->numOfSegments - 1;
+    if(last < 0 || dl->colour[last] != colour) {
+        return 0;
+    }
+    if(dl->compact) {
+        if(dl->fx1[last] != (float) x0 || dl->fy1[last] != (float) y0 ||
+           !checkCollinear(dl->fx1[last] - dl->fx0[last], dl->fy1[last] - dl->fy0[last], (float) x1 - (float) x0, (float) y1 - (float) y0)) {
+            return 0;
+        }
+        dl->fx1[last] = (float) x1;
+        dl->fy1[last] = (float) y1;
+    } else {
+        if(dl->x1[last] != x0 || dl->y1[last] != y0 || !checkCollinear(dl->x1[last] - dl->x0[last], dl->y1[last] - dl->y0[last], x1 - x0, y1 - y0)) {
+            return 0;
+        }
+        dl->x1[last] = x1;
+        dl->y1[last] = y1;
+    }
+    return 1;
+}
+
+// returns 1 if the two directions point the same way. Directions turning back on themselves don't count, as merging them would lose
+// the part of the line drawn over twice
+int checkCollinear(double ax, double ay, double bx, double by)
+{
+    double cross = ax * by - ay * bx;
+    double dot = ax * bx + ay * by;
+    double lengths = sqrt((ax * ax + ay * ay) * (bx * bx + by * by));
+    return dot > 0 && fabs(cross) <= COLLINEAR_TOLERANCE * lengths;
+}
+
+// doubles the room in every array
+void growDisplayList(DisplayList dl)
+{
+    resizeDisplayList(dl, (dl->capacity == 0) ? INITIAL_SEGMENT_CAPACITY : dl->capacity * 2);
+}
+
+// gives every array room for newCapacity segments, which must be a multiple of SEGMENT_BLOCK and no less than the current capacity
+void resizeDisplayList(DisplayList dl, int64_t newCapacity)
+{
+    if(dl->compact) {
+        dl->fx0 = (float*) growSegmentArray(dl->fx0, dl->capacity, newCapacity, sizeof(float));
+        dl->fy0 = (float*) growSegmentArray(dl->fy0, dl->capacity, newCapacity, sizeof(float));
+        dl->fx1 = (float*) growSegmentArray(dl->fx1, dl->capacity, newCapacity, sizeof(float));
+        dl->fy1 = (float*) growSegmentArray(dl->fy1, dl->capacity, newCapacity, sizeof(float));
+    } else {
+        dl->x0 = (double*) growSegmentArray(dl->x0, dl->capacity, newCapacity, sizeof(double));
+        dl->y0 = (double*) growSegmentArray(dl->y0, dl->capacity, newCapacity, sizeof(double));
+        dl->x1 = (double*) growSegmentArray(dl->x1, dl->capacity, newCapacity, sizeof(double));
+        dl->y1 = (double*) growSegmentArray(dl->y1, dl->capacity, newCapacity, sizeof(double));
+    }
+    dl->colour = (uint8_t*) growSegmentArray(dl->colour, dl->capacity, newCapacity, sizeof(uint8_t));
+    dl->sequence = (int64_t*) growSegmentArray(dl->sequence, dl->capacity, newCapacity, sizeof(int64_t));
+    dl->capacity = newCapacity;
+}
+
+// returns an aligned copy of the array with room for newCapacity elements. The new part is cleared
+void *growSegmentArray(void *old, int64_t oldCapacity, int64_t newCapacity, size_t elementSize)
+{
+    char *array = (char*) runAllocAligned(newCapacity * elementSize, DISPLAY_LIST_ALIGNMENT, memDisplayList);
+    if(old != NULL) {
+        memcpy(array, old, oldCapacity * elementSize);
+        trackRunMemory(memDisplayList, oldCapacity * elementSize, 0); // the old array stays in the arena, but is no longer used
+    }
+    memset(array + oldCapacity * elementSize, 0, (newCapacity - oldCapacity) * elementSize);
+    return array;
+}
+
+void getSegment(DisplayList dl, int64_t index, Segment *segment)
+{
+    if(dl->compact) {
+        segment->x0 = dl->fx0[index];
+        segment->y0 = dl->fy0[index];
+        segment->x1 = dl->fx1[index];
+        segment->y1 = dl->fy1[index];
+    } else {
+        segment->x0 = dl->x0[index];
+        segment->y0 = dl->y0[index];
+        segment->x1 = dl->x1[index];
+        segment->y1 = dl->y1[index];
+    }
+    segment->colour = dl->colour[index];
+    segment->sequence = dl->sequence[index];
+}
+
+int64_t getNumberOfSegments()
+{
+    return getDisplayListPointer(NULL)->numOfSegments;
+}
+
+int64_t getSegmentsAppended()
+{
+    return getDisplayListPointer(NULL)->segmentsAppended;
+}
+
+
+
+
+//  DUPLICATE REMOVAL FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// removes every segment that is drawn again later in the same colour, as the later copy paints over all of it. Whatever was drawn in
+// between is painted over by the later copy too, so the finished picture is the same. The segments left keep their order. Returns the
+// number removed
+int64_t removeDuplicateSegments(DisplayList dl)
+{
+    int64_t n = dl->numOfSegments;
+    int64_t numOfBuckets = 16;
+    while(numOfBuckets < n * 2) {
+        numOfBuckets *= 2;
+    }
+    int64_t *buckets = (int64_t*) malloc(numOfBuckets * sizeof(int64_t));
+    uint8_t *keep = (uint8_t*) malloc(n > 0 ? n : 1);
+    if(buckets == NULL || keep == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for segment hash set in removeDuplicateSegments()\n");
+        exit(1);
+    }
+    trackMemory(memDisplayList, 0, numOfBuckets * sizeof(int64_t) + (n > 0 ? n : 1));
+    for(int64_t b = 0; b < numOfBuckets; b++) {
+        buckets[b] = NO_SEGMENT;
+    }
+
+      // work back from the last segment, so the copy kept is the one drawn last
+    int64_t key[5], otherKey[5];
+    for(int64_t i = n - 1; i >= 0; i--) {
+        makeSegmentKey(dl, i, key);
+        uint64_t b = hashSegmentKey(key) & (numOfBuckets - 1);
+        keep[i] = 1;
+        while(buckets[b] != NO_SEGMENT) {
+            makeSegmentKey(dl, buckets[b], otherKey);
+            if(memcmp(key, otherKey, sizeof(key)) == 0) {
+                keep[i] = 0;
+                break;
+            }
+            b = (b + 1) & (numOfBuckets - 1);
+        }
+        if(keep[i]) {
+            buckets[b] = i;
+        }
+    }
+
+    int64_t kept = 0;
+    for(int64_t i = 0; i < n; i++) {
+        if(!keep[i]) {
+            continue;
+        }
+        if(dl->compact) {
+            dl->fx0[kept] = dl->fx0[i];
+            dl->fy0[kept] = dl->fy0[i];
+            dl->fx1[kept] = dl->fx1[i];
+            dl->fy1[kept] = dl->fy1[i];
+        } else {
+            dl->x0[kept] = dl->x0[i];
+            dl->y0[kept] = dl->y0[i];
+            dl->x1[kept] = dl->x1[i];
+            dl->y1[kept] = dl->y1[i];
+        }
+        dl->colour[kept] = dl->colour[i];
+        dl->sequence[kept] = dl->sequence[i];
+        kept++;
+    }
+      // keep the entries past the end cleared
+    for(int64_t i = kept; i < n; i++) {
+        if(dl->compact) {
+            dl->fx0[i] = dl->fy0[i] = dl->fx1[i] = dl->fy1[i] = 0;
+        } else {
+            dl->x0[i] = dl->y0[i] = dl->x1[i] = dl->y1[i] = 0;
+        }
+        dl->colour[i] = 0;
+        dl->sequence[i] = 0;
+    }
+
+    free(buckets);
+    free(keep);
+    trackMemory(memDisplayList, numOfBuckets * sizeof(int64_t) + (n > 0 ? n : 1), 0);
+    dl->numOfSegments = kept;
+    dl->duplicatesRemoved += n - kept;
+    if(kept != n) {
+        dl->generation++;
+    }
+    return n - kept;
+}
+
+// the key a segment is matched on: the exact bits of its ends, lowest end first so a line drawn either way round matches (the line
+// drawers put the ends in order before drawing), and its colour. Segments that differ by any amount may round to different pixels, so
+// only exact copies are treated as the same
+void makeSegmentKey(DisplayList dl, int64_t index, int64_t key[5])
+{
+    Segment s;
+    getSegment(dl, index, &s);
+      // adding 0 turns -0 into 0, which is drawn the same
+    double ax = s.x0 + 0.0, ay = s.y0 + 0.0;
+    double bx = s.x1 + 0.0, by = s.y1 + 0.0;
+    if(bx < ax || (bx == ax && by < ay)) {
+        double tx = ax, ty = ay;
+        ax = bx; ay = by;
+        bx = tx; by = ty;
+    }
+    memcpy(&key[0], &ax, sizeof(double));
+    memcpy(&key[1], &ay, sizeof(double));
+    memcpy(&key[2], &bx, sizeof(double));
+    memcpy(&key[3], &by, sizeof(double));
+    key[4] = s.colour;
+}
+
+// FNV-1a over the key
+uint64_t hashSegmentKey(int64_t key[5])
+{
+    uint64_t hash = 14695981039346656037ULL;
+    unsigned char *bytes = (unsigned char*) key;
+    for(size_t i = 0; i < 5 * sizeof(int64_t); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runDisplayListWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testDisplayListAppending(): Checking segments are kept in order in aligned arrays");
+    sput_run_test(testDisplayListAppending);
+    sput_leave_suite();
+
+    sput_enter_suite("testCompactDisplayList(): Checking compact display lists keep segments as floats");
+    sput_run_test(testCompactDisplayList);
+    sput_leave_suite();
+
+    sput_enter_suite("testSegmentCoalescing(): Checking segments carrying straight on are merged");
+    sput_run_test(testSegmentCoalescing);
+    sput_leave_suite();
+
+    sput_enter_suite("testDuplicateRemoval(): Checking segments drawn again later are removed");
+    sput_run_test(testDuplicateRemoval);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testDisplayListAppending()
+{
+    setCoalescing(0);
+    createDisplayList();
+    DisplayList dl = getDisplayListPointer(NULL);
+    sput_fail_unless(dl->numOfSegments == 0 && dl->x0 == NULL, "Display list starts empty");
+
+    for(int i = 0; i < INITIAL_SEGMENT_CAPACITY + 1; i++) {
+        appendSegment(i, i + 0.5, i + 1, i + 1.5, (uint8_t) (i % 6));
+    }
+    sput_fail_unless(getNumberOfSegments() == INITIAL_SEGMENT_CAPACITY + 1 && dl->capacity == INITIAL_SEGMENT_CAPACITY * 2, "Display list grows by doubling");
+    sput_fail_unless(dl->capacity % SEGMENT_BLOCK == 0 && (uintptr_t) dl->x0 % DISPLAY_LIST_ALIGNMENT == 0 && (uintptr_t) dl->sequence % DISPLAY_LIST_ALIGNMENT == 0,
+                     "Arrays are aligned and sized in whole blocks");
+
+    Segment s;
+    getSegment(dl, INITIAL_SEGMENT_CAPACITY, &s);
+    sput_fail_unless(s.x0 == INITIAL_SEGMENT_CAPACITY && s.y1 == INITIAL_SEGMENT_CAPACITY + 1.5 && s.colour == INITIAL_SEGMENT_CAPACITY % 6, "Segment kept after growing");
+    sput_fail_unless(s.sequence == INITIAL_SEGMENT_CAPACITY && dl->sequence[0] == 0, "Segments numbered in the order they were drawn");
+    sput_fail_unless(dl->x0[dl->capacity - 1] == 0 && dl->colour[dl->capacity - 1] == 0, "Unused entries are cleared");
+    setCoalescing(1);
+    resetRunArena();
+}
+
+void testCompactDisplayList()
+{
+    setCompactSegments(1);
+    createDisplayList();
+    DisplayList dl = getDisplayListPointer(NULL);
+    appendSegment(0.1, 2, 3.25, 4, 1);
+    sput_fail_unless(dl->x0 == NULL && dl->fx0 != NULL, "Compact display list stores floats");
+    Segment s;
+    getSegment(dl, 0, &s);
+    sput_fail_unless(s.x0 == (float) 0.1 && s.x1 == 3.25 && s.colour == 1, "Compact segment returned rounded to float");
+    setCompactSegments(0);
+    resetRunArena();
+}
+
+void testSegmentCoalescing()
+{
+    createDisplayList();
+    DisplayList dl = getDisplayListPointer(NULL);
+    double angle = 0.7;
+    for(int i = 0; i < 10; i++) {
+        appendSegment(i * 10 * sin(angle), -i * 10 * cos(angle), (i+1) * 10 * sin(angle), -(i+1) * 10 * cos(angle), 0);
+    }
+    sput_fail_unless(getNumberOfSegments() == 1 && getSegmentsAppended() == 10, "Steps of one move merged into one segment");
+    sput_fail_unless(fabs(dl->x1[0] - 100 * sin(angle)) < 1e-9, "Merged segment ends at the end of the last step");
+
+    double x = dl->x1[0], y = dl->y1[0];
+    appendSegment(x, y, x + 10, y, 0);
+    appendSegment(x + 10, y, x + 20, y, 3);
+    appendSegment(x + 20, y, x + 15, y, 3);
+    appendSegment(x + 50, y, x + 60, y, 3);
+    sput_fail_unless(getNumberOfSegments() == 5, "Turns, colour changes, reversals and jumps start new segments");
+    sput_fail_unless(dl->sequence[1] == 10 && dl->sequence[4] == 13, "Segments keep the sequence number of their first step");
+    resetRunArena();
+}
+
+void testDuplicateRemoval()
+{
+    createDisplayList();
+    DisplayList dl = getDisplayListPointer(NULL);
+    appendSegment(0, 0, 10, 0, 1);
+    appendSegment(0, 0, 0, 10, 2);
+    appendSegment(10, 0, 0, 0, 1);
+    appendSegment(0, 0, 10, 0, 3);
+    appendSegment(0.001, 0, 10, 0.001, 3);
+    appendSegment(0, 0, 10, 0, 3);
+    appendSegment(50, 50, 60, 60, 1);
+    sput_fail_unless(removeDuplicateSegments(dl) == 2 && getNumberOfSegments() == 5, "Earlier copies of segments removed");
+    sput_fail_unless(dl->sequence[0] == 1 && dl->sequence[1] == 2 && dl->sequence[2] == 4 && dl->sequence[3] == 5 && dl->sequence[4] == 6,
+                     "Last copy kept and order kept");
+    sput_fail_unless(dl->x0[5] == 0 && dl->sequence[5] == 0, "Entries past the end cleared");
+    sput_fail_unless(removeDuplicateSegments(dl) == 0, "Nothing more to remove");
+    resetRunArena();
+
+    sput_fail_unless(interpret("examples/dandelion.txt", TESTING) == 1, "Interpreted dandelion example");
+    int64_t before = getNumberOfSegments();
+    removeDuplicateSegments(getDisplayListPointer(NULL));
+    sput_fail_unless(before - getNumberOfSegments() == 30, "Spokes drawn twice removed from dandelion example");
+    shutDownParsing();
+}
@@ -0,0 +1,315 @@
+#include "../includes/expression.h"
+
+// every expression compiled while running a program, found by the index of the ":=" token before it. The ops of every expression are
+// kept in one array, one expression after another
+struct expressionTable {
+    Expression *expressions;
+    int numOfExpressions;
+    int expressionCapacity;
+
+    ExprOp *ops;
+    int numOfOps;
+    int opCapacity;
+
+    int *buckets; // open addressing hash table of expression ids, keyed on startIndex
+    int numOfBuckets; // a power of 2, kept at least twice numOfExpressions
+
+    double *deepStack; // room to evaluate expressions too deep for EVAL_STACK_SIZE. Sized as they are compiled so evaluating never allocates
+    int deepStackSize;
+} ;
+
+
+
+//  SETUP FUNCTIONS  /////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+ExpressionTable createExpressionTable()
+{
+    ExpressionTable table = (ExpressionTable) runCalloc(sizeof(struct expressionTable), memExpressions);
+    table->numOfBuckets = INITIAL_EXPRESSION_BUCKETS;
+    table->buckets = (int*) runAlloc(table->numOfBuckets * sizeof(int), memExpressions);
+    for(int i = 0; i < table->numOfBuckets; i++) {
+        table->buckets[i] = NO_EXPRESSION;
+    }
+    return table;
+}
+
+
+
+
+//  COMPILING FUNCTIONS  /////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// returns the id of the expression after the ":=" token at startIndex, or NO_EXPRESSION if it hasn't been compiled yet
+int findExpression(ExpressionTable table, int64_t startIndex)
+{
+    uint32_t mask = (uint32_t) table->numOfBuckets - 1;
+    for(uint32_t b = (uint32_t) (startIndex * 2654435761u) & mask; table->buckets[b] != NO_EXPRESSION; b = (b + 1) & mask) {
+        if(table->expressions[table->buckets[b]].startIndex == startIndex) {
+            return table->buckets[b];
+        }
+    }
+    return NO_EXPRESSION;
+}
+
+// adds an empty expression for the ":=" token at startIndex and returns its id. Ops are added to it with addExpressionOp()
+int beginExpression(ExpressionTable table, int64_t startIndex)
+{
+    if(table->numOfExpressions == table->expressionCapacity) {
+        int oldCapacity = table->expressionCapacity;
+        table->expressionCapacity = (oldCapacity == 0) ? 16 : oldCapacity * 2;
+        table->expressions = (Expression*) runGrow(table->expressions, oldCapacity * sizeof(Expression), table->expressionCapacity * sizeof(Expression), memExpressions);
+    }
+    int id = table->numOfExpressions;
+    Expression *e = &table->expressions[id];
+    memset(e, 0, sizeof(Expression));
+    e->startIndex = startIndex;
+    e->endIndex = startIndex;
+    e->firstOp = table->numOfOps;
+    table->numOfExpressions++;
+
+    if(table->numOfExpressions * 2 > table->numOfBuckets) {
+        growExpressionBuckets(table);
+    } else {
+        uint32_t mask = (uint32_t) table->numOfBuckets - 1;
+        uint32_t b = (uint32_t) (startIndex * 2654435761u) & mask;
+        while(table->buckets[b] != NO_EXPRESSION) {
+            b = (b + 1) & mask;
+        }
+        table->buckets[b] = id;
+    }
+    return id;
+}
+
+// adds an op to the end of the expression being compiled and keeps track of how many values it holds. Returns 0 (and records the error)
+// if an operator doesn't have two values to work on
+int addExpressionOp(ExpressionTable table, int id, ExprOpType type, int slot, double val, int64_t tokenIndex)
+{
+    Expression *e = &table->expressions[id];
+    if(type == applyOperator) {
+        if(e->depth < 2) {
+            return failExpression(table, id, "too few variables/constants for operators in reverse polish expression", tokenIndex);
+        }
+        e->depth--;
+    } else {
+        e->depth++;
+        if(e->depth > e->maxDepth) {
+            e->maxDepth = e->depth;
+        }
+    }
+
+    if(table->numOfOps == table->opCapacity) {
+        int oldCapacity = table->opCapacity;
+        table->opCapacity = (oldCapacity == 0) ? 256 : oldCapacity * 2;
+        table->ops = (ExprOp*) runGrow(table->ops, oldCapacity * sizeof(ExprOp), table->opCapacity * sizeof(ExprOp), memExpressions);
+    }
+    ExprOp *op = &table->ops[table->numOfOps];
+    op->type = type;
+    op->slot = slot;
+    op->val = val;
+    op->tokenIndex = tokenIndex;
+    table->numOfOps++;
+    e->numOfOps++;
+    return 1;
+}
+
+// called at the ";" ending the expression. Returns 0 (and records the error) unless the expression leaves exactly one value
+int finishExpression(ExpressionTable table, int id, int64_t endIndex)
+{
+    Expression *e = &table->expressions[id];
+    e->endIndex = endIndex;
+    if(e->depth == 0) {
+        return failExpression(table, id, "no variables/constants in reverse polish expression", endIndex);
+    }
+    if(e->depth > 1) {
+        return failExpression(table, id, "more input than required operators in reverse polish expression", endIndex);
+    }
+    if(e->maxDepth > EVAL_STACK_SIZE && e->maxDepth > table->deepStackSize) {
+        trackRunMemory(memExpressions, table->deepStackSize * sizeof(double), 0);
+        table->deepStack = (double*) runAlloc(e->maxDepth * sizeof(double), memExpressions);
+        table->deepStackSize = e->maxDepth;
+    }
+    return 1;
+}
+
+// records why the expression can't be compiled. Always returns 0
+int failExpression(ExpressionTable table, int id, char *error, int64_t errorIndex)
+{
+    Expression *e = &table->expressions[id];
+    if(e->error == NULL) {
+        e->error = error;
+        e->errorIndex = errorIndex;
+    }
+    return 0;
+}
+
+Expression *getExpression(ExpressionTable table, int id)
+{
+    return &table->expressions[id];
+}
+
+// doubles the number of buckets and puts every expression back in
+void growExpressionBuckets(ExpressionTable table)
+{
+    trackRunMemory(memExpressions, table->numOfBuckets * sizeof(int), 0);
+    table->numOfBuckets *= 2;
+    table->buckets = (int*) runAlloc(table->numOfBuckets * sizeof(int), memExpressions);
+    uint32_t mask = (uint32_t) table->numOfBuckets - 1;
+    for(int i = 0; i < table->numOfBuckets; i++) {
+        table->buckets[i] = NO_EXPRESSION;
+    }
+    for(int i = 0; i < table->numOfExpressions; i++) {
+        uint32_t b = (uint32_t) (table->expressions[i].startIndex * 2654435761u) & mask;
+        while(table->buckets[b] != NO_EXPRESSION) {
+            b = (b + 1) & mask;
+        }
+        table->buckets[b] = i;
+    }
+}
+
+
+
+//  EVALUATING FUNCTIONS  ////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// works out the value of a compiled expression. The values are held in a buffer on the C stack unless the expression is too deep for it.
+// Returns 0 if a variable in the expression hasn't been assigned, with failedIndex set to the variable's token
+int evaluateExpression(ExpressionTable table, int id, int interpret, double *result, int64_t *failedIndex)
+{
+    Expression *e = &table->expressions[id];
+    ExprOp *ops = table->ops + e->firstOp;
+    if(e->maxDepth <= EVAL_STACK_SIZE) {
+        double stack[EVAL_STACK_SIZE];
+        return runExpressionOps(ops, e->numOfOps, stack, interpret, result, failedIndex);
+    }
+    return runExpressionOps(ops, e->numOfOps, table->deepStack, interpret, result, failedIndex);
+}
+
+// the arity of the ops has already been checked, so the stack can't run out
+int runExpressionOps(ExprOp *ops, int numOfOps, double *stack, int interpret, double *result, int64_t *failedIndex)
+{
+    int top = 0;
+    for(int i = 0; i < numOfOps; i++) {
+        switch(ops[i].type) {
+            case pushNumber :
+                stack[top++] = ops[i].val;
+                break;
+            case pushVariable :
+                stack[top] = 0;
+                if(!checkSlotAssigned(ops[i].slot, interpret, &stack[top])) {
+                    *failedIndex = ops[i].tokenIndex;
+                    return 0;
+                }
+                top++;
+                break;
+            case applyOperator :
+                top--;
+                stack[top-1] = doMaths(stack[top-1], stack[top], (mathSymbol) ops[i].slot);
+                break;
+        }
+    }
+    *result = stack[0];
+    return 1;
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runExpressionWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testExpressionCompiling(): Checking reverse polish expressions are compiled and their arity checked");
+    sput_run_test(testExpressionCompiling);
+    sput_leave_suite();
+
+    sput_enter_suite("testExpressionEvaluation(): Checking compiled expressions give the right values");
+    sput_run_test(testExpressionEvaluation);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testExpressionCompiling()
+{
+    ExpressionTable table = createExpressionTable();
+
+      // 3 12.4 + ;
+    int id = beginExpression(table, 10);
+    addExpressionOp(table, id, pushNumber, 0, 3, 11);
+    addExpressionOp(table, id, pushNumber, 0, 12.4, 12);
+    sput_fail_unless(getExpression(table, id)->depth == 2, "After adding two values, expression holds 2 values");
+    addExpressionOp(table, id, applyOperator, add, 0, 13);
+    sput_fail_unless(finishExpression(table, id, 14) == 1, "Expression with one value left compiles");
+    sput_fail_unless(getExpression(table, id)->maxDepth == 2 && getExpression(table, id)->numOfOps == 3, "Maximum depth and op count found");
+    sput_fail_unless(findExpression(table, 10) == id && findExpression(table, 11) == NO_EXPRESSION, "Expression found by its start token");
+
+      // 3 + ;
+    id = beginExpression(table, 20);
+    addExpressionOp(table, id, pushNumber, 0, 3, 21);
+    sput_fail_unless(addExpressionOp(table, id, applyOperator, add, 0, 22) == 0, "Operator with one value is refused");
+    sput_fail_unless(getExpression(table, id)->error != NULL && getExpression(table, id)->errorIndex == 22, "Error recorded at the operator");
+
+      // 3 4 ;
+    id = beginExpression(table, 30);
+    addExpressionOp(table, id, pushNumber, 0, 3, 31);
+    addExpressionOp(table, id, pushNumber, 0, 4, 32);
+    sput_fail_unless(finishExpression(table, id, 33) == 0 && getExpression(table, id)->errorIndex == 33, "Expression with values left over is refused");
+
+    id = beginExpression(table, 40);
+    sput_fail_unless(finishExpression(table, id, 41) == 0, "Empty expression is refused");
+
+    for(int i = 0; i < 1000; i++) {
+        beginExpression(table, 100 + i);
+    }
+    sput_fail_unless(findExpression(table, 10) == 0 && findExpression(table, 1099) == 1003, "Expressions still found after the table grows");
+
+}
+
+void testExpressionEvaluation()
+{
+    setUpForInterpreting(TESTING, INTERPRET);
+    ExpressionTable table = createExpressionTable();
+    double result = 0;
+    int64_t failedIndex = -1;
+
+      // 8 56 21 5 8 1 - + / + * ;
+    int id = beginExpression(table, 0);
+    double vals[] = {8, 56, 21, 5, 8, 1};
+    for(int i = 0; i < 6; i++) {
+        addExpressionOp(table, id, pushNumber, 0, vals[i], i+1);
+    }
+    mathSymbol ops[] = {subtract, add, divide, add, multiply};
+    for(int i = 0; i < 5; i++) {
+        addExpressionOp(table, id, applyOperator, ops[i], 0, i+7);
+    }
+    finishExpression(table, id, 12);
+    sput_fail_unless(evaluateExpression(table, id, INTERPRET, &result, &failedIndex) == 1 && result == 8 * (56 + 21.0 / (5 + (8 - 1))), "Long expression evaluated correctly");
+
+      // A 2 * ;
+    id = beginExpression(table, 20);
+    addExpressionOp(table, id, pushVariable, 'A' - 'A', 0, 21);
+    addExpressionOp(table, id, pushNumber, 0, 2, 22);
+    addExpressionOp(table, id, applyOperator, multiply, 0, 23);
+    finishExpression(table, id, 24);
+    sput_fail_unless(evaluateExpression(table, id, INTERPRET, &result, &failedIndex) == 0 && failedIndex == 21, "Unassigned variable found when evaluating");
+    assignValToVariable('A', 7, INTERPRET);
+    sput_fail_unless(evaluateExpression(table, id, INTERPRET, &result, &failedIndex) == 1 && result == 14, "Expression uses variable's current value");
+
+      // 1 1 1 ... + + + ; deeper than the buffer on the C stack
+    id = beginExpression(table, 100);
+    for(int i = 0; i < EVAL_STACK_SIZE * 2; i++) {
+        addExpressionOp(table, id, pushNumber, 0, 1, 101 + i);
+    }
+    for(int i = 1; i < EVAL_STACK_SIZE * 2; i++) {
+        addExpressionOp(table, id, applyOperator, add, 0, 101 + EVAL_STACK_SIZE * 2 + i);
+    }
+    sput_fail_unless(finishExpression(table, id, 1000) == 1, "Deep expression compiles");
+    sput_fail_unless(evaluateExpression(table, id, INTERPRET, &result, &failedIndex) == 1 && result == EVAL_STACK_SIZE * 2, "Deep expression evaluated correctly");
+
+    shutDownInterpreting();
+}
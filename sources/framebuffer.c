@@ -0,0 +1,764 @@
+#include "../includes/parser.h" // the tests draw through display.c, which parser.h includes
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ADLER_MODULUS 65521
+
+static uint32_t crcTable[256];
+static int crcTableBuilt = 0;
+static int antialiasing = 0;
+static LineKernel lineKernel = kernelAuto; // until a kernel has been chosen
+static SpanKernel spanFiller = fillSpanScalar;
+static CoverageKernel coverageKernel = findCoverageScalar;
+
+
+
+//  SETUP FUNCTIONS  /////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// the framebuffer is made in the run arena, cleared to black with white lines, like a new SDL window
+void createFramebuffer(int width, int height)
+{
+    Framebuffer fb = (Framebuffer) runAlloc(sizeof(struct framebuffer), memDisplay);
+    fb->width = width;
+    fb->height = height;
+    fb->pixels = (uint8_t*) runAlloc((size_t) width * height * BYTES_PER_PIXEL, memDisplay);
+    if(getLineKernel() == kernelAuto) {
+        selectLineKernel(kernelAuto);
+    }
+    clearFramebuffer(fb, 0, 0, 0);
+    setPenArea(&fb->pen, 0, 0, width - 1, height - 1);
+    setFramebufferColour(fb, 255, 255, 255);
+    getFramebufferPointer(fb);
+}
+
+// if passed NULL, returns pointer to the Framebuffer. If passed pointer, sets static pointer to the new pointer
+Framebuffer getFramebufferPointer(Framebuffer newFramebuffer)
+{
+    static Framebuffer fb = NULL;
+    if(newFramebuffer != NULL) {
+        fb = newFramebuffer;
+    }
+    return fb;
+}
+
+
+
+//  DRAWING FUNCTIONS  ///////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void clearFramebuffer(Framebuffer fb, uint8_t r, uint8_t g, uint8_t b)
+{
+    size_t numOfPixels = (size_t) fb->width * fb->height;
+    for(size_t i = 0; i < numOfPixels; i++) {
+        fb->pixels[i * BYTES_PER_PIXEL] = r;
+        fb->pixels[i * BYTES_PER_PIXEL + 1] = g;
+        fb->pixels[i * BYTES_PER_PIXEL + 2] = b;
+    }
+}
+
+void setFramebufferColour(Framebuffer fb, uint8_t r, uint8_t g, uint8_t b)
+{
+    setPenColour(&fb->pen, r, g, b);
+}
+
+// also fills the pattern the span kernels copy from, so nothing has to be set up per line
+void setPenColour(Pen *pen, uint8_t r, uint8_t g, uint8_t b)
+{
+    pen->r = r;
+    pen->g = g;
+    pen->b = b;
+    for(int i = 0; i < SPAN_PATTERN_PIXELS; i++) {
+        pen->pattern[i * BYTES_PER_PIXEL] = r;
+        pen->pattern[i * BYTES_PER_PIXEL + 1] = g;
+        pen->pattern[i * BYTES_PER_PIXEL + 2] = b;
+    }
+}
+
+void setPenArea(Pen *pen, int left, int top, int right, int bottom)
+{
+    pen->left = left;
+    pen->top = top;
+    pen->right = right;
+    pen->bottom = bottom;
+}
+
+// draws a line with both ends included in the framebuffer's own pen
+void drawFramebufferLine(Framebuffer fb, int x0, int y0, int x1, int y1)
+{
+    drawPenLine(fb, &fb->pen, x0, y0, x1, y1);
+}
+
+// draws the part of a line inside the pen's area, anti-aliased if that has been asked for. Which pixels a line covers depends only
+// on its ends, so drawing it in pieces through pens with areas side by side gives the same pixels as drawing it whole
+void drawPenLine(Framebuffer fb, Pen *pen, int x0, int y0, int x1, int y1)
+{
+    if(antialiasing) {
+        drawWuLine(fb, pen, x0, y0, x1, y1);
+    } else {
+        drawBresenhamLine(fb, pen, x0, y0, x1, y1);
+    }
+}
+
+// Bresenham's line drawn a run at a time. A line that is mostly across puts a run of pixels on each row it crosses; the pixels at
+// i steps along are on row round(i * rows / columns) (halves round up), so the last pixel of row k is found with one division instead
+// of stepping the error along pixel by pixel. Each run is filled by the span kernel. A line that is mostly down is drawn the same way
+// a column at a time, but a column's pixels aren't next to each other in memory, so they are plotted one by one. Only the rows (or
+// columns) inside the pen's area are visited
+void drawBresenhamLine(Framebuffer fb, Pen *pen, int x0, int y0, int x1, int y1)
+{
+    int64_t dx = llabs((int64_t) x1 - x0);
+    int64_t dy = llabs((int64_t) y1 - y0);
+    if(dx >= dy) {
+        if(x1 < x0) {
+            int temp = x0; x0 = x1; x1 = temp;
+            temp = y0; y0 = y1; y1 = temp;
+        }
+        int stepY = (y0 < y1) ? 1 : -1;
+        int64_t first = (stepY > 0) ? (int64_t) pen->top - y0 : (int64_t) y0 - pen->bottom;
+        int64_t last = (stepY > 0) ? (int64_t) pen->bottom - y0 : (int64_t) y0 - pen->top;
+        first = (first > 0) ? first : 0;
+        last = (last < dy) ? last : dy;
+        for(int64_t k = first; k <= last; k++) {
+            int64_t start = (k == 0) ? 0 : ((2 * k - 1) * dx - 1) / (2 * dy) + 1;
+            int64_t end = (dy == 0) ? dx : ((2 * k + 1) * dx - 1) / (2 * dy);
+            end = (end < dx) ? end : dx;
+            int64_t left = x0 + start, right = x0 + end;
+            left = (left > pen->left) ? left : pen->left;
+            right = (right < pen->right) ? right : pen->right;
+            if(left <= right) {
+                uint8_t *row = &fb->pixels[((size_t) (y0 + stepY * k) * fb->width + left) * BYTES_PER_PIXEL];
+                spanFiller(row, (int) (right - left + 1), pen->pattern);
+            }
+        }
+    } else {
+        if(y1 < y0) {
+            int temp = x0; x0 = x1; x1 = temp;
+            temp = y0; y0 = y1; y1 = temp;
+        }
+        int stepX = (x0 < x1) ? 1 : -1;
+        int64_t first = (stepX > 0) ? (int64_t) pen->left - x0 : (int64_t) x0 - pen->right;
+        int64_t last = (stepX > 0) ? (int64_t) pen->right - x0 : (int64_t) x0 - pen->left;
+        first = (first > 0) ? first : 0;
+        last = (last < dx) ? last : dx;
+        for(int64_t k = first; k <= last; k++) {
+            int64_t start = (k == 0) ? 0 : ((2 * k - 1) * dy - 1) / (2 * dx) + 1;
+            int64_t end = (dx == 0) ? dy : ((2 * k + 1) * dy - 1) / (2 * dx);
+            end = (end < dy) ? end : dy;
+            int64_t top = y0 + start, bottom = y0 + end;
+            top = (top > pen->top) ? top : pen->top;
+            bottom = (bottom < pen->bottom) ? bottom : pen->bottom;
+            for(int64_t y = top; y <= bottom; y++) {
+                plotPixel(fb, pen, (int) (x0 + stepX * k), (int) y);
+            }
+        }
+    }
+}
+
+// Xiaolin Wu's line: at each step along the line, the two pixels either side of it share the colour in proportion to how close
+// the line passes to each, blended over what is already there. The rows (or columns) and shares are worked out WU_BATCH steps at a
+// time by the coverage kernel, and then blended. Both ends land on whole pixels, so they are drawn solid
+void drawWuLine(Framebuffer fb, Pen *pen, int x0, int y0, int x1, int y1)
+{
+    int xMajor = abs(x1 - x0) >= abs(y1 - y0);
+    if(xMajor ? x1 < x0 : y1 < y0) {
+        int temp = x0; x0 = x1; x1 = temp;
+        temp = y0; y0 = y1; y1 = temp;
+    }
+      // along is the axis the line covers most of, across the other
+    int alongStart = xMajor ? x0 : y0, alongEnd = xMajor ? x1 : y1;
+    int acrossStart = xMajor ? y0 : x0, acrossEnd = xMajor ? y1 : x1;
+    int alongMin = xMajor ? pen->left : pen->top, alongMax = xMajor ? pen->right : pen->bottom;
+    float gradient = (alongEnd == alongStart) ? 0 : (float) (acrossEnd - acrossStart) / (alongEnd - alongStart);
+
+    int first = (alongStart < alongMin) ? alongMin - alongStart : 0;
+    int last = (alongEnd <= alongMax) ? alongEnd - alongStart : alongMax - alongStart;
+    int rows[WU_BATCH], coverage[WU_BATCH];
+    for(int i = first; i <= last; i += WU_BATCH) {
+        int count = (last - i + 1 < WU_BATCH) ? last - i + 1 : WU_BATCH;
+        coverageKernel(gradient, i, count, rows, coverage);
+        for(int j = 0; j < count; j++) {
+            int along = alongStart + i + j;
+            int across = acrossStart + rows[j];
+            if(xMajor) {
+                blendPixel(fb, pen, along, across, COVERAGE_ONE - coverage[j]);
+                blendPixel(fb, pen, along, across + 1, coverage[j]);
+            } else {
+                blendPixel(fb, pen, across, along, COVERAGE_ONE - coverage[j]);
+                blendPixel(fb, pen, across + 1, along, coverage[j]);
+            }
+        }
+    }
+}
+
+// moves the pixel coverage / COVERAGE_ONE of the way from its colour to the pen's colour
+void blendPixel(Framebuffer fb, Pen *pen, int x, int y, int coverage)
+{
+    if(coverage <= 0 || x < pen->left || y < pen->top || x > pen->right || y > pen->bottom) {
+        return;
+    }
+    uint8_t *pixel = &fb->pixels[((size_t) y * fb->width + x) * BYTES_PER_PIXEL];
+    pixel[0] = (uint8_t) (pixel[0] + (((int) pen->r - pixel[0]) * coverage) / COVERAGE_ONE);
+    pixel[1] = (uint8_t) (pixel[1] + (((int) pen->g - pixel[1]) * coverage) / COVERAGE_ONE);
+    pixel[2] = (uint8_t) (pixel[2] + (((int) pen->b - pixel[2]) * coverage) / COVERAGE_ONE);
+}
+
+// lines are clipped before they get here, but can still end on the pixel just past the right or bottom edge
+void plotPixel(Framebuffer fb, Pen *pen, int x, int y)
+{
+    if(x < pen->left || y < pen->top || x > pen->right || y > pen->bottom) {
+        return;
+    }
+    uint8_t *pixel = &fb->pixels[((size_t) y * fb->width + x) * BYTES_PER_PIXEL];
+    pixel[0] = pen->r;
+    pixel[1] = pen->g;
+    pixel[2] = pen->b;
+}
+
+
+
+//  LINE KERNEL FUNCTIONS  ///////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// chooses which span and coverage kernels lines are drawn with. kernelAuto picks the widest the processor supports. Asking for one
+// the processor (or the compiler) doesn't support falls back to the widest that it does. Returns the kernel chosen
+LineKernel selectLineKernel(LineKernel kernel)
+{
+    LineKernel best = kernelScalar;
+#ifdef X86_LINE_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) {
+        best = kernelSSE2;
+    }
+    if(__builtin_cpu_supports("avx2")) {
+        best = kernelAVX2;
+    }
+#endif
+    if(kernel == kernelAuto || kernel > best) {
+        kernel = best;
+    }
+    switch(kernel) {
+#ifdef X86_LINE_KERNELS
+        case kernelAVX2 :
+            spanFiller = fillSpanAVX2;
+            coverageKernel = findCoverageSSE2;
+            break;
+        case kernelSSE2 :
+            spanFiller = fillSpanSSE2;
+            coverageKernel = findCoverageSSE2;
+            break;
+#endif
+        default :
+            kernel = kernelScalar;
+            spanFiller = fillSpanScalar;
+            coverageKernel = findCoverageScalar;
+    }
+    lineKernel = kernel;
+    return kernel;
+}
+
+LineKernel getLineKernel()
+{
+    return lineKernel;
+}
+
+void setAntialiasing(int antialias)
+{
+    antialiasing = antialias;
+}
+
+int getAntialiasing()
+{
+    return antialiasing;
+}
+
+void fillSpanScalar(uint8_t *row, int numOfPixels, uint8_t *pattern)
+{
+    for(int i = 0; i < numOfPixels; i++) {
+        row[i * BYTES_PER_PIXEL] = pattern[0];
+        row[i * BYTES_PER_PIXEL + 1] = pattern[1];
+        row[i * BYTES_PER_PIXEL + 2] = pattern[2];
+    }
+}
+
+// finds, for steps first to first+count-1 along a line, the row (or column) offset of the pixel on or before the line and the share of
+// the colour the pixel after it gets
+void findCoverageScalar(float gradient, int first, int count, int *rows, int *coverage)
+{
+    for(int j = 0; j < count; j++) {
+        float across = gradient * (first + j);
+        float row = floorf(across);
+        rows[j] = (int) row;
+        coverage[j] = (int) ((across - row) * COVERAGE_ONE);
+    }
+}
+
+#ifdef X86_LINE_KERNELS
+
+// 16 pixels are 48 bytes, so three 16 byte stores from the pattern fill them whatever colour is being drawn
+__attribute__((target("sse2")))
+void fillSpanSSE2(uint8_t *row, int numOfPixels, uint8_t *pattern)
+{
+    __m128i a = _mm_loadu_si128((__m128i*) pattern);
+    __m128i b = _mm_loadu_si128((__m128i*) (pattern + 16));
+    __m128i c = _mm_loadu_si128((__m128i*) (pattern + 32));
+    for(; numOfPixels >= 16; numOfPixels -= 16, row += 48) {
+        _mm_storeu_si128((__m128i*) row, a);
+        _mm_storeu_si128((__m128i*) (row + 16), b);
+        _mm_storeu_si128((__m128i*) (row + 32), c);
+    }
+    fillSpanScalar(row, numOfPixels, pattern);
+}
+
+// as fillSpanSSE2, 32 pixels at a time
+__attribute__((target("avx2")))
+void fillSpanAVX2(uint8_t *row, int numOfPixels, uint8_t *pattern)
+{
+    __m256i a = _mm256_loadu_si256((__m256i*) pattern);
+    __m256i b = _mm256_loadu_si256((__m256i*) (pattern + 32));
+    __m256i c = _mm256_loadu_si256((__m256i*) (pattern + 64));
+    for(; numOfPixels >= 32; numOfPixels -= 32, row += 96) {
+        _mm256_storeu_si256((__m256i*) row, a);
+        _mm256_storeu_si256((__m256i*) (row + 32), b);
+        _mm256_storeu_si256((__m256i*) (row + 64), c);
+    }
+    fillSpanSSE2(row, numOfPixels, pattern);
+}
+
+// as findCoverageScalar, four steps at a time. Truncating rounds negative offsets up, so those are moved down by one to floor them
+__attribute__((target("sse2")))
+void findCoverageSSE2(float gradient, int first, int count, int *rows, int *coverage)
+{
+    __m128 slope = _mm_set1_ps(gradient);
+    __m128 scale = _mm_set1_ps((float) COVERAGE_ONE);
+    __m128i step = _mm_setr_epi32(first, first + 1, first + 2, first + 3);
+    int j = 0;
+    for(; j + 4 <= count; j += 4) {
+        __m128 across = _mm_mul_ps(slope, _mm_cvtepi32_ps(step));
+        __m128i row = _mm_cvttps_epi32(across);
+        row = _mm_add_epi32(row, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(row), across)));
+        __m128 share = _mm_mul_ps(_mm_sub_ps(across, _mm_cvtepi32_ps(row)), scale);
+        _mm_storeu_si128((__m128i*) (rows + j), row);
+        _mm_storeu_si128((__m128i*) (coverage + j), _mm_cvttps_epi32(share));
+        step = _mm_add_epi32(step, _mm_set1_epi32(4));
+    }
+    findCoverageScalar(gradient, first + j, count - j, rows + j, coverage + j);
+}
+
+#endif
+
+
+
+//  IMAGE WRITING FUNCTIONS  /////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// writes the framebuffer as a PNG if filePath ends in .png, and as a PPM otherwise. Like a .tbc file it is written next to filePath and
+// renamed into place. Returns 0 if the file couldn't be written
+int writeFramebufferImage(Framebuffer fb, char *filePath)
+{
+    size_t tempLength = strlen(filePath) + 8;
+    char *tempPath = (char*) malloc(tempLength);
+    if(tempPath == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for temporary file name in writeFramebufferImage()\n");
+        exit(1);
+    }
+    snprintf(tempPath, tempLength, "%s.XXXXXX", filePath);
+    int fd = mkstemp(tempPath);
+    if(fd < 0) {
+        free(tempPath);
+        return 0;
+    }
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    FILE *file = fdopen(fd, "wb");
+    int written = file != NULL;
+    if(checkForExtension(filePath, ".png")) {
+        written = written && writePNG(fb, file);
+    } else {
+        written = written && writePPM(fb, file);
+    }
+    if(file != NULL) {
+        written = (fclose(file) == 0) && written;
+    } else {
+        close(fd);
+    }
+
+    written = written && rename(tempPath, filePath) == 0;
+    if(!written) {
+        unlink(tempPath);
+    }
+    free(tempPath);
+    return written;
+}
+
+// binary PPM: a short text header then the pixels exactly as they are held
+int writePPM(Framebuffer fb, FILE *file)
+{
+    size_t size = (size_t) fb->width * fb->height * BYTES_PER_PIXEL;
+    return fprintf(file, "P6\n%d %d\n255\n", fb->width, fb->height) > 0 && fwrite(fb->pixels, 1, size, file) == size;
+}
+
+// PNG with the image data stored in uncompressed deflate blocks, so no compression library is needed. Each row is written with filter
+// type 0 (none) in front of it. The image data is streamed a row at a time inside one IDAT chunk, whose length is known in advance
+int writePNG(Framebuffer fb, FILE *file)
+{
+    static uint8_t signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    uint8_t header[13];
+    putBigEndian32(header, (uint32_t) fb->width);
+    putBigEndian32(header + 4, (uint32_t) fb->height);
+    header[8] = 8; // bits per channel
+    header[9] = PNG_COLOUR_TYPE_RGB;
+    header[10] = 0; // deflate
+    header[11] = 0; // adaptive filtering
+    header[12] = 0; // not interlaced
+    if(fwrite(signature, 1, sizeof(signature), file) != sizeof(signature) || !writePNGChunk(file, "IHDR", header, sizeof(header))) {
+        return 0;
+    }
+
+    size_t rowSize = 1 + (size_t) fb->width * BYTES_PER_PIXEL;
+    size_t rawSize = rowSize * fb->height;
+    size_t numOfBlocks = (rawSize + PNG_STORED_BLOCK - 1) / PNG_STORED_BLOCK;
+    size_t dataSize = 2 + numOfBlocks * 5 + rawSize + 4; // zlib header, block headers, rows, Adler-32
+
+    uint8_t *row = (uint8_t*) malloc(rowSize);
+    if(row == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for image row in writePNG()\n");
+        exit(1);
+    }
+    uint8_t start[8];
+    putBigEndian32(start, (uint32_t) dataSize);
+    memcpy(start + 4, "IDAT", 4);
+    uint8_t zlibHeader[2] = {0x78, 0x01};
+    int written = fwrite(start, 1, 8, file) == 8 && fwrite(zlibHeader, 1, 2, file) == 2;
+    uint32_t crc = updateCRC32(updateCRC32(0xFFFFFFFFu, start + 4, 4), zlibHeader, 2);
+
+    uint32_t adlerA = 1, adlerB = 0;
+    size_t rawLeft = rawSize;
+    size_t blockLeft = 0;
+    for(int y = 0; written && y < fb->height; y++) {
+        row[0] = 0;
+        memcpy(row + 1, fb->pixels + (size_t) y * fb->width * BYTES_PER_PIXEL, rowSize - 1);
+        for(size_t i = 0; i < rowSize; i++) {
+            adlerA = (adlerA + row[i]) % ADLER_MODULUS;
+            adlerB = (adlerB + adlerA) % ADLER_MODULUS;
+        }
+        size_t position = 0;
+        while(written && position < rowSize) {
+            if(blockLeft == 0) {
+                blockLeft = (rawLeft < PNG_STORED_BLOCK) ? rawLeft : PNG_STORED_BLOCK;
+                uint8_t blockHeader[5];
+                blockHeader[0] = (blockLeft == rawLeft) ? 1 : 0; // set on the final block
+                blockHeader[1] = (uint8_t) (blockLeft & 0xFF);
+                blockHeader[2] = (uint8_t) (blockLeft >> 8);
+                blockHeader[3] = (uint8_t) (~blockLeft & 0xFF);
+                blockHeader[4] = (uint8_t) ((~blockLeft >> 8) & 0xFF);
+                written = fwrite(blockHeader, 1, 5, file) == 5;
+                crc = updateCRC32(crc, blockHeader, 5);
+            }
+            size_t length = (blockLeft < rowSize - position) ? blockLeft : rowSize - position;
+            written = written && fwrite(row + position, 1, length, file) == length;
+            crc = updateCRC32(crc, row + position, length);
+            position += length;
+            blockLeft -= length;
+            rawLeft -= length;
+        }
+    }
+    free(row);
+
+    uint8_t end[8];
+    putBigEndian32(end, (adlerB << 16) | adlerA);
+    putBigEndian32(end + 4, updateCRC32(crc, end, 4) ^ 0xFFFFFFFFu);
+    written = written && fwrite(end, 1, 8, file) == 8;
+    return written && writePNGChunk(file, "IEND", NULL, 0);
+}
+
+// writes a whole chunk: its length, type, data and the CRC of the type and data
+int writePNGChunk(FILE *file, char *type, uint8_t *data, size_t length)
+{
+    uint8_t buffer[8];
+    putBigEndian32(buffer, (uint32_t) length);
+    memcpy(buffer + 4, type, 4);
+    uint32_t crc = updateCRC32(0xFFFFFFFFu, buffer + 4, 4);
+    crc = updateCRC32(crc, data, length) ^ 0xFFFFFFFFu;
+    int written = fwrite(buffer, 1, 8, file) == 8 && (length == 0 || fwrite(data, 1, length, file) == length);
+    putBigEndian32(buffer, crc);
+    return written && fwrite(buffer, 1, 4, file) == 4;
+}
+
+// the CRC-32 PNG uses, a table driven byte at a time. Start with 0xFFFFFFFF and flip every bit of the result
+uint32_t updateCRC32(uint32_t crc, uint8_t *data, size_t length)
+{
+    if(!crcTableBuilt) {
+        for(uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            crcTable[n] = c;
+        }
+        crcTableBuilt = 1;
+    }
+    for(size_t i = 0; i < length; i++) {
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+void putBigEndian32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t) (value >> 24);
+    buffer[1] = (uint8_t) (value >> 16);
+    buffer[2] = (uint8_t) (value >> 8);
+    buffer[3] = (uint8_t) value;
+}
+
+// returns 1 if filePath ends in extension, ignoring case
+int checkForExtension(char *filePath, char *extension)
+{
+    size_t pathLength = strlen(filePath);
+    size_t extensionLength = strlen(extension);
+    if(pathLength < extensionLength) {
+        return 0;
+    }
+    for(size_t i = 0; i < extensionLength; i++) {
+        char c = filePath[pathLength - extensionLength + i];
+        if(c >= 'A' && c <= 'Z') {
+            c = c - 'A' + 'a';
+        }
+        if(c != extension[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runFramebufferWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testFramebufferLines(): Checking lines are drawn pixel by pixel into the framebuffer");
+    sput_run_test(testFramebufferLines);
+    sput_leave_suite();
+
+    sput_enter_suite("testLineKernels(): Checking every line kernel draws the same pixels");
+    sput_run_test(testLineKernels);
+    sput_leave_suite();
+
+    sput_enter_suite("testAntialiasing(): Checking anti-aliased lines share their colour between neighbouring pixels");
+    sput_run_test(testAntialiasing);
+    sput_leave_suite();
+
+    sput_enter_suite("testImageWriting(): Checking the framebuffer is written as PPM and PNG files");
+    sput_run_test(testImageWriting);
+    sput_leave_suite();
+
+    sput_enter_suite("testHeadlessDrawing(): Checking programs are drawn into the framebuffer when there is no window");
+    sput_run_test(testHeadlessDrawing);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+// counts the pixels that aren't black
+int countLitPixels(Framebuffer fb)
+{
+    int lit = 0;
+    for(int i = 0; i < fb->width * fb->height; i++) {
+        uint8_t *pixel = &fb->pixels[i * BYTES_PER_PIXEL];
+        lit += (pixel[0] | pixel[1] | pixel[2]) != 0;
+    }
+    return lit;
+}
+
+void testFramebufferLines()
+{
+    createFramebuffer(100, 50);
+    Framebuffer fb = getFramebufferPointer(NULL);
+    sput_fail_unless(countLitPixels(fb) == 0, "New framebuffer is black");
+
+    drawFramebufferLine(fb, 10, 10, 19, 10);
+    sput_fail_unless(countLitPixels(fb) == 10 && fb->pixels[(10 * 100 + 19) * BYTES_PER_PIXEL] == 255, "Horizontal line covers both ends");
+
+    clearFramebuffer(fb, 0, 0, 0);
+    drawFramebufferLine(fb, 30, 40, 20, 0);
+    sput_fail_unless(countLitPixels(fb) == 41, "Steep line going up and left has one pixel on every row");
+
+    clearFramebuffer(fb, 0, 0, 0);
+    setFramebufferColour(fb, RED_R, RED_G, RED_B);
+    drawFramebufferLine(fb, 90, 40, 110, 60);
+    uint8_t *corner = &fb->pixels[(49 * 100 + 99) * BYTES_PER_PIXEL];
+    sput_fail_unless(countLitPixels(fb) == 10 && corner[0] == RED_R && corner[2] == RED_B, "Line leaving the framebuffer stops at its edge");
+    resetRunArena();
+}
+
+// draws the same scattered lines, some crossing the edges and some long, in every colour
+void drawTestLines(Framebuffer fb)
+{
+    uint32_t seed = 12345;
+    for(int i = 0; i < 300; i++) {
+        int coordinates[4];
+        for(int j = 0; j < 4; j++) {
+            seed = seed * 1103515245u + 12345u;
+            coordinates[j] = (int) ((seed >> 8) % 400) - 50;
+        }
+        setFramebufferColour(fb, (uint8_t) (i * 37), (uint8_t) (i * 91), (uint8_t) (255 - i));
+        drawFramebufferLine(fb, coordinates[0], coordinates[1], coordinates[2], coordinates[3]);
+    }
+    drawFramebufferLine(fb, -100000, 150, 100000, 151);
+    drawFramebufferLine(fb, 150, -100000, 151, 100000);
+}
+
+void testLineKernels()
+{
+    createFramebuffer(300, 250);
+    Framebuffer fb = getFramebufferPointer(NULL);
+    LineKernel chosen = getLineKernel();
+    sput_fail_unless(chosen != kernelAuto && selectLineKernel(kernelAVX2) == chosen, "Widest supported kernel chosen");
+
+    selectLineKernel(kernelScalar);
+    drawFramebufferLine(fb, 0, 0, 9, 3);
+    uint8_t *row = &fb->pixels[300 * BYTES_PER_PIXEL];
+    sput_fail_unless(countLitPixels(fb) == 10 && row[1 * BYTES_PER_PIXEL] == 0 && row[2 * BYTES_PER_PIXEL] == 255 &&
+                     row[4 * BYTES_PER_PIXEL] == 255 && row[5 * BYTES_PER_PIXEL] == 0, "Shallow line drawn as a run on each row");
+    uint8_t *before = (uint8_t*) malloc(300 * 250 * BYTES_PER_PIXEL);
+    if(before == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for test image in testLineKernels()\n");
+        exit(1);
+    }
+    memcpy(before, fb->pixels, 300 * 250 * BYTES_PER_PIXEL);
+    clearFramebuffer(fb, 0, 0, 0);
+    setFramebufferColour(fb, 255, 255, 255);
+    drawFramebufferLine(fb, 9, 3, 0, 0);
+    sput_fail_unless(memcmp(before, fb->pixels, 300 * 250 * BYTES_PER_PIXEL) == 0, "Line drawn either way round covers the same pixels");
+
+    clearFramebuffer(fb, 0, 0, 0);
+    drawTestLines(fb);
+    memcpy(before, fb->pixels, 300 * 250 * BYTES_PER_PIXEL);
+    for(LineKernel kernel = kernelSSE2; kernel <= chosen; kernel++) {
+        selectLineKernel(kernel);
+        clearFramebuffer(fb, 0, 0, 0);
+        drawTestLines(fb);
+        sput_fail_unless(memcmp(before, fb->pixels, 300 * 250 * BYTES_PER_PIXEL) == 0, "Wider kernel draws the same as the scalar one");
+    }
+
+    setAntialiasing(1);
+    selectLineKernel(kernelScalar);
+    clearFramebuffer(fb, 0, 0, 0);
+    drawTestLines(fb);
+    memcpy(before, fb->pixels, 300 * 250 * BYTES_PER_PIXEL);
+    selectLineKernel(chosen);
+    clearFramebuffer(fb, 0, 0, 0);
+    drawTestLines(fb);
+    sput_fail_unless(memcmp(before, fb->pixels, 300 * 250 * BYTES_PER_PIXEL) == 0, "Anti-aliased lines the same with every kernel");
+    setAntialiasing(0);
+
+    free(before);
+    resetRunArena();
+}
+
+void testAntialiasing()
+{
+    setAntialiasing(1);
+    createFramebuffer(100, 50);
+    Framebuffer fb = getFramebufferPointer(NULL);
+    drawFramebufferLine(fb, 10, 10, 19, 10);
+    sput_fail_unless(countLitPixels(fb) == 10 && fb->pixels[(10 * 100 + 15) * BYTES_PER_PIXEL] == 255, "Straight line drawn solid");
+
+    clearFramebuffer(fb, 0, 0, 0);
+    drawFramebufferLine(fb, 10, 0, 0, 5);
+    uint8_t *above = &fb->pixels[(0 * 100 + 9) * BYTES_PER_PIXEL];
+    uint8_t *below = &fb->pixels[(1 * 100 + 9) * BYTES_PER_PIXEL];
+    uint8_t *onLine = &fb->pixels[(1 * 100 + 8) * BYTES_PER_PIXEL];
+    sput_fail_unless(above[0] == 127 && below[0] == 127, "Pixels either side of the line share its colour");
+    sput_fail_unless(onLine[0] == 255 && countLitPixels(fb) == 16, "Pixel the line passes through drawn solid");
+
+    clearFramebuffer(fb, 0, 0, 255);
+    setFramebufferColour(fb, 255, 0, 0);
+    drawFramebufferLine(fb, 10, 0, 0, 5);
+    sput_fail_unless(above[0] == 127 && above[2] == 128, "Colour blended over the background");
+    setAntialiasing(0);
+    resetRunArena();
+}
+
+void testImageWriting()
+{
+    char directory[] = "/tmp/turtleImageXXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        fprintf(stderr, "ERROR - unable to make temporary directory in testImageWriting()\n");
+        exit(1);
+    }
+    char ppmPath[100], pngPath[100];
+    snprintf(ppmPath, sizeof(ppmPath), "%s/image.ppm", directory);
+    snprintf(pngPath, sizeof(pngPath), "%s/image.PNG", directory);
+
+    createFramebuffer(300, 250);
+    Framebuffer fb = getFramebufferPointer(NULL);
+    drawFramebufferLine(fb, 0, 0, 299, 249);
+    sput_fail_unless(writeFramebufferImage(fb, ppmPath) == 1, "PPM written");
+    FILE *file = fopen(ppmPath, "rb");
+    char magic[3] = {0};
+    int width = 0, height = 0;
+    sput_fail_unless(file != NULL && fscanf(file, "%2s %d %d", magic, &width, &height) == 3 && strcmp(magic, "P6") == 0 &&
+                     width == 300 && height == 250, "PPM header gives the size");
+    fseek(file, 0, SEEK_END);
+    sput_fail_unless(ftell(file) == (long) strlen("P6\n300 250\n255\n") + 300 * 250 * BYTES_PER_PIXEL, "PPM holds every pixel");
+    fclose(file);
+
+      // 250 rows of 901 bytes is more than one stored block
+    sput_fail_unless(writeFramebufferImage(fb, pngPath) == 1, "PNG written for an upper case extension");
+    file = fopen(pngPath, "rb");
+    uint8_t start[33];
+    sput_fail_unless(file != NULL && fread(start, 1, 33, file) == 33 && memcmp(start + 1, "PNG", 3) == 0 && memcmp(start + 12, "IHDR", 4) == 0,
+                     "PNG starts with its signature and header");
+    uint8_t crc[4];
+    putBigEndian32(crc, updateCRC32(0xFFFFFFFFu, start + 12, 17) ^ 0xFFFFFFFFu);
+    sput_fail_unless(memcmp(crc, start + 29, 4) == 0, "PNG header CRC matches");
+    fseek(file, 0, SEEK_END);
+    size_t rawSize = 250 * (1 + 300 * BYTES_PER_PIXEL);
+    sput_fail_unless(ftell(file) == (long) (33 + 12 + 2 + 5 * ((rawSize + PNG_STORED_BLOCK - 1) / PNG_STORED_BLOCK) + rawSize + 4 + 12),
+                     "PNG is the size of its stored blocks");
+    fclose(file);
+    resetRunArena();
+
+    unlink(ppmPath);
+    unlink(pngPath);
+    rmdir(directory);
+}
+
+void testHeadlessDrawing()
+{
+    char directory[] = "/tmp/turtleImageXXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        fprintf(stderr, "ERROR - unable to make temporary directory in testHeadlessDrawing()\n");
+        exit(1);
+    }
+    char path[100];
+    snprintf(path, sizeof(path), "%s/drawing.ppm", directory);
+
+    setImageOutput(path, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2);
+    createDisplayList();
+    setUpDisplay();
+    Framebuffer fb = getFramebufferPointer(NULL);
+    sput_fail_unless(fb != NULL && fb->width == SCREEN_WIDTH / 2 && fb->height == SCREEN_HEIGHT / 2, "Framebuffer made instead of a window");
+    appendSegment(SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, SCREEN_WIDTH / 2 + 100, SCREEN_HEIGHT / 2, green);
+    sput_fail_unless(countLitPixels(fb) == 0, "Nothing drawn until the end");
+    appendSegment(0, 0, 100, 100, red);
+
+    holdScreenUntilUserInput();
+      // the image shows the turtle's world one pixel to a unit, centred where the turtle starts
+    uint8_t *pixel = &fb->pixels[((SCREEN_HEIGHT / 4) * fb->width + SCREEN_WIDTH / 4 + 50) * BYTES_PER_PIXEL];
+    sput_fail_unless(countLitPixels(fb) == 101 && pixel[1] == GREEN_G && pixel[0] == GREEN_R, "Line drawn from the centre in its colour");
+    sput_fail_unless(access(path, R_OK) == 0, "Image written instead of holding the window open");
+    setImageOutput(NULL, 0, 0);
+    resetRunArena();
+
+    unlink(path);
+    rmdir(directory);
+}
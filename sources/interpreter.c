@@ -6,12 +6,10 @@
 #endif
 
 
-struct variable {
-    
-    char varName;
-    double contents;
-    int assigned;
-} ;
+static double sinTable[MAX_ANGLE]; // the sine and cosine of every whole degree, filled in by buildTrigTables()
+static double cosTable[MAX_ANGLE];
+static int trigTablesBuilt = 0;
+static Measurement *measurement = NULL; // if set, moves are measured rather than drawn or kept
 
   // structure containing al the information needed to draw the turtle
 struct turtle {
@@ -21,33 +19,31 @@ struct turtle {
     Clr drawColour;
     
     int drawTurtle;
-    Variable varList[NUMBER_OF_VARIABLES];
+    
+      // variables are stored by slot. Slots 0-25 are A-Z and named variables follow, in the order the lexer found them
+    double *variables;
+    uint64_t *assigned; // one bit per slot
+    int variableCapacity; // always a multiple of 64 so the assigned bits fill whole words
+    
+    int64_t segmentsDrawn; // running totals, read by the profiler before and after each instruction
+    int64_t positionsStored;
 } ;
 
-  // a stack to hold all previous positions and angles of the turtle. Used with the BKSTP command
+  // a stack to hold all previous positions and angles of the turtle. Used with the BKSTP command. Positions are kept one after another in a
+  // single array that doubles when full, as full doubles or, in compact mode, as floats. If the program can only go back a limited number
+  // of steps, the array stops growing at ringSize and new positions overwrite the oldest ones. Position i is always kept at i & (capacity-1)
 struct positionStack {
-    int numOfPositions;
-    PositionNode top;
-} ;
-
-struct positionNode {
-    double x, y;
-    int angle;
-    PositionNode next;
-} ;
-
-  // a stack to hold all the values used in reverse Polish expressions. Used when calculatind in SET commands
-struct valStack {
-
-  int numOfVals;
-  ValNode top;
+    int64_t numOfPositions; // the number of positions pushed and not popped, including any that have been overwritten
+    int64_t oldest; // the first position still kept
+    int64_t capacity; // always a power of 2
+    int64_t ringSize; // the most positions kept, or 0 to keep all of them
+    int keepHistory; // cleared if the program never uses BKSTP, so positions aren't stored at all
+    int compact; // set from compactPositions when the stack is created
+    PositionRecord *records;
+    CompactPositionRecord *compactRecords;
 } ;
 
-struct valNode {
-
-  double val;
-  ValNode next;
-} ;
+static int compactPositions = 0;
 
 //// SETUP/SHUTDOWN FUNCTIONS ////////////////////////////////////////////////
 /*..........................................................................*/
@@ -55,10 +51,11 @@ struct valNode {
 // creates all structures for interpretting and initialises SDL if required
 void setUpForInterpreting(int testMode, int interpretMode)
 {
+    buildTrigTables();
     createTurtle();
     initialiseTurtle(testMode, interpretMode);
     createPositionStack();
-    createValStack();
+    createDisplayList();
     
     Turtle t = getTurtlePointer(NULL);
     if(t->drawTurtle) {
@@ -66,14 +63,11 @@ void setUpForInterpreting(int testMode, int interpretMode)
     }
 }
 
+// the turtle, position stack and display state are all in the run arena, along with the parse handler, so resetting it releases the
+// whole run
 void shutDownInterpreting()
 {
-    Turtle t = getTurtlePointer(NULL);
-    if(t->drawTurtle) {
-        shutDownDisplay();
-    }
-    freeTurtle();
-    freePositionStack();
+    resetRunArena();
 }
 
 //// TURTLE STRUCTURE FUNCTIONS //////////////////////////////////////////////
@@ -81,11 +75,7 @@ void shutDownInterpreting()
 
 
 void createTurtle() {
-    Turtle newTurtle = (Turtle) malloc(sizeof(struct turtle));
-    if(newTurtle == NULL) {
-        fprintf(stderr, "ERROR - unable to malloc space for Turtle in createTurtle()\n");
-        exit(1);
-    }
+    Turtle newTurtle = (Turtle) runAlloc(sizeof(struct turtle), memTurtle);
     
     getTurtlePointer(newTurtle);
     
@@ -112,6 +102,8 @@ void initialiseTurtle(int testMode, int interpretMode)
     t->angle = 0;
     t->penStatus = penDown;
     t->drawColour = white;
+    t->segmentsDrawn = 0;
+    t->positionsStored = 0;
     
     initialiseVariableList(t);
     
@@ -128,43 +120,45 @@ void initialiseTurtle(int testMode, int interpretMode)
     }
 }
 
-  // initialise the array of variable structures to hold values and assigned status for all variables
+  // start with room for the single letter variables. setUpForParsing() makes room for the program's named variables
 void initialiseVariableList(Turtle t)
 {
-    for(int i = 0; i < NUMBER_OF_VARIABLES; i++) {
-        t->varList[i] = (Variable) malloc(sizeof(struct variable));
-        if(t->varList[i] == NULL) {
-            fprintf(stderr, "ERROR - unable to malloc space for variable structure in initialiseVariableList()");
-            exit(1);
-        }
-        t->varList[i]->varName = 'A'+i;
-        t->varList[i]->assigned = 0;
-    }
+    t->variables = NULL;
+    t->assigned = NULL;
+    t->variableCapacity = 0;
+    reserveVariableSlots(NUMBER_OF_VARIABLES);
 }
 
-void freeTurtle()
+// makes sure there is space for at least numOfSlots variables. New slots start unassigned
+void reserveVariableSlots(int numOfSlots)
 {
     Turtle t = getTurtlePointer(NULL);
-    
-    for(int i = 0; i < NUMBER_OF_VARIABLES; i++) {
-        free(t->varList[i]);
+    if(numOfSlots <= t->variableCapacity) {
+        return;
     }
-    free(t);
+    int newCapacity = ((numOfSlots + BITS_PER_WORD - 1) / BITS_PER_WORD) * BITS_PER_WORD;
+    t->variables = (double*) runGrow(t->variables, t->variableCapacity * sizeof(double), newCapacity * sizeof(double), memVariables);
+    t->assigned = (uint64_t*) runGrow(t->assigned, (t->variableCapacity / BITS_PER_WORD) * sizeof(uint64_t), (newCapacity / BITS_PER_WORD) * sizeof(uint64_t), memVariables);
+    memset(t->variables + t->variableCapacity, 0, (newCapacity - t->variableCapacity) * sizeof(double));
+    memset(t->assigned + t->variableCapacity / BITS_PER_WORD, 0, ((newCapacity - t->variableCapacity) / BITS_PER_WORD) * sizeof(uint64_t));
+    t->variableCapacity = newCapacity;
 }
-    
+
 //// POSITION STACK FUNCTIONS ////////////////////////////////////////////////
 /*..........................................................................*/
 
 void createPositionStack()
 {
-    PositionStack newStack = (PositionStack) malloc(sizeof(struct positionStack));
-    if(newStack == NULL) {
-        fprintf(stderr, "ERROR - unable to malloc space for PositionStack in createPositionStack()\n");
-        exit(1);
-    }
+    PositionStack newStack = (PositionStack) runAlloc(sizeof(struct positionStack), memPositions);
     
-    newStack->top = NULL;
     newStack->numOfPositions = 0;
+    newStack->oldest = 0;
+    newStack->capacity = 0;
+    newStack->ringSize = 0;
+    newStack->keepHistory = 1;
+    newStack->compact = compactPositions;
+    newStack->records = NULL;
+    newStack->compactRecords = NULL;
     getPositionStackPointer(newStack);
 }
 
@@ -178,142 +172,106 @@ PositionStack getPositionStackPointer(PositionStack newStack)
     return pStack;
 }
 
-void freePositionStack()
+// chooses whether position stacks created from now on store positions as floats. Halves the memory used by long histories, at the cost
+// of positions returned to by BKSTP being rounded to float precision
+void setCompactPositions(int compact)
 {
-    PositionStack pStack = getPositionStackPointer(NULL);
-    
-    for(int i = 0; i < pStack->numOfPositions; i++) {
-        PositionNode tmp = pStack->top;
-        pStack->top = pStack->top->next;
-        free(tmp);
-    }
-    
-    free(pStack);
+    compactPositions = compact;
 }
 
-
-//  POSITION NODE FUNCTIONS  //////////////////////////////////////////
-/*...................................................................*/
-
-PositionNode newPositionNode()
+int getCompactPositions()
 {
-    PositionNode newNode = (PositionNode) malloc (sizeof(struct positionNode));
-    if(newNode == NULL) {
-        fprintf(stderr, "ERROR - malloc failed for PositionNode in newPositionNode()\n");
-        exit(1);
-    }
-    newNode->next = NULL;
-    return newNode;
-}
-
-void pushToPositionStack(PositionNode pNode)
-{
-    PositionStack pStack = getPositionStackPointer(NULL);
-    pNode->next = pStack->top;
-    pStack->top = pNode;
-    pStack->numOfPositions++;
+    return compactPositions;
 }
 
-PositionNode popFromPositionStack()
+// sets how much history the position stack keeps, given the most steps the program can go back (found by findMaxBackstepDepth()).
+// No steps means no history. A limit of up to MAX_POSITION_RING positions is kept in a ring, anything else keeps every position
+void limitPositionHistory(int64_t maxSteps)
 {
     PositionStack pStack = getPositionStackPointer(NULL);
-    if(pStack->numOfPositions > 0) {
-        PositionNode poppedNode = pStack->top;
-        pStack->top = pStack->top->next;
-        pStack->numOfPositions--;
-        return poppedNode;
+    pStack->keepHistory = (maxSteps != 0);
+    pStack->ringSize = 0;
+    if(maxSteps > 0 && maxSteps <= MAX_POSITION_RING) {
+        pStack->ringSize = INITIAL_POSITION_CAPACITY;
+        while(pStack->ringSize < maxSteps) {
+            pStack->ringSize *= 2;
+        }
     }
-    return NULL;
 }
 
 
-//  VAL STACK FUNCTIONS  //////////////////////////////////////////////
+//  POSITION RECORD FUNCTIONS  ////////////////////////////////////////
 /*...................................................................*/
 
-void createValStack()
+void pushToPositionStack(double x, double y, int angle)
 {
-    ValStack newStack = (ValStack) malloc(sizeof(struct valStack));
-    if(newStack == NULL) {
-        fprintf(stderr, "ERROR - unable to malloc space for valstack in createValStack()\n");
-        exit(1);
+    PositionStack pStack = getPositionStackPointer(NULL);
+    if(pStack->numOfPositions - pStack->oldest == pStack->capacity) {
+        if(pStack->ringSize != 0 && pStack->capacity == pStack->ringSize) {
+            pStack->oldest++;
+        } else {
+            growPositionStack(pStack);
+        }
     }
-    
-    newStack->top = NULL;
-    newStack->numOfVals = 0;
-    getValStackPointer(newStack);
-}
-
-ValStack getValStackPointer(ValStack newStack)
-{
-    static ValStack vStack;
-    if(newStack != NULL) {
-        vStack = newStack;
+    int64_t i = pStack->numOfPositions & (pStack->capacity - 1);
+    if(pStack->compact) {
+        CompactPositionRecord *record = &pStack->compactRecords[i];
+        record->x = (float) x;
+        record->y = (float) y;
+        record->angle = angle;
+    } else {
+        PositionRecord *record = &pStack->records[i];
+        record->x = x;
+        record->y = y;
+        record->angle = angle;
     }
-    
-    return vStack;
-}
-
-void pushToValStack(double val)
-{
-    ValStack vStack = getValStackPointer(NULL);
-    
-    ValNode vN = newValNode();
-    vN->val = val;
-    vN->next = vStack->top;
-    vStack->numOfVals++;
-    vStack->top = vN;
+    pStack->numOfPositions++;
 }
 
-
-ValNode newValNode()
+// doubles the room for positions. Only called before the ring (if there is one) is full, so every position is still where it was
+void growPositionStack(PositionStack pStack)
 {
-    ValNode newNode = (ValNode) malloc(sizeof(struct valNode));
-    if(newNode == NULL) {
-        fprintf(stderr, "ERROR - Unable to malloc space for val node in newValNode()\n");
-        exit(1);
+    int64_t oldCapacity = pStack->capacity;
+    pStack->capacity = (oldCapacity == 0) ? INITIAL_POSITION_CAPACITY : oldCapacity * 2;
+    if(pStack->compact) {
+        pStack->compactRecords = (CompactPositionRecord*) runGrow(pStack->compactRecords, oldCapacity * sizeof(CompactPositionRecord), pStack->capacity * sizeof(CompactPositionRecord), memPositions);
+    } else {
+        pStack->records = (PositionRecord*) runGrow(pStack->records, oldCapacity * sizeof(PositionRecord), pStack->capacity * sizeof(PositionRecord), memPositions);
     }
-    
-    newNode->next = NULL;
-    return newNode;
 }
 
-int popFromValStack(double *poppedVal)
+// removes the last steps positions and sets x, y & angle to the last one removed. If there are fewer than steps positions kept, goes back
+// to the oldest one. Returns 0, leaving x, y & angle alone, if there were none to remove
+int popFromPositionStack(int64_t steps, double *x, double *y, int *angle)
 {
-    ValStack vStack = getValStackPointer(NULL);
-    
-    if(vStack->numOfVals > 0) {
-        *poppedVal = vStack->top->val;
-        ValNode tmp = vStack->top;
-        vStack->top = vStack->top->next;
-        free(tmp);
-        vStack->numOfVals--;
-        return 1;
-    } else {
+    PositionStack pStack = getPositionStackPointer(NULL);
+    if(pStack->numOfPositions == pStack->oldest || steps <= 0) {
         return 0;
     }
+    pStack->numOfPositions = (steps < pStack->numOfPositions - pStack->oldest) ? pStack->numOfPositions - steps : pStack->oldest;
+    int64_t i = pStack->numOfPositions & (pStack->capacity - 1);
+    if(pStack->compact) {
+        CompactPositionRecord *record = &pStack->compactRecords[i];
+        *x = record->x;
+        *y = record->y;
+        *angle = record->angle;
+    } else {
+        PositionRecord *record = &pStack->records[i];
+        *x = record->x;
+        *y = record->y;
+        *angle = record->angle;
+    }
+    return 1;
 }
 
-int getNumberOfValsOnStack()
-{
-    return getValStackPointer(NULL)->numOfVals;
-}
-    
-void freeValStack()
+// the number of positions BKSTP can currently go back through
+int64_t getNumberOfPositions()
 {
-    ValStack vStack = getValStackPointer(NULL);
-    
-    for(int i = 0; i < vStack->numOfVals; i++) {
-        ValNode tmp = vStack->top;
-        vStack->top = vStack->top->next;
-        free(tmp);
-    }
-    
-    free(vStack);
+    PositionStack pStack = getPositionStackPointer(NULL);
+    return pStack->numOfPositions - pStack->oldest;
 }
 
 
-
-
 //  MOVE HANDLING FUNCTIONS  //////////////////////////////////////////
 /*...................................................................*/
 
@@ -344,58 +302,83 @@ void doAction(TokenType actionType, double val)
     }
 }
 
-  // changes the turtle's x & y positions based on its angle and the move length
+  // changes the turtle's x & y positions based on its angle and the move length. The whole move is one segment, so it costs the same
+  // however far the turtle goes. If the interpreter is running on its own thread while the window shows the drawing, the segment is
+  // passed to the drawing thread through the segment ring, which adds it to the display list there
 void moveTurtle(int moveLength)
 {
     Turtle t = getTurtlePointer(NULL);
+    if(moveLength <= 0) {
+        return;
+    }
     
-    double radAngle = degreesToRad(t->angle);
-    int moveDistance = 0;
-    int stepLength = TURTLE_SPEED;
-    while(moveDistance < moveLength) {
-    
-        if(moveDistance+stepLength > moveLength) {
-            stepLength = moveLength - moveDistance;
-        }
-        
-        double xAdjust = (double) stepLength * sin(radAngle);
-        double yAdjust = (double) stepLength * cos(radAngle);
-        
-        if(t->drawTurtle) {
-            if(t->penStatus == penDown) {
-                drawLine((int)t->x, (int)t->y, (int)(t->x + xAdjust), (int)(t->y - yAdjust));
-            }
+    double xAdjust = (double) moveLength * getSinOfAngle(t->angle);
+    double yAdjust = (double) moveLength * getCosOfAngle(t->angle);
+    
+    if(t->penStatus == penDown && measurement != NULL) {
+        t->segmentsDrawn++;
+        measureSegment(measurement, t->x, t->y, t->x + xAdjust, t->y - yAdjust);
+    } else if(t->penStatus == penDown) {
+        t->segmentsDrawn++;
+        if(getSegmentRing() != NULL) {
+            RingSegment s = {t->x, t->y, t->x + xAdjust, t->y - yAdjust, (uint8_t) t->drawColour};
+            pushToSegmentRing(getSegmentRing(), &s);
+        } else {
+            appendSegment(t->x, t->y, t->x + xAdjust, t->y - yAdjust, (uint8_t) t->drawColour);
         }
-        t->x += xAdjust;
-        t->y -= yAdjust;
-        
-        moveDistance+=stepLength;
     }
+    t->x += xAdjust;
+    t->y -= yAdjust;
 }
 
-// create a position node with turtle's current x, y & angle and push it to the position stack. Done before every move
+// push the turtle's current x, y & angle to the position stack. Done before every move, unless the program never goes back. A
+// measurement counts every move, as the position stack may keep only the newest positions or none at all
 void storeTurtlePosition(Turtle t)
 {
-    PositionNode pNode = newPositionNode();
-    pNode->x = t->x;
-    pNode->y = t->y;
-    pNode->angle = t->angle;
-    
-    pushToPositionStack(pNode);
+    if(measurement != NULL && ++measurement->positions > measurement->maxPositions) {
+        measurement->maxPositions = measurement->positions;
+    }
+    if(!getPositionStackPointer(NULL)->keepHistory) {
+        return;
+    }
+    pushToPositionStack(t->x, t->y, t->angle);
+    t->positionsStored++;
 }
 
-// pop the last position node from the stack and update the turtle to move it back one step. If already back to start, does nothing
+// move the turtle back to where it was the given number of moves ago. If there are fewer moves than that, goes back to the start
 void backstep(Turtle t, int steps)
 {
-    for(int i = 0; i < steps; i++) {
-        PositionNode pNode = popFromPositionStack();
-        if(pNode != NULL) {
-            t->x = pNode->x;
-            t->y = pNode->y;
-            t->angle = pNode->angle;
-            free(pNode);
-        }
+    if(measurement != NULL && steps > 0) {
+        measurement->positions -= (steps < measurement->positions) ? steps : measurement->positions;
     }
+    popFromPositionStack(steps, &t->x, &t->y, &t->angle);
+}
+
+
+//  MEASURING FUNCTIONS  /////////////////////////////////////////////
+/*..................................................................*/
+
+// while m is set, segments the turtle draws are added to m instead of the display list or the screen. Passing NULL goes back to drawing
+void setMeasurement(Measurement *m)
+{
+    measurement = m;
+}
+
+Measurement *getMeasurement()
+{
+    return measurement;
+}
+
+// adds a segment to the count and bounding box
+void measureSegment(Measurement *m, double x0, double y0, double x1, double y1)
+{
+    Box segment = {fmin(x0, x1), fmin(y0, y1), fmax(x0, x1), fmax(y0, y1)};
+    if(m->segments == 0) {
+        m->bounds = segment;
+    } else {
+        addToBox(&m->bounds, &segment);
+    }
+    m->segments++;
 }
 
 
@@ -429,12 +412,12 @@ void setRandomTurtleColour()
     applyTurtleColour(t->drawColour);
 }
 
-// updates the SDL draw colour in display.c with the turtle's current colour
+// updates the SDL draw colour in display.c with the turtle's current colour. Segments sent through the segment ring carry their colour
 void applyTurtleColour(Clr colour)
 {
     Turtle t = getTurtlePointer(NULL);
     t->drawColour = colour;
-    if(t->drawTurtle) {
+    if(t->drawTurtle && getSegmentRing() == NULL) {
         setDrawColour(t->drawColour);
     }
 }
@@ -448,6 +431,53 @@ double degreesToRad(int deg)
     return (double) deg * (M_PI/180.0); //multiply angle in degrees by pi/180 to give angle in radians
 }
 
+// fills the sine and cosine tables. Only 0 to 90 degrees are worked out, and the rest are copied from them with the signs of their
+// quadrant, so the tables are exactly symmetric and every multiple of 90 degrees gives exactly 0, 1 or -1
+void buildTrigTables()
+{
+    if(trigTablesBuilt) {
+        return;
+    }
+    double quarter[MAX_ANGLE / 4 + 1];
+    for(int deg = 0; deg <= MAX_ANGLE / 4; deg++) {
+        quarter[deg] = sin(degreesToRad(deg));
+    }
+    quarter[0] = 0;
+    quarter[MAX_ANGLE / 4] = 1;
+
+    for(int deg = 0; deg < MAX_ANGLE; deg++) {
+        int within = deg % (MAX_ANGLE / 4);
+        switch(deg / (MAX_ANGLE / 4)) {
+            case 0 :
+                sinTable[deg] = quarter[within];
+                break;
+            case 1 :
+                sinTable[deg] = quarter[MAX_ANGLE / 4 - within];
+                break;
+            case 2 :
+                sinTable[deg] = -quarter[within];
+                break;
+            default :
+                sinTable[deg] = -quarter[MAX_ANGLE / 4 - within];
+        }
+    }
+    for(int deg = 0; deg < MAX_ANGLE; deg++) {
+        cosTable[deg] = sinTable[(deg + MAX_ANGLE / 4) % MAX_ANGLE];
+    }
+    trigTablesBuilt = 1;
+}
+
+// the sine of an angle in whole degrees. Angles outside 0 to 359 (which RT and LT by negative or large amounts can leave) are wrapped
+double getSinOfAngle(int deg)
+{
+    return sinTable[((deg % MAX_ANGLE) + MAX_ANGLE) % MAX_ANGLE];
+}
+
+double getCosOfAngle(int deg)
+{
+    return cosTable[((deg % MAX_ANGLE) + MAX_ANGLE) % MAX_ANGLE];
+}
+
 // it does maths
 double doMaths(double a, double b, mathSymbol op)
 {
@@ -469,87 +499,92 @@ double doMaths(double a, double b, mathSymbol op)
 ///// INFORMATION RETURNING FUNCTIONS ////////////////////////////////
 /*..................................................................*/
 
-// returns the value of the passed variable from the turtles variable array
+// returns the value of the passed single letter variable
 double getVariableVal(char c)
+{
+    if(!checkValidVariable(c)) {
+        fprintf(stderr, "ERROR - attempted to extract contents of invalid variable in getVariableVal()\n");
+        exit(1);
+    }
+    return getSlotVal(c - 'A');
+}
+
+// returns the value held in a variable slot
+double getSlotVal(int slot)
 {
     Turtle t = getTurtlePointer(NULL);
-    
-    for(int i = 0; i < NUMBER_OF_VARIABLES; i++) {
-        if(t->varList[i]->varName == c) {
-            return t->varList[i]->contents;
-        }
+    if(slot < 0 || slot >= t->variableCapacity) {
+        fprintf(stderr, "ERROR - attempted to extract contents of variable slot %d in getSlotVal()\n", slot);
+        exit(1);
     }
-    
-    fprintf(stderr, "ERROR - attempted to extract contents of variable not in varList in getTokenVal()\n");
-    exit(1);
+    return t->variables[slot];
 }
 
 /*
-returns 1 if passed character is within list of potential variables. If not, returns 0.
+returns 1 if passed character is one of the single letter variables. If not, returns 0.
 */
 int checkValidVariable(char c)
 {
-    Turtle t = getTurtlePointer(NULL);
-    
-    for(int i = 0; i < NUMBER_OF_VARIABLES; i++) {
-        if(t->varList[i]->varName == c) {
-            return 1;
-        }
-    }
-    
-    return 0;
+    return c >= 'A' && c - 'A' < NUMBER_OF_VARIABLES;
 }
 
 // if variable is marked as assigned, returns 1 and updates the parseHandler's current val to the variable's value (if interpreting)
 int checkVariableAssigned(char c, int interpret, double *valToSet)
+{
+    if(!checkValidVariable(c)) {
+        return 0;
+    }
+    return checkSlotAssigned(c - 'A', interpret, valToSet);
+}
+
+// as checkVariableAssigned(), for a variable slot. Slots past the end of the variable array have never been assigned
+int checkSlotAssigned(int slot, int interpret, double *valToSet)
 {
     Turtle t = getTurtlePointer(NULL);
     
-    for(int i = 0; i < NUMBER_OF_VARIABLES; i++) {
-        if(t->varList[i]->varName == c) {
-            if(t->varList[i]->assigned == 1) {
-                if(interpret) {
-                    *valToSet = t->varList[i]->contents;
-                }
-                return 1;
-            }
-        }
+    if(slot >= t->variableCapacity || !(t->assigned[slot / BITS_PER_WORD] & ((uint64_t) 1 << (slot % BITS_PER_WORD)))) {
+        return 0;
     }
-    return 0;
+    if(interpret) {
+        *valToSet = t->variables[slot];
+    }
+    return 1;
 }
 
-// run strtod() once, and if there are no characters left over in the string then it is a valid number. If so, run strtod() again to update the contents of valToSet
+// run strtod(), and if there are no characters left over in the string then it is a valid number and valToSet is updated
 int checkForNumber(char *token, double *valToSet)
 {
     char *remainder;
-    strtod(token, &remainder);
+    double val = strtod(token, &remainder);
     if(remainder[0] != '\0') {
         return 0;
-    } else {
-        *valToSet = strtod(token, &remainder);
-        return 1;
     }
+    *valToSet = val;
+    return 1;
 }
 
-// if indicated variable existsand returns 1, else returns 0
+// marks the indicated single letter variable as assigned
 // if parser is set in interpret mode, assigns value to variable
 void assignValToVariable(char varToSet, double val, int interpret)
+{
+    if(!checkValidVariable(varToSet)) {
+        fprintf(stderr, "ERROR - unable to locate variable in assignValToVariable()\n");
+        exit(1);
+    }
+    assignValToSlot(varToSet - 'A', val, interpret);
+}
+
+// as assignValToVariable(), for a variable slot. Makes room for the slot if the program has more variables than expected
+void assignValToSlot(int slot, double val, int interpret)
 {
     Turtle t = getTurtlePointer(NULL);
     
-    int foundVar = 0;
-    for(int i = 0; i < NUMBER_OF_VARIABLES && foundVar == 0; i++) {
-        if(t->varList[i]->varName == varToSet) {
-            foundVar = 1;
-            t->varList[i]->assigned = 1;
-            if(interpret) {
-                t->varList[i]->contents = val;
-            }
-        }
+    if(slot >= t->variableCapacity) {
+        reserveVariableSlots(slot + 1);
     }
-    if(foundVar != 1) {
-        fprintf(stderr, "ERROR - unable to locate variable in assignValToVariable()\n");
-        exit(1);
+    t->assigned[slot / BITS_PER_WORD] |= (uint64_t) 1 << (slot % BITS_PER_WORD);
+    if(interpret) {
+        t->variables[slot] = val;
     }
 }
 
@@ -574,6 +609,24 @@ Clr getTurtleColour()
     return getTurtlePointer(NULL)->drawColour;
 }
 
+// 1 if the turtle is being drawn as the program runs
+int getDrawTurtle()
+{
+    return getTurtlePointer(NULL)->drawTurtle;
+}
+
+// the number of line segments drawn (or that would have been drawn if SDL were running) since the turtle was initialised
+int64_t getSegmentsDrawn()
+{
+    return getTurtlePointer(NULL)->segmentsDrawn;
+}
+
+// the number of positions pushed to the position stack since the turtle was initialised
+int64_t getPositionsStored()
+{
+    return getTurtlePointer(NULL)->positionsStored;
+}
+
 ///// WHITE BOX TESTING FUNCTIONS ////////////////////////////////////
 /*..................................................................*/
 
@@ -592,10 +645,6 @@ void runInterpreterWhiteBoxTests()
     sput_run_test(testTurtleActions);
     sput_leave_suite();
     
-    sput_enter_suite("testValStack(): Testing pushing and popping from Val Stack");
-    sput_run_test(testValStack);
-    sput_leave_suite();
-    
     sput_enter_suite("testPositionStack(): Testing pushing and popping from Position Stack");
     sput_run_test(testPositionStack);
     sput_leave_suite();
@@ -638,6 +687,13 @@ void testTurtleActions()
     doAction(rt, 90);
     doAction(fd, 50);
     sput_fail_unless((int) t->x == (SCREEN_WIDTH/2) + 50, "Turtle moved right the correct ammount");
+    Segment last;
+    getSegment(getDisplayListPointer(NULL), getNumberOfSegments() - 1, &last);
+    sput_fail_unless(getSegmentsAppended() == 2 && (int) last.x1 == (SCREEN_WIDTH/2) + 50, "Each move added to the display list as one segment");
+    sput_fail_unless(t->y == (SCREEN_HEIGHT/2) - 50 && t->x == (SCREEN_WIDTH/2) + 50, "Moves at multiples of 90 degrees are exact");
+    
+    doAction(fd, 1000000000);
+    sput_fail_unless(t->x == (SCREEN_WIDTH/2) + 50 + 1000000000.0 && getSegmentsAppended() == 3, "Long move done in one step");
     
     t->x = 0; t->y = 0; t->angle = 0;
     // set up 3, 4, 5 triangle and check movement ammounts
@@ -649,54 +705,50 @@ void testTurtleActions()
 }
 
 
-void testValStack()
-{
-    createValStack();
-    pushToValStack(3);
-    pushToValStack(12.4);
-    sput_fail_unless(getValStackPointer(NULL)->numOfVals == 2, "After pushing two values to stack, number of items in stack is 2");
-    freeValStack();
-    
-    createValStack();
-    pushToValStack(25);
-    pushToValStack(13);
-    pushToValStack(20);
-    double d = 0;
-    sput_fail_unless(popFromValStack(&d) == 1 && (int) d == 20, "Stack successfully pops value from stack");
-    sput_fail_unless(getValStackPointer(NULL)->numOfVals == 2, "After pushing 3 values and popping 1, number of items in stack is 2");
-    
-    popFromValStack(&d);
-    popFromValStack(&d);
-    sput_fail_unless(getValStackPointer(NULL)->numOfVals == 0, "After pushing 3 values and popping 3, number of items in stack is 0");
-    sput_fail_unless((int) d == 25, "Successfully pops 3 values from stack");
-    
-    sput_fail_unless(popFromValStack(&d) == 0, "Does not alow pop from empty stack");
-    sput_fail_unless((int) d == 25, "Target value unchanged after pop from empty stack");
-    sput_fail_unless(getValStackPointer(NULL)->numOfVals == 0, "Items in stack is still 0 after pop from empty stack");
-    freeValStack();
-}
-
-
-
 void testPositionStack()
 {
     createPositionStack();
     PositionStack pStack = getPositionStackPointer(NULL);
     sput_fail_unless(pStack->numOfPositions == 0, "Position Stack initialised with correct number of positions");
-    PositionNode tstNode = newPositionNode();
-    tstNode->x = 35;
-    pushToPositionStack(tstNode);
+    pushToPositionStack(35, 10, 90);
     sput_fail_unless(pStack->numOfPositions == 1, "Position Stack has correct number of positions after push");
-    sput_fail_unless(pStack->top->x == 35, "Position Stack has correct x value of first node");
-    PositionNode tstNodeTwo = popFromPositionStack();
-    sput_fail_unless(tstNodeTwo->x == 35, "Position Stack has popped node with correct x value");
+    sput_fail_unless(pStack->records[0].x == 35 && pStack->records[0].angle == 90, "Position Stack has correct values in first record");
+    double x = 0, y = 0;
+    int angle = 0;
+    sput_fail_unless(popFromPositionStack(1, &x, &y, &angle) == 1 && x == 35 && y == 10 && angle == 90, "Position Stack has popped record with correct values");
     sput_fail_unless(pStack->numOfPositions == 0, "Position Stack has correct number of positions after pop");
-    free(tstNode);
-    tstNodeTwo = popFromPositionStack();
-    sput_fail_unless(pStack->numOfPositions == 0, "Position Stack has correct number of positions after pop from empty stack");
+    sput_fail_unless(popFromPositionStack(1, &x, &y, &angle) == 0 && x == 35, "Pop from empty stack changes nothing");
     
-    freePositionStack();
+    for(int i = 0; i < INITIAL_POSITION_CAPACITY * 3; i++) {
+        pushToPositionStack(i, -i, i % MAX_ANGLE);
+    }
+    sput_fail_unless(pStack->numOfPositions == INITIAL_POSITION_CAPACITY * 3 && pStack->capacity == INITIAL_POSITION_CAPACITY * 4, "Position Stack grows by doubling");
+    popFromPositionStack(10, &x, &y, &angle);
+    sput_fail_unless(pStack->numOfPositions == INITIAL_POSITION_CAPACITY * 3 - 10 && x == INITIAL_POSITION_CAPACITY * 3 - 10, "Popping several steps returns the earliest one popped");
+    popFromPositionStack(INITIAL_POSITION_CAPACITY * 5, &x, &y, &angle);
+    sput_fail_unless(pStack->numOfPositions == 0 && x == 0 && y == 0, "Popping more steps than stored goes back to the first position");
+    
+    setCompactPositions(1);
+    createPositionStack();
+    pStack = getPositionStackPointer(NULL);
+    pushToPositionStack(0.1, 250.5, 45);
+    sput_fail_unless(pStack->records == NULL && pStack->compactRecords != NULL, "Compact Position Stack stores floats");
+    popFromPositionStack(1, &x, &y, &angle);
+    sput_fail_unless(x == (float) 0.1 && y == 250.5 && angle == 45, "Compact Position Stack returns positions rounded to float");
+    setCompactPositions(0);
     
+    createPositionStack();
+    pStack = getPositionStackPointer(NULL);
+    limitPositionHistory(3);
+    for(int i = 0; i < INITIAL_POSITION_CAPACITY * 3; i++) {
+        pushToPositionStack(i, 0, 0);
+    }
+    sput_fail_unless(pStack->capacity == INITIAL_POSITION_CAPACITY && getNumberOfPositions() == INITIAL_POSITION_CAPACITY, "Limited Position Stack stops growing and keeps the newest positions");
+    popFromPositionStack(3, &x, &y, &angle);
+    sput_fail_unless(x == INITIAL_POSITION_CAPACITY * 3 - 3, "Limited Position Stack goes back to the right position after wrapping");
+    pushToPositionStack(-1, 0, 0);
+    popFromPositionStack(2, &x, &y, &angle);
+    sput_fail_unless(x == INITIAL_POSITION_CAPACITY * 3 - 4, "Limited Position Stack keeps older positions after a push");
 }
 
 
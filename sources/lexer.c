@@ -0,0 +1,1134 @@
+#include "../includes/lexer.h"
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// a section of the source file that is lexed independently of the others. Each chunk starts and ends on whitespace so no token is split between two chunks
+struct lexChunk {
+    char *source; // the start of the whole source buffer, which token text offsets are measured from
+    char *start, *end; // the region of the source to lex - end is exclusive
+
+    Token *tokens; // the tokens found in this chunk
+    int64_t numOfTokens;
+    int64_t capacity;
+
+    int braceDepth; // the change in brace depth across the chunk
+    int minDepth; // the lowest brace depth (relative to the start of the chunk) after any token except the chunk's last. INT_MAX if there is no such token
+
+    SymbolTable symbols; // the named variables found in this chunk. Their slots are only local to the chunk until the chunks are stitched
+
+    int32_t newlines; // the number of newlines in the chunk. Token lines are counted from the start of the chunk until the chunks are stitched
+    char *lastLineStart; // the start of the chunk's last line, or NULL if the chunk has no newlines
+};
+
+// the tokens of a file. Either the whole file is held in memory along with every token found in it, or the file is read a block at a
+// time and only a window of recent tokens is kept
+struct tokenStream {
+    char *source; // whole file: the file contents. Every token is null terminated in place
+    size_t sourceSize;
+    int mapped; // 1 if source is a private mapping of the file, 0 if it was read into a malloced buffer
+
+    FILE *file; // streaming: the file being read. NULL if the whole file is in memory
+    char *readBuffer; // streaming: bytes read from the file that have not been lexed yet are between readStart and readEnd
+    size_t readStart, readEnd, readCapacity;
+    int32_t line, column; // streaming: the position in the file of readBuffer[readStart]
+    char *windowText; // streaming: the text of every token in the window, null terminated
+    size_t textUsed, textCapacity;
+
+    char *text; // the buffer token text offsets are measured from (source, windowText or the bytecode mapping)
+
+    void *bytecode; // if loaded from a bytecode file: the mapping holding the tokens and text
+    size_t bytecodeSize;
+
+    Token *tokens; // whole file: every token. Streaming: the window of tokens still needed
+    int64_t numOfTokens; // the number of tokens lexed so far
+    int64_t windowStart; // the index of tokens[0]. Always 0 when the whole file is in memory
+    int64_t windowCapacity;
+    int64_t releasedBefore; // tokens before this index will never be asked for again, so can be dropped from the window
+    int64_t largestWindow; // the most tokens the window has held at once
+
+    BraceBalance braceBalance; // result of reducing the brace depths of every chunk
+
+    SymbolTable symbols; // every named variable in the file, or in the part read so far when streaming
+};
+
+// the names of multi-character variables. Single letters always have slots 0 to 25, so the first name has slot NUMBER_OF_VARIABLES
+struct symbolTable {
+    char **names; // indexed by slot - NUMBER_OF_VARIABLES
+    int numOfNames;
+    int nameCapacity;
+
+    int *buckets; // open addressing hash table of indexes into names
+    int numOfBuckets; // a power of 2, kept at least twice numOfNames
+
+    int copyNames; // 1 if names are copied in (when streaming, as the text they came from is dropped), 0 if they point into the source
+};
+
+static int lexThreads = AUTO_LEX_THREADS;
+
+// every keyword and colour, placed at the slot given by keywordHash()
+static const struct keyword keywordTable[KEYWORD_TABLE_SIZE] = {
+    [10] = {"FD", fd, 0},            [0]  = {"LT", lt, 0},
+    [61] = {"RT", rt, 0},            [22] = {"SET", set, 0},
+    [41] = {"DO", doToken, 0},       [32] = {"BKSTP", bkStep, 0},
+    [60] = {"PN", penChange, 0},     [18] = {"CLR", colour, 0},
+    [38] = {"FROM", from, 0},        [12] = {"TO", to, 0},
+    [1]  = {"{", openBrace, 0},      [16] = {"}", closeBrace, 0},
+    [29] = {";", semicolon, 0},      [59] = {":=", equals, 0},
+    [7]  = {"WHILE", whileToken, 0}, [5]  = {"<", lessThan, 0},
+    [20] = {">", moreThan, 0},       [9]  = {"RAND", randomColour, 0},
+    [40] = {"ADV", advanceColour, 0},
+    [57] = {"WHTE", colourName, white},  [33] = {"RED", colourName, red},
+    [19] = {"BLUE", colourName, blue},   [4]  = {"GREEN", colourName, green},
+    [21] = {"YLLW", colourName, yellow}, [26] = {"PRPL", colourName, purple}
+};
+
+
+//  LEXING FUNCTIONS  ////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// loads the whole file into memory and splits it into tokens
+TokenStream lexFile(char *filePath, int numOfThreads)
+{
+    TokenStream ts = createTokenStream();
+    loadSourceFile(ts, filePath);
+    lexSource(ts, numOfThreads);
+    return ts;
+}
+
+TokenStream createTokenStream()
+{
+    TokenStream ts = (TokenStream) calloc(1, sizeof(struct tokenStream));
+    if(ts == NULL) {
+        fprintf(stderr, "ERROR - unable to calloc space for TokenStream in createTokenStream()\n");
+        exit(1);
+    }
+    return ts;
+}
+
+// splits the loaded source into tokens. Large files are split into chunks at whitespace and lexed on separate threads
+void lexSource(TokenStream ts, int numOfThreads)
+{
+    ts->text = ts->source;
+
+    int numOfChunks = chooseNumberOfChunks(ts, numOfThreads);
+    LexChunk chunks = (LexChunk) calloc(numOfChunks, sizeof(struct lexChunk));
+    if(chunks == NULL) {
+        fprintf(stderr, "ERROR - unable to calloc space for lex chunks in lexSource()\n");
+        exit(1);
+    }
+    splitIntoChunks(ts, chunks, numOfChunks);
+
+      // chunk 0 is lexed on this thread while the rest are lexed on their own threads
+    pthread_t threads[MAX_LEX_THREADS];
+    for(int i = 1; i < numOfChunks; i++) {
+        if(pthread_create(&threads[i], NULL, lexChunk, &chunks[i]) != 0) {
+            fprintf(stderr, "ERROR - unable to create lexing thread in lexSource()\n");
+            exit(1);
+        }
+    }
+    lexChunk(&chunks[0]);
+    for(int i = 1; i < numOfChunks; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    stitchChunks(ts, chunks, numOfChunks);
+
+    for(int i = 0; i < numOfChunks; i++) {
+        free(chunks[i].tokens);
+        trackMemory(memTokens, chunks[i].capacity * sizeof(Token), 0);
+        freeSymbolTable(chunks[i].symbols);
+    }
+    free(chunks);
+}
+
+// maps the file into memory as a private (writable) mapping. If the file fills its last page exactly there is no room to null terminate the final token, so it is read into a buffer instead
+void loadSourceFile(TokenStream ts, char *filePath)
+{
+    int fd = open(filePath, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "ERROR - unable to open '%s' in loadSourceFile()\n", filePath);
+        exit(1);
+    }
+    struct stat fileInfo;
+    if(fstat(fd, &fileInfo) != 0) {
+        fprintf(stderr, "ERROR - unable to read size of '%s' in loadSourceFile()\n", filePath);
+        exit(1);
+    }
+    ts->sourceSize = (size_t) fileInfo.st_size;
+    ts->mapped = 0;
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if(ts->sourceSize > 0 && pageSize > 0 && ts->sourceSize % (size_t) pageSize != 0) {
+        void *map = mmap(NULL, ts->sourceSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED) {
+            ts->source = (char*) map;
+            ts->mapped = 1;
+            trackMemory(memTokens, 0, ts->sourceSize);
+        }
+    }
+
+    if(!ts->mapped) {
+        ts->source = (char*) malloc(ts->sourceSize + 1);
+        if(ts->source == NULL) {
+            fprintf(stderr, "ERROR - unable to malloc space for source file in loadSourceFile()\n");
+            exit(1);
+        }
+        trackMemory(memTokens, 0, ts->sourceSize + 1);
+        size_t bytesRead = 0;
+        while(bytesRead < ts->sourceSize) {
+            ssize_t n = read(fd, ts->source + bytesRead, ts->sourceSize - bytesRead);
+            if(n <= 0) {
+                fprintf(stderr, "ERROR - unable to read '%s' in loadSourceFile()\n", filePath);
+                exit(1);
+            }
+            bytesRead += (size_t) n;
+        }
+        ts->source[ts->sourceSize] = '\0';
+    }
+    close(fd);
+}
+
+// small files are lexed in one chunk unless a thread count has been asked for. Large files get one chunk per core
+int chooseNumberOfChunks(TokenStream ts, int numOfThreads)
+{
+    int numOfChunks = numOfThreads;
+    if(numOfChunks == AUTO_LEX_THREADS) {
+        if(ts->sourceSize < LEX_PARALLEL_THRESHOLD) {
+            numOfChunks = 1;
+        } else {
+            numOfChunks = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        }
+    }
+    if(numOfChunks > MAX_LEX_THREADS) {
+        numOfChunks = MAX_LEX_THREADS;
+    }
+    if((size_t) numOfChunks > ts->sourceSize) {
+        numOfChunks = (int) ts->sourceSize;
+    }
+    if(numOfChunks < 1) {
+        numOfChunks = 1;
+    }
+    return numOfChunks;
+}
+
+// divides the source into roughly equal chunks, moving each split point forward to the next whitespace character. The whitespace is kept by the earlier chunk so that only that chunk ever writes to it
+void splitIntoChunks(TokenStream ts, LexChunk chunks, int numOfChunks)
+{
+    char *sourceEnd = ts->source + ts->sourceSize;
+    char *chunkStart = ts->source;
+
+    for(int i = 0; i < numOfChunks-1; i++) {
+        char *split = ts->source + (ts->sourceSize / numOfChunks) * (i+1);
+        if(split < chunkStart) {
+            split = chunkStart;
+        }
+        while(split < sourceEnd && !isspace((unsigned char) *split)) {
+            split++;
+        }
+        chunks[i].source = ts->source;
+        chunks[i].start = chunkStart;
+        chunks[i].end = (split < sourceEnd) ? split+1 : sourceEnd;
+        chunkStart = chunks[i].end;
+    }
+    chunks[numOfChunks-1].source = ts->source;
+    chunks[numOfChunks-1].start = chunkStart;
+    chunks[numOfChunks-1].end = sourceEnd;
+}
+
+// thread function: null terminates and classifies every token in the chunk and keeps track of the brace depth
+void *lexChunk(void *chunkPointer)
+{
+    LexChunk chunk = (LexChunk) chunkPointer;
+    chunk->braceDepth = 0;
+    chunk->minDepth = INT_MAX;
+    chunk->newlines = 0;
+    chunk->lastLineStart = NULL;
+    chunk->symbols = createSymbolTable(0);
+
+    char *c = chunk->start;
+    while(c < chunk->end) {
+        while(c < chunk->end && isspace((unsigned char) *c)) {
+            if(*c == '\n') {
+                chunk->newlines++;
+                chunk->lastLineStart = c+1;
+            }
+            c++;
+        }
+        if(c >= chunk->end) {
+            break;
+        }
+        char *text = c;
+        while(c < chunk->end && !isspace((unsigned char) *c)) {
+            c++;
+        }
+        int32_t line = chunk->newlines;
+        char *lineStart = (chunk->lastLineStart != NULL) ? chunk->lastLineStart : chunk->start;
+
+          // the whitespace ending the token is about to be overwritten, so count it first if it ends the line
+        if(c < chunk->end && *c == '\n') {
+            chunk->newlines++;
+            chunk->lastLineStart = c+1;
+        }
+        *c = '\0';
+        c++;
+        addTokenToChunk(chunk, text, line, lineStart);
+
+          // the depth after the previous token is only counted once we know it wasn't the last token
+        if(chunk->numOfTokens > 1 && chunk->braceDepth < chunk->minDepth) {
+            chunk->minDepth = chunk->braceDepth;
+        }
+
+        TokenType t = chunk->tokens[chunk->numOfTokens-1].type;
+        if(t == openBrace) {
+            chunk->braceDepth++;
+        } else if(t == closeBrace) {
+            chunk->braceDepth--;
+        }
+    }
+    return NULL;
+}
+
+// lines are counted from the start of the chunk, and columns of tokens on the chunk's first line from the start of the chunk. stitchChunks() fixes both up
+void addTokenToChunk(LexChunk chunk, char *text, int32_t line, char *lineStart)
+{
+    if(chunk->numOfTokens == chunk->capacity) {
+        trackMemory(memTokens, chunk->capacity * sizeof(Token), (chunk->capacity == 0 ? 256 : chunk->capacity * 2) * sizeof(Token));
+        chunk->capacity = (chunk->capacity == 0) ? 256 : chunk->capacity * 2;
+        chunk->tokens = (Token*) realloc(chunk->tokens, chunk->capacity * sizeof(Token));
+        if(chunk->tokens == NULL) {
+            fprintf(stderr, "ERROR - realloc failed in addTokenToChunk()\n");
+            exit(1);
+        }
+    }
+    Token *token = &chunk->tokens[chunk->numOfTokens];
+    token->textOffset = text - chunk->source;
+    token->line = line;
+    token->column = (int32_t) (text - lineStart);
+    classifyToken(token, text);
+    if(token->type == var && token->slot == UNRESOLVED_SLOT) {
+        token->slot = internSymbol(chunk->symbols, text);
+    }
+    chunk->numOfTokens++;
+}
+
+// joins the token arrays of every chunk in order and reduces the chunk brace depths to find whether the braces balance.
+// Token lines are moved on by the newlines in earlier chunks, and tokens on a chunk's first line by the length of the line before the chunk.
+// Each chunk's names are added to the file's symbol table in order, so slots come out the same however many chunks there are
+void stitchChunks(TokenStream ts, LexChunk chunks, int numOfChunks)
+{
+    ts->symbols = createSymbolTable(0);
+    ts->numOfTokens = 0;
+    int lastChunkWithTokens = -1;
+    for(int i = 0; i < numOfChunks; i++) {
+        ts->numOfTokens += chunks[i].numOfTokens;
+        if(chunks[i].numOfTokens > 0) {
+            lastChunkWithTokens = i;
+        }
+    }
+
+    ts->tokens = (Token*) malloc((ts->numOfTokens > 0 ? ts->numOfTokens : 1) * sizeof(Token));
+    if(ts->tokens == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for token array in stitchChunks()\n");
+        exit(1);
+    }
+    trackMemory(memTokens, 0, (ts->numOfTokens > 0 ? ts->numOfTokens : 1) * sizeof(Token));
+
+    ts->largestWindow = ts->numOfTokens;
+
+      // the main code block must stay open until the very last token, so the depth after every other token has to stay above 0
+    int depth = 0;
+    int lowestDepth = INT_MAX;
+    int64_t copied = 0;
+    int32_t lineBase = 1;
+    int32_t columnCarry = 1;
+    for(int i = 0; i < numOfChunks; i++) {
+        Token *tokens = ts->tokens + copied;
+        memcpy(tokens, chunks[i].tokens, chunks[i].numOfTokens * sizeof(Token));
+        copied += chunks[i].numOfTokens;
+
+        SymbolTable local = chunks[i].symbols;
+        int *slotMap = (int*) malloc((local->numOfNames > 0 ? local->numOfNames : 1) * sizeof(int));
+        if(slotMap == NULL) {
+            fprintf(stderr, "ERROR - unable to malloc space for slot map in stitchChunks()\n");
+            exit(1);
+        }
+        for(int j = 0; j < local->numOfNames; j++) {
+            slotMap[j] = internSymbol(ts->symbols, local->names[j]);
+        }
+
+        for(int64_t j = 0; j < chunks[i].numOfTokens; j++) {
+            if(tokens[j].type == var && tokens[j].slot >= NUMBER_OF_VARIABLES) {
+                tokens[j].slot = slotMap[tokens[j].slot - NUMBER_OF_VARIABLES];
+            }
+            if(tokens[j].line == 0) {
+                tokens[j].column += columnCarry;
+            } else {
+                tokens[j].column += 1;
+            }
+            tokens[j].line += lineBase;
+        }
+        lineBase += chunks[i].newlines;
+        if(chunks[i].lastLineStart != NULL) {
+            columnCarry = (int32_t) (chunks[i].end - chunks[i].lastLineStart) + 1;
+        } else {
+            columnCarry += (int32_t) (chunks[i].end - chunks[i].start);
+        }
+        free(slotMap);
+
+        if(chunks[i].minDepth != INT_MAX && depth + chunks[i].minDepth < lowestDepth) {
+            lowestDepth = depth + chunks[i].minDepth;
+        }
+        depth += chunks[i].braceDepth;
+        if(chunks[i].numOfTokens > 0 && i != lastChunkWithTokens && depth < lowestDepth) {
+            lowestDepth = depth;
+        }
+    }
+
+    if(lowestDepth <= 0) {
+        ts->braceBalance = bracesExtraInput;
+    } else if(depth != 0) {
+        ts->braceBalance = bracesUnclosed;
+    } else {
+        ts->braceBalance = bracesOK;
+    }
+}
+
+// creates a token stream over tokens and text that have been mapped in from a bytecode file. The mapping is unmapped when the stream is freed
+TokenStream wrapBytecodeTokens(void *bytecode, size_t bytecodeSize, Token *tokens, int64_t numOfTokens, char *text, BraceBalance braceBalance, SymbolTable symbols)
+{
+    TokenStream ts = createTokenStream();
+    ts->bytecode = bytecode;
+    ts->bytecodeSize = bytecodeSize;
+    trackMemory(memTokens, 0, bytecodeSize);
+    ts->tokens = tokens;
+    ts->numOfTokens = numOfTokens;
+    ts->largestWindow = numOfTokens;
+    ts->text = text;
+    ts->braceBalance = braceBalance;
+    ts->symbols = symbols;
+    return ts;
+}
+
+void freeTokenStream(TokenStream ts)
+{
+    freeSymbolTable(ts->symbols);
+    if(ts->bytecode != NULL) {
+        munmap(ts->bytecode, ts->bytecodeSize);
+        trackMemory(memTokens, ts->bytecodeSize, 0);
+        free(ts);
+        return;
+    }
+    if(ts->file != NULL) {
+        fclose(ts->file);
+        free(ts->readBuffer);
+        free(ts->windowText);
+        trackMemory(memTokens, ts->readCapacity + ts->textCapacity + ts->windowCapacity * sizeof(Token), 0);
+    } else if(ts->mapped) {
+        munmap(ts->source, ts->sourceSize);
+        trackMemory(memTokens, ts->sourceSize, 0);
+    } else if(ts->source != NULL) {
+        free(ts->source);
+        trackMemory(memTokens, ts->sourceSize + 1, 0);
+    }
+    if(ts->file == NULL && ts->tokens != NULL) {
+        trackMemory(memTokens, (ts->numOfTokens > 0 ? ts->numOfTokens : 1) * sizeof(Token), 0);
+    }
+    free(ts->tokens);
+    free(ts);
+}
+
+
+//  STREAMING FUNCTIONS  /////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// opens the file to be lexed a block at a time as tokens are asked for. Only tokens that may still be asked for are kept, so memory
+// use depends on how far back the parser needs to go rather than the size of the file
+TokenStream openTokenStream(char *filePath)
+{
+    TokenStream ts = (TokenStream) calloc(1, sizeof(struct tokenStream));
+    if(ts == NULL) {
+        fprintf(stderr, "ERROR - unable to calloc space for TokenStream in openTokenStream()\n");
+        exit(1);
+    }
+    ts->file = fopen(filePath, "r");
+    if(ts->file == NULL) {
+        fprintf(stderr, "ERROR - unable to open '%s' in openTokenStream()\n", filePath);
+        exit(1);
+    }
+    ts->readCapacity = STREAM_BLOCK_SIZE;
+    ts->readBuffer = (char*) malloc(ts->readCapacity);
+    ts->textCapacity = STREAM_BLOCK_SIZE;
+    ts->windowText = (char*) malloc(ts->textCapacity);
+    ts->windowCapacity = INITIAL_WINDOW_SIZE;
+    ts->tokens = (Token*) malloc(ts->windowCapacity * sizeof(Token));
+    if(ts->readBuffer == NULL || ts->windowText == NULL || ts->tokens == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for token window in openTokenStream()\n");
+        exit(1);
+    }
+    trackMemory(memTokens, 0, ts->readCapacity + ts->textCapacity + ts->windowCapacity * sizeof(Token));
+    ts->text = ts->windowText;
+    ts->line = 1;
+    ts->column = 1;
+    ts->symbols = createSymbolTable(1);
+      // braces can only be counted once the whole file has been read, so leave it to the parser
+    ts->braceBalance = bracesUnchecked;
+    return ts;
+}
+
+// moves any unlexed bytes to the front of the read buffer and reads the next block after them. Returns 0 at the end of the file
+int refillReadBuffer(TokenStream ts)
+{
+    size_t unread = ts->readEnd - ts->readStart;
+    memmove(ts->readBuffer, ts->readBuffer + ts->readStart, unread);
+    ts->readStart = 0;
+    ts->readEnd = unread;
+
+      // a token longer than the buffer needs more room
+    if(ts->readCapacity - unread < STREAM_BLOCK_SIZE) {
+        trackMemory(memTokens, ts->readCapacity, ts->readCapacity * 2);
+        ts->readCapacity *= 2;
+        ts->readBuffer = (char*) realloc(ts->readBuffer, ts->readCapacity);
+        if(ts->readBuffer == NULL) {
+            fprintf(stderr, "ERROR - realloc failed in refillReadBuffer()\n");
+            exit(1);
+        }
+    }
+    size_t bytesRead = fread(ts->readBuffer + ts->readEnd, 1, ts->readCapacity - ts->readEnd, ts->file);
+    ts->readEnd += bytesRead;
+    return bytesRead > 0;
+}
+
+// lexes the next token from the file into the window. Returns 0 if there are no tokens left
+int lexNextStreamToken(TokenStream ts)
+{
+    do {
+        while(ts->readStart < ts->readEnd && isspace((unsigned char) ts->readBuffer[ts->readStart])) {
+            if(ts->readBuffer[ts->readStart] == '\n') {
+                ts->line++;
+                ts->column = 1;
+            } else {
+                ts->column++;
+            }
+            ts->readStart++;
+        }
+    } while(ts->readStart == ts->readEnd && refillReadBuffer(ts));
+    if(ts->readStart == ts->readEnd) {
+        return 0;
+    }
+
+    size_t length = 0;
+    while(1) {
+        while(ts->readStart + length < ts->readEnd && !isspace((unsigned char) ts->readBuffer[ts->readStart + length])) {
+            length++;
+        }
+          // stop at whitespace, or at the end of the file
+        if(ts->readStart + length < ts->readEnd || !refillReadBuffer(ts)) {
+            break;
+        }
+    }
+
+    makeRoomInWindow(ts, length + 1);
+    Token *token = &ts->tokens[ts->numOfTokens - ts->windowStart];
+    token->textOffset = (int64_t) ts->textUsed;
+    token->line = ts->line;
+    token->column = ts->column;
+    ts->column += (int32_t) length;
+    memcpy(ts->windowText + ts->textUsed, ts->readBuffer + ts->readStart, length);
+    ts->windowText[ts->textUsed + length] = '\0';
+    ts->textUsed += length + 1;
+    ts->readStart += length;
+
+    classifyToken(token, ts->windowText + token->textOffset);
+    if(token->type == var && token->slot == UNRESOLVED_SLOT) {
+        token->slot = internSymbol(ts->symbols, ts->windowText + token->textOffset);
+    }
+    ts->numOfTokens++;
+    if(ts->numOfTokens - ts->windowStart > ts->largestWindow) {
+        ts->largestWindow = ts->numOfTokens - ts->windowStart;
+    }
+    return 1;
+}
+
+// makes sure there is space for one more token and textLength more bytes of text. Tokens that have been released are dropped first,
+// and the window only grows if that doesn't free anything
+void makeRoomInWindow(TokenStream ts, size_t textLength)
+{
+    if(ts->numOfTokens - ts->windowStart == ts->windowCapacity || ts->textUsed + textLength > ts->textCapacity) {
+        dropReleasedTokens(ts);
+    }
+
+    if(ts->numOfTokens - ts->windowStart == ts->windowCapacity) {
+        trackMemory(memTokens, ts->windowCapacity * sizeof(Token), ts->windowCapacity * 2 * sizeof(Token));
+        ts->windowCapacity *= 2;
+        ts->tokens = (Token*) realloc(ts->tokens, ts->windowCapacity * sizeof(Token));
+        if(ts->tokens == NULL) {
+            fprintf(stderr, "ERROR - realloc failed for token window in makeRoomInWindow()\n");
+            exit(1);
+        }
+    }
+    while(ts->textUsed + textLength > ts->textCapacity) {
+        trackMemory(memTokens, ts->textCapacity, ts->textCapacity * 2);
+        ts->textCapacity *= 2;
+        ts->windowText = (char*) realloc(ts->windowText, ts->textCapacity);
+        if(ts->windowText == NULL) {
+            fprintf(stderr, "ERROR - realloc failed for window text in makeRoomInWindow()\n");
+            exit(1);
+        }
+    }
+    ts->text = ts->windowText;
+}
+
+// moves the tokens (and their text) that may still be needed to the front of the window
+void dropReleasedTokens(TokenStream ts)
+{
+    int64_t numToDrop = ts->releasedBefore - ts->windowStart;
+    if(numToDrop <= 0) {
+        return;
+    }
+    int64_t numToKeep = ts->numOfTokens - ts->releasedBefore;
+    size_t textToDrop = (numToKeep > 0) ? (size_t) ts->tokens[numToDrop].textOffset : ts->textUsed;
+
+    memmove(ts->tokens, ts->tokens + numToDrop, numToKeep * sizeof(Token));
+    memmove(ts->windowText, ts->windowText + textToDrop, ts->textUsed - textToDrop);
+    for(int64_t i = 0; i < numToKeep; i++) {
+        ts->tokens[i].textOffset -= (int64_t) textToDrop;
+    }
+    ts->textUsed -= textToDrop;
+    ts->windowStart = ts->releasedBefore;
+}
+
+
+//  TOKEN CLASSIFYING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// works out what type of token the text is. Keywords are checked first, then operators, variables and finally numbers.
+// Single letter variables get their slot straight away. Longer names are left as UNRESOLVED_SLOT for the lexer to look up
+void classifyToken(Token *token, char *text)
+{
+    token->slot = 0;
+    token->val = 0;
+
+    if(checkForKeyword(token, text) || checkForOperator(token, text)) {
+        return;
+    }
+
+    if(checkForIdentifier(text)) {
+        token->type = var;
+        token->slot = (text[1] == '\0') ? text[0] - 'A' : UNRESOLVED_SLOT;
+        return;
+    }
+
+    if(checkForNumber(text, &token->val)) {
+        token->type = num;
+    } else {
+        token->type = noToken;
+    }
+}
+
+// hashes the text then spreads the hash over the table by multiplying and keeping the top bits
+uint32_t keywordHash(char *text)
+{
+    uint32_t hash = 0;
+    for(int i = 0; text[i] != '\0'; i++) {
+        hash = hash * 31 + (unsigned char) text[i];
+    }
+    return (uint32_t)(hash * KEYWORD_HASH_MULTIPLIER) >> (32 - KEYWORD_HASH_BITS);
+}
+
+// if the token is a keyword or colour, sets its type and returns 1. As the hash is perfect only one string comparison is needed
+int checkForKeyword(Token *token, char *text)
+{
+    if(strlen(text) > KEYWORD_MAX_LENGTH) {
+        return 0;
+    }
+    const struct keyword *entry = &keywordTable[keywordHash(text)];
+    if(entry->text == NULL || strcmp(entry->text, text) != 0) {
+        return 0;
+    }
+    token->type = entry->type;
+    token->slot = entry->slot;
+    return 1;
+}
+
+// if the token is a mathematical operator, sets its type and stores which operator it is. Tokens must be one character so "-5" is not read as a minus operator
+int checkForOperator(Token *token, char *text)
+{
+    if(text[0] == '\0' || text[1] != '\0') {
+        return 0;
+    }
+    switch(text[0]) {
+        case '+' :
+            token->slot = add;
+            break;
+        case '-' :
+            token->slot = subtract;
+            break;
+        case '/' :
+            token->slot = divide;
+            break;
+        case '*' :
+            token->slot = multiply;
+            break;
+        default :
+            return 0;
+    }
+    token->type = op;
+    return 1;
+}
+
+// variable names are a capital letter followed by any number of capital letters, digits and underscores
+int checkForIdentifier(char *text)
+{
+    if(text[0] < 'A' || text[0] > 'Z') {
+        return 0;
+    }
+    for(int i = 1; text[i] != '\0'; i++) {
+        if(!((text[i] >= 'A' && text[i] <= 'Z') || (text[i] >= '0' && text[i] <= '9') || text[i] == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+//  SYMBOL TABLE FUNCTIONS  //////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+SymbolTable createSymbolTable(int copyNames)
+{
+    SymbolTable symbols = (SymbolTable) calloc(1, sizeof(struct symbolTable));
+    if(symbols == NULL) {
+        fprintf(stderr, "ERROR - unable to calloc space for SymbolTable in createSymbolTable()\n");
+        exit(1);
+    }
+    symbols->copyNames = copyNames;
+    symbols->numOfBuckets = INITIAL_SYMBOL_BUCKETS;
+    symbols->buckets = (int*) malloc(symbols->numOfBuckets * sizeof(int));
+    if(symbols->buckets == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for symbol buckets in createSymbolTable()\n");
+        exit(1);
+    }
+    trackMemory(memVariables, 0, symbols->numOfBuckets * sizeof(int));
+    for(int i = 0; i < symbols->numOfBuckets; i++) {
+        symbols->buckets[i] = EMPTY_BUCKET;
+    }
+    return symbols;
+}
+
+// returns the slot of a named variable, giving it the next free slot if it hasn't been seen before
+int internSymbol(SymbolTable symbols, char *name)
+{
+    int slot = findSymbol(symbols, name);
+    if(slot != UNRESOLVED_SLOT) {
+        return slot;
+    }
+
+    if(symbols->numOfNames == symbols->nameCapacity) {
+        trackMemory(memVariables, symbols->nameCapacity * sizeof(char*), (symbols->nameCapacity == 0 ? 16 : symbols->nameCapacity * 2) * sizeof(char*));
+        symbols->nameCapacity = (symbols->nameCapacity == 0) ? 16 : symbols->nameCapacity * 2;
+        symbols->names = (char**) realloc(symbols->names, symbols->nameCapacity * sizeof(char*));
+        if(symbols->names == NULL) {
+            fprintf(stderr, "ERROR - realloc failed for symbol names in internSymbol()\n");
+            exit(1);
+        }
+    }
+    if(symbols->copyNames) {
+        char *copy = (char*) malloc(strlen(name) + 1);
+        if(copy == NULL) {
+            fprintf(stderr, "ERROR - unable to malloc space for symbol name in internSymbol()\n");
+            exit(1);
+        }
+        strcpy(copy, name);
+        trackMemory(memVariables, 0, strlen(name) + 1);
+        name = copy;
+    }
+    symbols->names[symbols->numOfNames] = name;
+    symbols->numOfNames++;
+    if(symbols->numOfNames * 2 > symbols->numOfBuckets) {
+        growSymbolBuckets(symbols);
+    } else {
+        uint32_t mask = (uint32_t) symbols->numOfBuckets - 1;
+        uint32_t b = symbolHash(name) & mask;
+        while(symbols->buckets[b] != EMPTY_BUCKET) {
+            b = (b + 1) & mask;
+        }
+        symbols->buckets[b] = symbols->numOfNames - 1;
+    }
+    return NUMBER_OF_VARIABLES + symbols->numOfNames - 1;
+}
+
+// returns the slot of a named variable, or UNRESOLVED_SLOT if it isn't in the table
+int findSymbol(SymbolTable symbols, char *name)
+{
+    uint32_t mask = (uint32_t) symbols->numOfBuckets - 1;
+    for(uint32_t b = symbolHash(name) & mask; symbols->buckets[b] != EMPTY_BUCKET; b = (b + 1) & mask) {
+        if(strcmp(symbols->names[symbols->buckets[b]], name) == 0) {
+            return NUMBER_OF_VARIABLES + symbols->buckets[b];
+        }
+    }
+    return UNRESOLVED_SLOT;
+}
+
+// 32 bit FNV-1a
+uint32_t symbolHash(char *name)
+{
+    uint32_t hash = 2166136261u;
+    for(int i = 0; name[i] != '\0'; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// doubles the number of buckets and puts every name back in
+void growSymbolBuckets(SymbolTable symbols)
+{
+    trackMemory(memVariables, symbols->numOfBuckets * sizeof(int), symbols->numOfBuckets * 2 * sizeof(int));
+    symbols->numOfBuckets *= 2;
+    symbols->buckets = (int*) realloc(symbols->buckets, symbols->numOfBuckets * sizeof(int));
+    if(symbols->buckets == NULL) {
+        fprintf(stderr, "ERROR - realloc failed for symbol buckets in growSymbolBuckets()\n");
+        exit(1);
+    }
+    uint32_t mask = (uint32_t) symbols->numOfBuckets - 1;
+    for(int i = 0; i < symbols->numOfBuckets; i++) {
+        symbols->buckets[i] = EMPTY_BUCKET;
+    }
+    for(int i = 0; i < symbols->numOfNames; i++) {
+        uint32_t b = symbolHash(symbols->names[i]) & mask;
+        while(symbols->buckets[b] != EMPTY_BUCKET) {
+            b = (b + 1) & mask;
+        }
+        symbols->buckets[b] = i;
+    }
+}
+
+void freeSymbolTable(SymbolTable symbols)
+{
+    if(symbols == NULL) {
+        return;
+    }
+    if(symbols->copyNames) {
+        for(int i = 0; i < symbols->numOfNames; i++) {
+            trackMemory(memVariables, strlen(symbols->names[i]) + 1, 0);
+            free(symbols->names[i]);
+        }
+    }
+    free(symbols->names);
+    free(symbols->buckets);
+    trackMemory(memVariables, symbols->nameCapacity * sizeof(char*) + symbols->numOfBuckets * sizeof(int), 0);
+    free(symbols);
+}
+
+// returns the number of variable slots the program uses: one for every letter and one for every named variable
+int getNumberOfSlots(TokenStream ts)
+{
+    return NUMBER_OF_VARIABLES + ((ts->symbols != NULL) ? ts->symbols->numOfNames : 0);
+}
+
+// returns the name of the variable in a slot. The name of a single letter slot is not stored, so NULL is returned
+char *getSlotName(TokenStream ts, int slot)
+{
+    if(ts->symbols == NULL || slot < NUMBER_OF_VARIABLES || slot >= getNumberOfSlots(ts)) {
+        return NULL;
+    }
+    return ts->symbols->names[slot - NUMBER_OF_VARIABLES];
+}
+
+// returns the slot of any variable name, or UNRESOLVED_SLOT if the program doesn't use it
+int findVariableSlot(TokenStream ts, char *name)
+{
+    if(name[0] >= 'A' && name[0] <= 'Z' && name[1] == '\0') {
+        return name[0] - 'A';
+    }
+    return (ts->symbols != NULL) ? findSymbol(ts->symbols, name) : UNRESOLVED_SLOT;
+}
+
+
+//  TOKEN STREAM FUNCTIONS  //////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// returns the number of tokens lexed so far. When the whole file is in memory this is every token in the file
+int64_t getNumberOfTokens(TokenStream ts)
+{
+    return ts->numOfTokens;
+}
+
+// returns the token at the passed index, lexing more of the file if needed. Returns NULL if the file has fewer tokens
+Token *getStreamToken(TokenStream ts, int64_t index)
+{
+    while(ts->file != NULL && index >= ts->numOfTokens) {
+        if(!lexNextStreamToken(ts)) {
+            break;
+        }
+    }
+    if(index >= ts->numOfTokens) {
+        return NULL;
+    }
+    if(index < ts->windowStart) {
+        fprintf(stderr, "ERROR - token %lld requested after being released in getStreamToken()\n", (long long) index);
+        exit(1);
+    }
+    return &ts->tokens[index - ts->windowStart];
+}
+
+char *getTokenText(TokenStream ts, Token *token)
+{
+    return ts->text + token->textOffset;
+}
+
+// tells the stream that no token before the passed index will be asked for again
+void releaseTokensBefore(TokenStream ts, int64_t index)
+{
+    if(ts->file != NULL && index > ts->releasedBefore) {
+        ts->releasedBefore = index;
+    }
+}
+
+// returns the buffer token text offsets are measured from, with every token null terminated. Returns NULL when streaming, as only a window of the text is kept
+char *getTextBuffer(TokenStream ts, size_t *textSize)
+{
+    if(ts->file != NULL) {
+        *textSize = 0;
+        return NULL;
+    }
+    if(ts->bytecode != NULL) {
+        *textSize = ts->bytecodeSize - (size_t) (ts->text - (char*) ts->bytecode);
+    } else {
+        *textSize = ts->sourceSize + 1;
+    }
+    return ts->text;
+}
+
+// returns the loaded source file before it is lexed
+char *getSourceBuffer(TokenStream ts, size_t *sourceSize)
+{
+    *sourceSize = ts->sourceSize;
+    return ts->source;
+}
+
+// returns 1 if the tokens were mapped in from a bytecode file rather than lexed
+int checkLoadedFromBytecode(TokenStream ts)
+{
+    return ts->bytecode != NULL;
+}
+
+// returns the most tokens held in memory at once
+int64_t getLargestWindow(TokenStream ts)
+{
+    return ts->largestWindow;
+}
+
+// returns whether the braces in the file match up, as the parser would find when counting hanging braces
+BraceBalance checkBraceBalance(TokenStream ts)
+{
+    return ts->braceBalance;
+}
+
+
+//  LEXER SETTINGS  //////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// sets the number of threads to lex with. AUTO_LEX_THREADS uses one per core for large files
+void setLexThreads(int numOfThreads)
+{
+    lexThreads = numOfThreads;
+}
+
+int getLexThreads()
+{
+    return lexThreads;
+}
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runLexerWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testChunkedLexing(): Checking files lexed in chunks give the same tokens as files lexed whole");
+    sput_run_test(testChunkedLexing);
+    sput_leave_suite();
+
+    sput_enter_suite("testBraceBalance(): Checking brace balance is found correctly across chunks");
+    sput_run_test(testBraceBalance);
+    sput_leave_suite();
+
+    sput_enter_suite("testStreamingWindow(): Checking streamed tokens match whole file tokens and released tokens are dropped");
+    sput_run_test(testStreamingWindow);
+    sput_leave_suite();
+
+    sput_enter_suite("testKeywordTable(): Checking every keyword hashes to its own slot");
+    sput_run_test(testKeywordTable);
+    sput_leave_suite();
+
+    sput_enter_suite("testTokenClassification(): Checking tokens are given the right type and payload");
+    sput_run_test(testTokenClassification);
+    sput_leave_suite();
+
+    sput_enter_suite("testTokenPositions(): Checking tokens record the line and column they start at");
+    sput_run_test(testTokenPositions);
+    sput_leave_suite();
+
+    sput_enter_suite("testSymbolTable(): Checking named variables get the same slots however the file is lexed");
+    sput_run_test(testSymbolTable);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testChunkedLexing()
+{
+    TokenStream whole = lexFile("examples/dandelion.txt", 1);
+    TokenStream chunked = lexFile("examples/dandelion.txt", 7);
+
+    sput_fail_unless(getNumberOfTokens(whole) == getNumberOfTokens(chunked), "Same number of tokens found when lexing in 7 chunks");
+    int allMatch = 1;
+    for(int64_t i = 0; i < getNumberOfTokens(whole) && i < getNumberOfTokens(chunked); i++) {
+        Token *a = getStreamToken(whole, i);
+        Token *b = getStreamToken(chunked, i);
+        if(strcmp(getTokenText(whole, a), getTokenText(chunked, b)) != 0 || a->type != b->type || a->line != b->line || a->column != b->column) {
+            allMatch = 0;
+        }
+    }
+    sput_fail_unless(allMatch, "Tokens lexed in 7 chunks match tokens lexed whole");
+    freeTokenStream(whole);
+    freeTokenStream(chunked);
+
+    TokenStream simple = lexFile("testingFiles/parserTesting.txt", 3);
+    sput_fail_unless(getNumberOfTokens(simple) == 12, "Correct number of tokens found in simple file");
+    sput_fail_unless(getStreamToken(simple, 11)->type == closeBrace, "Last token of simple file found correctly");
+    sput_fail_unless(getStreamToken(simple, 12) == NULL, "No token returned past the end of the file");
+    freeTokenStream(simple);
+}
+
+void testBraceBalance()
+{
+    for(int threads = 1; threads <= 4; threads += 3) {
+        TokenStream ts = lexFile("testingFiles/DO_Testing/test_nestedDO.txt", threads);
+        sput_fail_unless(checkBraceBalance(ts) == bracesOK, "Braces balance in nested DO loop file");
+        freeTokenStream(ts);
+
+        ts = lexFile("testingFiles/test_noClosingBrace.txt", threads);
+        sput_fail_unless(checkBraceBalance(ts) == bracesUnclosed, "Unclosed brace found");
+        freeTokenStream(ts);
+
+        ts = lexFile("testingFiles/test_textAfterClosingBrace.txt", threads);
+        sput_fail_unless(checkBraceBalance(ts) == bracesExtraInput, "Input after final closing brace found");
+        freeTokenStream(ts);
+    }
+}
+
+void testKeywordTable()
+{
+    int numOfKeywords = 0;
+    int allInPlace = 1;
+    for(int i = 0; i < KEYWORD_TABLE_SIZE; i++) {
+        if(keywordTable[i].text != NULL) {
+            numOfKeywords++;
+            if(keywordHash(keywordTable[i].text) != (uint32_t) i || strlen(keywordTable[i].text) > KEYWORD_MAX_LENGTH) {
+                allInPlace = 0;
+            }
+        }
+    }
+    sput_fail_unless(numOfKeywords == 25, "All 19 keywords and 6 colours are in the table");
+    sput_fail_unless(allInPlace, "Every keyword is stored at the slot it hashes to");
+}
+
+void testTokenClassification()
+{
+    Token t;
+    classifyToken(&t, "BKSTP");
+    sput_fail_unless(t.type == bkStep, "BKSTP classified as keyword");
+    classifyToken(&t, "PRPL");
+    sput_fail_unless(t.type == colourName && t.slot == purple, "PRPL classified as colour with correct payload");
+    classifyToken(&t, "/");
+    sput_fail_unless(t.type == op && t.slot == divide, "/ classified as operator with correct payload");
+    classifyToken(&t, "-12.5");
+    sput_fail_unless(t.type == num && t.val == -12.5, "-12.5 classified as number with correct value");
+    classifyToken(&t, "Q");
+    sput_fail_unless(t.type == var && t.slot == 'Q'-'A', "Q classified as variable with correct slot");
+    classifyToken(&t, "FDX");
+    sput_fail_unless(t.type == var && t.slot == UNRESOLVED_SLOT, "FDX classified as a named variable, left for the symbol table");
+    classifyToken(&t, "STEP_2");
+    sput_fail_unless(t.type == var, "Names may contain digits and underscores");
+    classifyToken(&t, "2STEP");
+    sput_fail_unless(t.type == noToken, "Names must start with a letter");
+    classifyToken(&t, "a");
+    sput_fail_unless(t.type == noToken, "Lower case letter is not a variable");
+}
+
+void testTokenPositions()
+{
+    for(int threads = 1; threads <= 5; threads += 4) {
+        TokenStream ts = lexFile("testingFiles/parserTesting.txt", threads);
+        Token *first = getStreamToken(ts, 0);
+        Token *fd = getStreamToken(ts, 1);
+        Token *distance = getStreamToken(ts, 2);
+        Token *last = getStreamToken(ts, 11);
+        sput_fail_unless(first->line == 1 && first->column == 1, "First token found at line 1, column 1");
+        sput_fail_unless(fd->line == 2 && fd->column == 1, "Token at the start of a line found at column 1");
+        sput_fail_unless(distance->line == 2 && distance->column == 4, "Token after a space found at the right column");
+        sput_fail_unless(last->line == 7 && last->column == 1, "Last token found on the last line");
+        freeTokenStream(ts);
+    }
+}
+
+void testSymbolTable()
+{
+    TokenStream whole = lexFile("testingFiles/VarNum_Testing/test_namedVariables.txt", 1);
+    TokenStream chunked = lexFile("testingFiles/VarNum_Testing/test_namedVariables.txt", 5);
+    TokenStream streamed = openTokenStream("testingFiles/VarNum_Testing/test_namedVariables.txt");
+
+    sput_fail_unless(getNumberOfSlots(whole) == NUMBER_OF_VARIABLES + 2, "Two named variables found");
+    sput_fail_unless(findVariableSlot(whole, "LENGTH") == NUMBER_OF_VARIABLES && findVariableSlot(whole, "STEP_2") == NUMBER_OF_VARIABLES + 1,
+                     "Named variables given slots in the order they appear");
+    sput_fail_unless(findVariableSlot(whole, "I") == 'I' - 'A', "Single letter variables keep their own slots");
+    sput_fail_unless(strcmp(getSlotName(whole, NUMBER_OF_VARIABLES + 1), "STEP_2") == 0, "Name found from slot");
+
+    int allMatch = getNumberOfSlots(chunked) == getNumberOfSlots(whole);
+    for(int64_t i = 0; i < getNumberOfTokens(whole); i++) {
+        Token *a = getStreamToken(whole, i);
+        Token *b = getStreamToken(chunked, i);
+        Token *c = getStreamToken(streamed, i);
+        if(b == NULL || c == NULL || a->slot != b->slot || a->slot != c->slot) {
+            allMatch = 0;
+        }
+    }
+    sput_fail_unless(allMatch, "Chunked and streamed lexing give every variable the same slot");
+
+    freeTokenStream(whole);
+    freeTokenStream(chunked);
+    freeTokenStream(streamed);
+}
+
+void testStreamingWindow()
+{
+    TokenStream whole = lexFile("testingFiles/STREAM_Testing/test_longProgram.txt", 1);
+    TokenStream streamed = openTokenStream("testingFiles/STREAM_Testing/test_longProgram.txt");
+
+    int allMatch = 1;
+    for(int64_t i = 0; i < getNumberOfTokens(whole); i++) {
+        Token *a = getStreamToken(whole, i);
+        Token *b = getStreamToken(streamed, i);
+        if(b == NULL || strcmp(getTokenText(whole, a), getTokenText(streamed, b)) != 0 || a->type != b->type || a->val != b->val ||
+           a->line != b->line || a->column != b->column) {
+            allMatch = 0;
+        }
+          // keep only the last few tokens, as if there were no open loops
+        releaseTokensBefore(streamed, i - 4 > 0 ? i - 4 : 0);
+    }
+    sput_fail_unless(allMatch, "Streamed tokens match tokens lexed from the whole file");
+    sput_fail_unless(getStreamToken(streamed, getNumberOfTokens(whole)) == NULL, "Stream ends at the same token as the whole file");
+    sput_fail_unless(getLargestWindow(streamed) <= INITIAL_WINDOW_SIZE, "Released tokens are dropped instead of growing the window");
+
+    freeTokenStream(whole);
+    freeTokenStream(streamed);
+}
@@ -3,15 +3,22 @@
 // structure to hold all the necessary information while parsing
 struct parseHandler {
 
-  FILE *tokenFP;
+  TokenStream tokenStream; // the lexed contents of the file. DO & WHILE loops go back to earlier tokens in the stream
+  uint64_t sourceHash; // the hash of the source file, used to save the program to the cache once it has been validated
   
   int hangingBraces; // record the number of open braces in order to check for more input after processing
   
-  int numberOfTokens; // the total number of tokens scanned from the file
-  int currentTokenIndex; // the index in the token array of the current token that is being processed
+  int64_t currentTokenIndex; // the index in the token stream of the current token that is being processed
+  Token *token; // the token currently being processed
   
-  char *token;
-  char **tokenArray; // an array containing all tokens that have been scanned so far. Used in DO & WHILE loops
+  int64_t *loopStarts; // the token index each open loop goes back to. Tokens before the first of these are never needed again
+  int64_t *loopPasses; // the number of times each open loop's body has been run
+  int numOfOpenLoops;
+  int loopStartCapacity;
+  int64_t lastLoopPasses; // the number of passes made by the last loop to close. Used by the profiler
+  int64_t expressionStart; // the start of the SET expression being compiled, whose tokens are kept until it has been evaluated
+  
+  ExpressionTable expressions; // the reverse polish expression of every SET reached so far, compiled the first time it is reached
   
   double val; // the current value that is being processed
   Clr colour; // the current colour that is being processed
@@ -22,6 +29,8 @@ struct parseHandler {
   int interpret; // a flag for whether to interpret the file or just parse the text
 } ;
 
+static int streamingValidation = 0;
+static int estimateOnly = 0; // if set, programs are measured and the estimate printed instead of being parsed or drawn
 
 
 
@@ -32,21 +41,20 @@ struct parseHandler {
 void setUpForParsing(char *filePath, int testMode, int interpretMode)
 {
     createParseHandler();
-    initialiseParseHandler(filePath, testMode);
+    initialiseParseHandler(filePath, testMode, interpretMode);
     
     ParseHandler pH = getParseHandlerPointer(NULL);
-    pH->interpret = interpretMode;
     setUpForInterpreting(testMode, pH->interpret);
+    reserveVariableSlots(getNumberOfSlots(pH->tokenStream));
+    if(pH->interpret) {
+        limitPositionHistory(findMaxBackstepDepth(pH->tokenStream));
+    }
     
 }
 
 void createParseHandler()
 {
-    ParseHandler pH = (ParseHandler) malloc(sizeof(struct parseHandler));
-    if(pH == NULL) {
-        fprintf(stderr, "ERROR: Unable to malloc space for parseHandler structure in createParseHandler()");
-        exit(1);
-    }
+    ParseHandler pH = (ParseHandler) runAlloc(sizeof(struct parseHandler), memParser);
     getParseHandlerPointer(pH);
 }
 
@@ -61,29 +69,48 @@ ParseHandler getParseHandlerPointer(ParseHandler newHandler)
     return pH;
 }
 
-// sets all starting values for parse handler and opens file to read from. If not testing, sets the showSyntaxErrors flag to true. If testing, the syntax error flag is determined by a #define in parser.h
-void initialiseParseHandler(char *filePath, int testMode)
+// sets all starting values for parse handler and lexes the file. If not testing, sets the showSyntaxErrors flag to true. If testing, the syntax error flag is determined by a #define in parser.h
+// if only parsing and streaming validation is switched on, the file is lexed as it is parsed and only tokens open loops may go back to are kept.
+// Otherwise the program is loaded from bytecode if it is a .tbc file or is in the cache
+void initialiseParseHandler(char *filePath, int testMode, int interpretMode)
 {
     ParseHandler pH = getParseHandlerPointer(NULL);
     
-    pH->tokenFP = fopen(filePath, "r");
+    pH->interpret = interpretMode;
+    pH->sourceHash = 0;
+    if(streamingValidation && interpretMode == DONT_INTERPRET) {
+        pH->tokenStream = openTokenStream(filePath);
+    } else {
+        pH->tokenStream = openProgram(filePath, getLexThreads(), &pH->sourceHash);
+    }
     
     pH->hangingBraces = 0;
-    pH->currentTokenIndex = 0;
-    pH->numberOfTokens = 0;
+    pH->currentTokenIndex = -1; // getToken() moves on to the first token
+    pH->token = NULL;
+    
+    pH->numOfOpenLoops = 0;
+    pH->loopStartCapacity = 0;
+    pH->loopStarts = NULL;
+    pH->loopPasses = NULL;
+    pH->lastLoopPasses = 0;
+    pH->expressionStart = NO_EXPRESSION_START;
+    
+    pH->expressions = createExpressionTable();
+    
+    if(getProfiling()) {
+        startProfile();
+    }
     
     if(testMode == NO_TESTING) {
         pH->showSyntaxErrors = 1;
     } else {
         pH->showSyntaxErrors = TEST_WITH_SYNTAX_ERRORS;
     }
-    
-    pH->tokenArray = NULL;
 }
 
 void shutDownParsing()
 {
-    freeValStack();
+    freeProfile();
     freeParseHandler();
     shutDownInterpreting();
 }
@@ -94,32 +121,59 @@ void shutDownParsing()
 //  PARSE HANDLER FUNCTIONS  /////////////////////////////////////////////////////////////////
 /*..........................................................................................*/
 
+void freeParseHandler()
+{
+    ParseHandler pH = getParseHandlerPointer(NULL);
+    freeTokenStream(pH->tokenStream);
+}
 
-// realocs the token array to fit in the next token
-void resizeTokenArray(ParseHandler pH)
+// records the token index a loop goes back to at the start of each pass, so the token stream keeps it
+void openLoop(ParseHandler pH, int64_t loopStartIndex)
 {
-    pH->tokenArray = (char**)realloc(pH->tokenArray,pH->numberOfTokens * sizeof(char*));
-    if(pH->tokenArray == NULL) {
-        fprintf(stderr, "ERROR - realloc failed in getToken()\n");
-        exit(1);
-    }
-    pH->tokenArray[pH->numberOfTokens-1] = (char*)calloc(TOKEN_LENGTH, sizeof(char));
-    if(pH->tokenArray[pH->numberOfTokens-1] == NULL) {
-        fprintf(stderr, "ERROR - malloc failed in getToken()\n");
-        exit(1);
+    if(pH->numOfOpenLoops == pH->loopStartCapacity) {
+        int oldCapacity = pH->loopStartCapacity;
+        pH->loopStartCapacity = (oldCapacity == 0) ? 16 : oldCapacity * 2;
+        pH->loopStarts = (int64_t*) runGrow(pH->loopStarts, oldCapacity * sizeof(int64_t), pH->loopStartCapacity * sizeof(int64_t), memParser);
+        pH->loopPasses = (int64_t*) runGrow(pH->loopPasses, oldCapacity * sizeof(int64_t), pH->loopStartCapacity * sizeof(int64_t), memParser);
     }
+    pH->loopStarts[pH->numOfOpenLoops] = loopStartIndex;
+    pH->loopPasses[pH->numOfOpenLoops] = 0;
+    pH->numOfOpenLoops++;
 }
 
-void freeParseHandler()
+// called at the start of each pass through the innermost open loop's body
+void countLoopPass(ParseHandler pH)
 {
-    ParseHandler pH = getParseHandlerPointer(NULL);
-    fclose(pH->tokenFP);
-    
-    for(int i = 0; i < pH->numberOfTokens; i++) {
-        free(pH->tokenArray[i]);
-    }
-    free(pH->tokenArray);
-    free(pH);
+    pH->loopPasses[pH->numOfOpenLoops-1]++;
+}
+
+// called once a loop has finished (or failed). Passes on the result of the loop
+int closeLoop(ParseHandler pH, int loopResult)
+{
+    pH->numOfOpenLoops--;
+    pH->lastLoopPasses = pH->loopPasses[pH->numOfOpenLoops];
+    return loopResult;
+}
+
+// switches streaming validation on or off. Only affects files that are parsed without being interpreted
+void setStreamingValidation(int streaming)
+{
+    streamingValidation = streaming;
+}
+
+int getStreamingValidation()
+{
+    return streamingValidation;
+}
+
+void setEstimateOnly(int estimate)
+{
+    estimateOnly = estimate;
+}
+
+int getEstimateOnly()
+{
+    return estimateOnly;
 }
 
 
@@ -134,6 +188,9 @@ int parse(char * filePath, int testMode)
     
     ParseHandler pH = getParseHandlerPointer(NULL);
     int parsed = processMain(pH);
+    if(parsed) {
+        saveValidatedProgram(pH->tokenStream, pH->sourceHash);
+    }
     return parsed;
 }
 
@@ -142,110 +199,146 @@ int interpret(char *filePath, int testMode)
     setUpForParsing(filePath, testMode, INTERPRET);
     
     ParseHandler pH = getParseHandlerPointer(NULL);
-    int interpreted = processMain(pH);
+    int interpreted = (getDrawTurtle() && getImageOutput() == NULL) ? interpretOnProducerThread(pH) : processMain(pH);
+    if(interpreted) {
+        saveValidatedProgram(pH->tokenStream, pH->sourceHash);
+        if(getDeduplication()) {
+            removeDuplicateSegments(getDisplayListPointer(NULL));
+        }
+        if(getSegmentLogPath() != NULL && !writeSegmentLog(getDisplayListPointer(NULL), getSegmentLogPath())) {
+            fprintf(stderr, "WARNING: unable to write segment log '%s'\n", getSegmentLogPath());
+        }
+    }
     return interpreted;
 }
 
-// reads the next token and sets it as the ParseHandler's current token
+// the program being run on the producer thread, and what processMain() returned for it
+struct producerRun {
+    ParseHandler pH;
+    int result;
+} ;
+
+// runs the program on a thread of its own while this thread draws it. The interpreter pushes each segment into the segment ring and
+// only waits if the ring is full, while this thread adds the segments to the display list every frame and reveals the drawing at its
+// own pace, so the program runs at full speed however slowly it is shown. SDL is only ever called from this thread
+int interpretOnProducerThread(ParseHandler pH)
+{
+    SegmentRing ring = createSegmentRing();
+    setSegmentRing(ring);
+    struct producerRun run = {pH, 0};
+    pthread_t producer;
+    if(pthread_create(&producer, NULL, runProducerThread, &run) != 0) {
+        fprintf(stderr, "ERROR - unable to create interpreter thread in interpretOnProducerThread()\n");
+        exit(1);
+    }
+    drawFromSegmentRing(ring);
+    pthread_join(producer, NULL);
+    setSegmentRing(NULL);
+    return run.result;
+}
+
+void *runProducerThread(void *data)
+{
+    struct producerRun *run = (struct producerRun*) data;
+    run->result = processMain(run->pH);
+    closeSegmentRing(getSegmentRing());
+    return NULL;
+}
+
+// runs the program following only the turtle's geometry: nothing is drawn or kept in the display list. m is filled in with the area
+// drawn over, the number of segments, how far back BKSTP had to be able to go and how long the run took. Returns 0 if the program has
+// errors, in which case m only covers the part run before the first one
+int measureProgram(char *filePath, Measurement *m)
+{
+    memset(m, 0, sizeof(Measurement));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    setMeasurement(m);
+    setUpForParsing(filePath, TESTING, INTERPRET);
+    int measured = processMain(getParseHandlerPointer(NULL));
+    shutDownParsing();
+    setMeasurement(NULL);
+
+    m->seconds = nanosecondsSince(&start) / 1e9;
+    return measured;
+}
+
+// the program runs at full speed while the window reveals the drawing, so drawing it on screen takes whichever of the two is longer
+void printMeasurement(FILE *out, char *filePath, Measurement *m)
+{
+    fprintf(out, "\nESTIMATE: %s\n", filePath);
+    fprintf(out, "segments:            %" PRId64 "\n", m->segments);
+    if(m->segments > 0) {
+        fprintf(out, "bounding box:        (%.2f, %.2f) to (%.2f, %.2f)\n", m->bounds.minX, m->bounds.minY, m->bounds.maxX, m->bounds.maxY);
+    }
+    fprintf(out, "BKSTP history:       %" PRId64 " positions\n", m->maxPositions);
+    fprintf(out, "run time:            %.3f s without drawing, %.3f s revealed on screen\n", m->seconds,
+            fmax(m->seconds, getRevealSeconds(m->segments)));
+}
+
+// moves on to the next token in the token stream and sets it as the ParseHandler's current token
 int getToken(ParseHandler pH)
 {
-      // if not at the end of the token array, advance token index along the array
-    if(pH->currentTokenIndex < pH->numberOfTokens-1) {
-        pH->currentTokenIndex++;
-        pH->token = pH->tokenArray[pH->currentTokenIndex];
-        return 1;
+      // nothing before the outermost open loop (or before the current token, if there are no loops open) will be needed again, unless
+      // it is part of the expression being compiled
+    int64_t keepFrom = (pH->numOfOpenLoops > 0) ? pH->loopStarts[0] : pH->currentTokenIndex;
+    if(pH->expressionStart != NO_EXPRESSION_START && pH->expressionStart < keepFrom) {
+        keepFrom = pH->expressionStart;
+    }
+    if(keepFrom > 0) {
+        releaseTokensBefore(pH->tokenStream, keepFrom);
     }
     
-      // if at the end of the array, increase the number of tokens processed & set the token index to be at the end of the array
-    pH->numberOfTokens++;
-    pH->currentTokenIndex = pH->numberOfTokens-1;
-    resizeTokenArray(pH);
-    
-      // scan in next token from file and insert it into the array
-    if(fscanf(pH->tokenFP, "%s", pH->tokenArray[pH->numberOfTokens-1]) != 1) {
-        if(fgetc(pH->tokenFP) == EOF) {
-              // if reached the end of file then there are not enough closing braces
-            return syntaxError(pH, "closing braces do not match opening braces. Are you missing a closing brace?");
-        } else {
-            return syntaxError(pH, "invalid character in file");
-        }
-    } else {
-          // set the current token pointer to the end of the array
-        pH->token = pH->tokenArray[pH->numberOfTokens-1];
+    Token *next = getStreamToken(pH->tokenStream, pH->currentTokenIndex + 1);
+    if(next != NULL) {
+        pH->currentTokenIndex++;
+        pH->token = next;
         return 1;
     }
+      // if reached the end of file then there are not enough closing braces
+    return syntaxError(pH, "closing braces do not match opening braces. Are you missing a closing brace?");
 }
 
         
-// analyses the token string and returns an enum for the type of token.
-TokenType whatToken(char *token)
+// returns the type the lexer gave the token. Variables are reported as assigned or unassigned. Numbers and assigned variables update the ParseHandler's current val, operators update its current operation
+TokenType whatToken(Token *token)
 {
     ParseHandler pH = getParseHandlerPointer(NULL);
     
-    if(sameString(token, "FD"))    {return fd;}
-    if(sameString(token, "LT"))    {return lt;}
-    if(sameString(token, "RT"))    {return rt;}
-    if(sameString(token, "SET"))   {return set;}
-    if(sameString(token, "DO"))    {return doToken;}
-    if(sameString(token, "BKSTP")) {return bkStep;}
-    if(sameString(token, "PN"))    {return penChange;}
-    if(sameString(token, "CLR"))   {return colour;}
-    if(sameString(token, "FROM"))  {return from;}
-    if(sameString(token, "TO"))    {return to;}
-    if(sameString(token, "{"))     {return openBrace;}
-    if(sameString(token, "}"))     {return closeBrace;}
-    if(sameString(token, ";"))     {return semicolon;}
-    if(sameString(token, ":="))    {return equals;}
-    if(sameString(token, "WHILE")) {return whileToken;}
-    if(sameString(token, "<"))     {return lessThan;}
-    if(sameString(token, ">"))     {return moreThan;}
-    if(sameString(token, "RAND"))  {return randomColour;}
-    if(sameString(token, "ADV"))   {return advanceColour;}
-    
-    if(checkForValidOperator(token, pH) == 1) {return op;}
-    
-      // if a single character, check for variable. If it is a variable, check whether it has been assigned
-    if(strlen(token) == 1) {
-        if(checkValidVariable(token[0])) {
-            if(checkVariableAssigned(token[0], pH->interpret, &pH->val)) {
+    switch(token->type) {
+        case var :
+            if(checkSlotAssigned(token->slot, pH->interpret, &pH->val)) {
                 return assignedVar;
-            } else {
-                return unassignedVar;
             }
-        }
+            return unassignedVar;
+        case num :
+            pH->val = token->val;
+            return num;
+        case op :
+            pH->currentOperation = (mathSymbol) token->slot;
+            return op;
+        default :
+            return token->type;
     }
-    if(checkForNumber(token, &pH->val)) {return num;}
-    
-    else {return noToken;}
 }
 
-// returns 1 if two strings are identical, ese returns 0
-int sameString(char *a, char *b)
-{
-    if(strcmp(a,b) == 0) {
-        return 1;
-    } else {
-        return 0;
-    }
-}
-        
-// used at the end of parsing. Returns 0 if there is anything other than spaces or newlines before the end of the file 
+// used at the end of parsing. Returns 0 if there are any tokens left after the current one
 int checkForEndOfCode(ParseHandler pH)
 {
-    char c;
-    while((c = fgetc(pH->tokenFP) ) != EOF) {
-        if(c != ' ' && c != '\n') {
-            return syntaxError(pH, "additional input detected. Are you missing an opening brace?");
-        }
+    if(getStreamToken(pH->tokenStream, pH->currentTokenIndex + 1) != NULL) {
+        return syntaxError(pH, "additional input detected. Are you missing an opening brace?");
     }
     return 1;
-}    
+}
         
 
 int syntaxError(ParseHandler pH, char *message)
 {
     if(pH->showSyntaxErrors) {
-        fprintf(stderr, "Syntax error - %s\nError at: %s\n", message, pH->token);
+          // while streaming, reading ahead can move the window the current token is kept in, so it is looked up again by its index
+        Token *token = (pH->token != NULL) ? getStreamToken(pH->tokenStream, pH->currentTokenIndex) : NULL;
+        fprintf(stderr, "Syntax error - %s\nError at: %s\n", message, token != NULL ? getTokenText(pH->tokenStream, token) : "start of file");
     }
     return 0;
 }        
@@ -264,6 +357,16 @@ int processMain(ParseHandler pH)
     if(whatToken(pH->token) != openBrace ) {
         return syntaxError(pH, "all code sections should begin with an opening brace");
     }
+    
+      // the lexer has already counted the braces in the whole file, so mismatches are caught before anything is run
+    switch(checkBraceBalance(pH->tokenStream)) {
+        case bracesUnclosed :
+            return syntaxError(pH, "closing braces do not match opening braces. Are you missing a closing brace?");
+        case bracesExtraInput :
+            return syntaxError(pH, "additional input detected. Are you missing an opening brace?");
+        default :
+            break;
+    }
     pH->hangingBraces++;
     
       // <INSTRCTLIST>
@@ -305,10 +408,31 @@ int processInstructionList(ParseHandler pH)
 
 /* <INSTRUCTION>: */
 // <FD> | <LT> | <RT> | <BKSTP> | <SET> | <DO> | <WHILE> | <CLR> | <PN>
+// when profiling, the instruction's cost is recorded against the line it starts on
 int processInstruction(ParseHandler pH)
+{
+    if(getMemoryReportInterval()) {
+        countInstructionForMemoryReport();
+    }
+    if(!getProfiling()) {
+        return runInstruction(pH);
+    }
+      // copied, as the token may move if the token stream is only keeping a window
+    Token instruction = *pH->token;
+    ProfileMark mark;
+    pH->lastLoopPasses = 0;
+    markInstructionStart(&mark);
+    
+    int result = runInstruction(pH);
+    
+    recordInstruction(&mark, &instruction, pH->lastLoopPasses);
+    return result;
+}
+
+int runInstruction(ParseHandler pH)
 {
     
-    TokenType t = whatToken(pH->token);
+    TokenType t = pH->token->type;
     
     switch(t) {
           // <FD> | <LT> | <RT> | <BKSTP>
@@ -342,7 +466,7 @@ int processInstruction(ParseHandler pH)
              }
             return 1;
         default :
-            fprintf(stderr,"ERROR - invalid token (%s) passed to processInstruction()\n", pH->token);
+            fprintf(stderr,"ERROR - invalid token (%s) passed to runInstruction()\n", getTokenText(pH->tokenStream, pH->token));
             exit(1);
     }
 }
@@ -372,7 +496,7 @@ int processSet(ParseHandler pH)
     if(!checkForAnyVar(pH->token)) {
         return 0;
     }
-    char varToSet = pH->token[0];
+    int slotToSet = pH->token->slot;
     
     if(!getToken(pH)) {return 0;}
       // ":="
@@ -383,7 +507,7 @@ int processSet(ParseHandler pH)
     if(!processPolish(pH)) {
         return 0;
     }
-    assignValToVariable(varToSet, pH->val, pH->interpret);
+    assignValToSlot(slotToSet, pH->val, pH->interpret);
     return 1;
     
 }
@@ -391,67 +515,80 @@ int processSet(ParseHandler pH)
 
 /* <POLISH>: */
 
-// <VARNUM> <POLISH> |
-// <OP> <POLISH> |
-// ";"
+// the expression is compiled the first time this SET is reached, then evaluated from its ops every time. Leaves the ";" ending the
+// expression as the current token. While streaming, the expression's tokens are kept until it has been evaluated the first time, so an
+// unassigned variable in it can still be reported at its token. Later evaluations are inside a loop, which keeps them anyway
 int processPolish(ParseHandler pH)
 {
-    if(!getToken(pH)) {return 0;}
-    
-      // <VARNUM>
-    if(checkForVarNum(pH->token)) {
-        pushToValStack(pH->val);
-           // <POLISH>
-        return processPolish(pH);
-    }
-    
-    if(strlen(pH->token) != 1) {
-        return syntaxError(pH, "all reverse polish operators/variables should only be 1 character long separated by spaces");
-    }
-    
-      // <OP>
-    if(whatToken(pH->token) == op) {
-        if(!processOperator(pH) ) {
+    int id = findExpression(pH->expressions, pH->currentTokenIndex);
+    if(id == NO_EXPRESSION) {
+        pH->expressionStart = pH->currentTokenIndex;
+        id = beginExpression(pH->expressions, pH->currentTokenIndex);
+        if(!compilePolish(pH, id)) {
+            pH->expressionStart = NO_EXPRESSION_START;
             return 0;
         }
-          // <POLISH>
-        return processPolish(pH);
     }
     
-      // ";"
-    if(whatToken(pH->token) == semicolon) {
-        return finishPolish(pH);
+    int64_t failedIndex;
+    int evaluated = evaluateExpression(pH->expressions, id, pH->interpret, &pH->val, &failedIndex);
+    if(!evaluated) {
+        pH->currentTokenIndex = failedIndex;
+        pH->token = getStreamToken(pH->tokenStream, failedIndex);
     }
-    
-    return syntaxError(pH, "reverse polish expression not completed properly");
-}
-
-
-/* <OP>: */
-
-// "+" | "-" | "*" | "/"
-int processOperator(ParseHandler pH)
-{
-    double a, b;
-    if(popFromValStack(&b) == 0 || popFromValStack(&a) == 0) {
-        return syntaxError(pH, "too few variables/constants for operators in reverse polish expression");
+    pH->expressionStart = NO_EXPRESSION_START;
+    if(!evaluated) {
+        return syntaxError(pH, "attempted to process an unassigned variable");
     }
     
-    pH->val = doMaths(a, b, pH->currentOperation);
-    
-    pushToValStack(pH->val);
+    int64_t endIndex = getExpression(pH->expressions, id)->endIndex;
+    if(pH->currentTokenIndex != endIndex) {
+        pH->currentTokenIndex = endIndex;
+        pH->token = getStreamToken(pH->tokenStream, endIndex);
+    }
     return 1;
 }
 
-// assigns final value from reverse polish expression to current val in ParseHandler and checks there are no values left over in expression
-int finishPolish(ParseHandler pH)
+// <VAR> <POLISH> | <NUM> <POLISH> |
+// <OP> <POLISH> |
+// ";"
+// adds an op for each token of the expression, checking every operator has two values to work on and one value is left at the end
+int compilePolish(ParseHandler pH, int id)
 {
-    popFromValStack(&pH->val);
-    if(getNumberOfValsOnStack() != 0) {
-        return syntaxError(pH, "more input than required operators in reverse polish expression\n");
-    } else {
-        return 1;
+    ExpressionTable table = pH->expressions;
+    
+    while(getToken(pH)) {
+        switch(pH->token->type) {
+              // <VAR>
+            case var :
+                addExpressionOp(table, id, pushVariable, pH->token->slot, 0, pH->currentTokenIndex);
+                break;
+              // <NUM>
+            case num :
+                addExpressionOp(table, id, pushNumber, 0, pH->token->val, pH->currentTokenIndex);
+                break;
+              // <OP>
+            case op :
+                if(!addExpressionOp(table, id, applyOperator, pH->token->slot, 0, pH->currentTokenIndex)) {
+                    return syntaxError(pH, getExpression(table, id)->error);
+                }
+                break;
+              // ";"
+            case semicolon :
+                if(!finishExpression(table, id, pH->currentTokenIndex)) {
+                    return syntaxError(pH, getExpression(table, id)->error);
+                }
+                return 1;
+            default :
+                if(pH->token->type == noToken) {
+                    failExpression(table, id, "unrecognised reverse polish operator or variable, operators are + - * / and variables are in capitals", pH->currentTokenIndex);
+                } else {
+                    failExpression(table, id, "reverse polish expression not completed properly", pH->currentTokenIndex);
+                }
+                return syntaxError(pH, getExpression(table, id)->error);
+        }
     }
+    return 0;
 }
 
 
@@ -465,7 +602,7 @@ int processDo(ParseHandler pH)
     if(!checkForAnyVar(pH->token)) {
         return syntaxError(pH, "invalid variable following DO command");
     }
-    char loopVariable = pH->token[0];
+    int loopSlot = pH->token->slot;
     
       // "FROM"
     if(!getToken(pH)) {return 0;}
@@ -479,7 +616,7 @@ int processDo(ParseHandler pH)
         return syntaxError(pH, "invalid variable/number following FROM in DO command");
     }
     int loopVal = (int) getCurrentTokenVal(pH);
-    assignValToVariable(loopVariable, (double)loopVal, pH->interpret);
+    assignValToSlot(loopSlot, (double)loopVal, pH->interpret);
     
       // "TO"
     if(!getToken(pH)) {return 0;}
@@ -501,28 +638,30 @@ int processDo(ParseHandler pH)
     }
     
     // record token index to restart loop
-    int doLoopStartIndex = pH->currentTokenIndex;
+    int64_t doLoopStartIndex = pH->currentTokenIndex;
+    openLoop(pH, doLoopStartIndex);
     
       // <INSTRCTLST>
     if(loopVal <= loopTargetVal) {
-        return executeUpwardsDoLoop(pH, doLoopStartIndex, loopVariable, loopVal, loopTargetVal);
+        return closeLoop(pH, executeUpwardsDoLoop(pH, doLoopStartIndex, loopSlot, loopVal, loopTargetVal));
     } else {
-        return executeDownwardsDoLoop(pH, doLoopStartIndex, loopVariable, loopVal, loopTargetVal);
+        return closeLoop(pH, executeDownwardsDoLoop(pH, doLoopStartIndex, loopSlot, loopVal, loopTargetVal));
     }
     
 
 }
 
 
-int executeUpwardsDoLoop(ParseHandler pH, int doLoopStartIndex, char loopVariable, int loopVal, int loopTargetVal)
+int executeUpwardsDoLoop(ParseHandler pH, int64_t doLoopStartIndex, int loopSlot, int loopVal, int loopTargetVal)
 {
     for(int i = loopVal; i <= loopTargetVal; i++) {
           // if interpreting, assign incremented value to loop variable
-        assignValToVariable(loopVariable, (double)i, pH->interpret);
+        assignValToSlot(loopSlot, (double)i, pH->interpret);
         
           // reset token location and increase number of hanging braces
         pH->currentTokenIndex = doLoopStartIndex;
         pH->hangingBraces++;
+        countLoopPass(pH);
         
           // carry out the embedded instruction list
         if(!processInstructionList(pH)) {
@@ -532,15 +671,16 @@ int executeUpwardsDoLoop(ParseHandler pH, int doLoopStartIndex, char loopVariabl
     return 1;
 }
 
-int executeDownwardsDoLoop(ParseHandler pH, int doLoopStartIndex, char loopVariable, int loopVal, int loopTargetVal)
+int executeDownwardsDoLoop(ParseHandler pH, int64_t doLoopStartIndex, int loopSlot, int loopVal, int loopTargetVal)
 {
     for(int i = loopVal; i >= loopTargetVal; i--) {
           // if interpreting, assign decremented value to loop variable
-        assignValToVariable(loopVariable, (double)i, pH->interpret);
+        assignValToSlot(loopSlot, (double)i, pH->interpret);
         
           // reset token location and increase number of hanging braces
         pH->currentTokenIndex = doLoopStartIndex;
         pH->hangingBraces++;
+        countLoopPass(pH);
         
           // carry out the embedded instruction list
         if(!processInstructionList(pH)) {
@@ -560,7 +700,7 @@ int processWhile(ParseHandler pH)
     if(whatToken(pH->token) != assignedVar) {
         return syntaxError(pH, "unassigned variable in WHILE command declaration");
     }
-    char loopVariable = pH->token[0];
+    int loopSlot = pH->token->slot;
     
       // <COMPARATOR>
     if(!getToken(pH)) {return 0;}
@@ -583,28 +723,32 @@ int processWhile(ParseHandler pH)
     }
     
     // record token index to restart loop
-    int loopStartIndex = pH->currentTokenIndex;
+    int64_t loopStartIndex = pH->currentTokenIndex;
     
       // <INSTRCTLST>
     if(!pH->interpret) {
-        return skipLoop(pH);
+        int parsed = skipLoop(pH);
+        pH->lastLoopPasses = 0; // the loop never ran, whatever loops inside it did
+        return parsed;
     } else {
-        return executeWhileLoop(pH, loopType, loopVariable, loopTargetVal, loopStartIndex);
+        openLoop(pH, loopStartIndex);
+        return closeLoop(pH, executeWhileLoop(pH, loopType, loopSlot, loopTargetVal, loopStartIndex));
     }
 }
 
 // processes while loop until while condition is met. If condition is met on instigation, parses loop once but doesn't set any values
-int executeWhileLoop(ParseHandler pH, TokenType loopType, char loopVariable, double loopTargetVal, int loopStartIndex)
+int executeWhileLoop(ParseHandler pH, TokenType loopType, int loopSlot, double loopTargetVal, int64_t loopStartIndex)
 {
     if(loopType == lessThan) {
           //check if condition is already met
-        if(getVariableVal(loopVariable) > loopTargetVal) {
+        if(getSlotVal(loopSlot) > loopTargetVal) {
             return skipLoop(pH);
         }
           // if not, do the loop
-        while(getVariableVal(loopVariable) < loopTargetVal) {
+        while(getSlotVal(loopSlot) < loopTargetVal) {
             pH->currentTokenIndex = loopStartIndex;
             pH->hangingBraces++;
+            countLoopPass(pH);
             
             if(!processInstructionList(pH)) {
                 return syntaxError(pH, "error within WHILE loop");
@@ -613,13 +757,14 @@ int executeWhileLoop(ParseHandler pH, TokenType loopType, char loopVariable, dou
       
     } else {
           //check if condition is already met
-        if(getVariableVal(loopVariable) < loopTargetVal) {
+        if(getSlotVal(loopSlot) < loopTargetVal) {
             return skipLoop(pH);
         }
           // if not, do the loop
-        while(getVariableVal(loopVariable) > loopTargetVal) {
+        while(getSlotVal(loopSlot) > loopTargetVal) {
             pH->currentTokenIndex = loopStartIndex;
             pH->hangingBraces++;
+            countLoopPass(pH);
             
             if(!processInstructionList(pH)) {
                 return syntaxError(pH, "error within WHILE loop");
@@ -671,31 +816,29 @@ int processColour(ParseHandler pH)
 {
     if(!getToken(pH)) {return 0;}
     
-      // "ADV"
-    if(whatToken(pH->token) == advanceColour) {
-        if(pH->interpret) {
-            advanceTurtleColour();
-        }
-        return 1;
-    }
-    
-      // "RAND"
-    if(whatToken(pH->token) == randomColour) {
-        if(pH->interpret) {
-            setRandomTurtleColour();
-        }
-        return 1;
-    }
-    
-      // colour
-    if(checkForColour(pH->token, pH) ) {
-        if(pH->interpret) {
-            applyTurtleColour(pH->colour);
-        }
-        return 1;
+    switch(pH->token->type) {
+          // "ADV"
+        case advanceColour :
+            if(pH->interpret) {
+                advanceTurtleColour();
+            }
+            return 1;
+          // "RAND"
+        case randomColour :
+            if(pH->interpret) {
+                setRandomTurtleColour();
+            }
+            return 1;
+          // colour
+        case colourName :
+            checkForColour(pH->token, pH);
+            if(pH->interpret) {
+                applyTurtleColour(pH->colour);
+            }
+            return 1;
+        default :
+            return syntaxError(pH, "invalid token following CLR");
     }
-    
-    return syntaxError(pH, "invalid token following CLR");
 }
 
 
@@ -705,29 +848,28 @@ int processColour(ParseHandler pH)
 /*..........................................................................................*/
 
 // returns 1 if passed token is an assigned variable or a number
-int checkForVarNum(char * token)
+int checkForVarNum(Token *token)
 {
-    if(whatToken(token) == assignedVar || whatToken(token) == num) {
+    TokenType t = whatToken(token);
+    if(t == assignedVar || t == num) {
         return 1;
     }
     return 0;
 }
 
 // returns 1 if the passed token is a variable, regardless of whether it has already been assigned
-int checkForAnyVar(char * token)
+int checkForAnyVar(Token *token)
 {
-    if(whatToken(token) == assignedVar || whatToken(token) == unassignedVar) {
+    if(token->type == var) {
         return 1;
     }
     return 0;
 }
 
 // returns 1 if the passed token is any one of the instruction commands
-int checkForInstruction(char *chkToken)
+int checkForInstruction(Token *token)
 {
-    TokenType t = whatToken(chkToken);
-    
-    switch(t) {
+    switch(token->type) {
         case fd :
         case rt :
         case lt :
@@ -743,56 +885,11 @@ int checkForInstruction(char *chkToken)
     }
 }
 
-// returns 1 if the passed token is a mathematical operator
-int checkForValidOperator(char *c, ParseHandler pH)
-{
-      // check token has only one character - prevents "-5", for example, from being read as a minus operator
-    if(strlen(c) > 1) {
-        return 0;
-    }
-    switch(c[0]) {
-        case '+' :
-            pH->currentOperation = add;
-            return 1;
-        case '-' :
-            pH->currentOperation = subtract;
-            return 1;
-        case '/' :
-            pH->currentOperation = divide;
-            return 1;
-        case '*' :
-            pH->currentOperation = multiply;
-            return 1;
-        default :
-            return 0;
-    }
-}
-
 // returns 1 if the passed token is any one of the valid colours and sets the ParseHandler's current colour
-int checkForColour(char *token, ParseHandler pH)
+int checkForColour(Token *token, ParseHandler pH)
 {
-    if(sameString(token, "WHTE")) {
-        pH->colour = white;
-        return 1;
-    }
-    if(sameString(token, "RED")) {
-        pH->colour = red;
-        return 1;
-    }
-    if(sameString(token, "BLUE")) {
-        pH->colour = blue;
-        return 1;
-    }
-    if(sameString(token, "GREEN")) {
-        pH->colour = green;
-        return 1;
-    }
-    if(sameString(token, "YLLW")) {
-        pH->colour = yellow;
-        return 1;
-    }
-    if(sameString(token, "PRPL")) {
-        pH->colour = purple;
+    if(token->type == colourName) {
+        pH->colour = (Clr) token->slot;
         return 1;
     }
     return 0;
@@ -801,10 +898,11 @@ int checkForColour(char *token, ParseHandler pH)
 // if token is a number, returns number. Else returns the number stored as that variable
 double getCurrentTokenVal(ParseHandler pH)
 {
-    if(checkForNumber(pH->token, &pH->val) ) {
+    if(pH->token->type == num) {
+        pH->val = pH->token->val;
         return pH->val;
     }
-    return getVariableVal(pH->token[0]);
+    return getSlotVal(pH->token->slot);
 }
 
 
@@ -825,6 +923,14 @@ void runParserWhiteBoxTests()
     sput_run_test(testSetAssignment);
     sput_leave_suite();
     
+    sput_enter_suite("testStreamingValidation(): Checking files parsed with a token window give the same results in less memory");
+    sput_run_test(testStreamingValidation);
+    sput_leave_suite();
+    
+    sput_enter_suite("testProgramMeasurement(): Checking a geometry only run finds the extent and size of a drawing");
+    sput_run_test(testProgramMeasurement);
+    sput_leave_suite();
+    
     sput_finish_testing();
 
 }
@@ -833,10 +939,11 @@ void runParserWhiteBoxTests()
 void testHandlerInitialisation()
 {
     createParseHandler();
-    initialiseParseHandler("testingFiles/parserTesting.txt", TESTING);
+    initialiseParseHandler("testingFiles/parserTesting.txt", TESTING, DONT_INTERPRET);
     ParseHandler pH = getParseHandlerPointer(NULL);
     
-    sput_fail_unless(pH->tokenFP != NULL, "Parser Handler sets token file pointer on initialisation");
+    sput_fail_unless(getNumberOfTokens(pH->tokenStream) == 12, "Parser Handler lexes every token from the file on initialisation");
+    sput_fail_unless(pH->currentTokenIndex == -1, "Parser Handler starts before the first token");
     freeParseHandler();
 }
 
@@ -844,6 +951,69 @@ void testSetAssignment()
 {
     sput_fail_unless(interpret("testingFiles/SET_Testing/test_selfSET.txt", TESTING) == 1 && getVariableVal('C') == 10, "Interpreted variable setting itself with correct value (e.g. C += C ;)");
     shutDownParsing();
+    
+    sput_fail_unless(interpret("testingFiles/VarNum_Testing/test_namedVariables.txt", TESTING) == 1, "Interpreted file using named variables");
+    ParseHandler pH = getParseHandlerPointer(NULL);
+    sput_fail_unless(getSlotVal(findVariableSlot(pH->tokenStream, "LENGTH")) == 13 && getVariableVal('A') == 13, "Named variable updated in loop has correct value");
+    sput_fail_unless(getSlotVal(findVariableSlot(pH->tokenStream, "STEP_2")) == 20, "Named variable set from another named variable");
+    shutDownParsing();
+}
+
+void testStreamingValidation()
+{
+    setStreamingValidation(1);
+    
+    sput_fail_unless(parse("testingFiles/STREAM_Testing/test_longProgram.txt", TESTING) == 1, "Parsed long program ok while streaming");
+    ParseHandler pH = getParseHandlerPointer(NULL);
+    sput_fail_unless(getLargestWindow(pH->tokenStream) < getNumberOfTokens(pH->tokenStream) / 4, "Long program parsed while holding under a quarter of its tokens");
+    sput_fail_unless(pH->numOfOpenLoops == 0, "All loops closed after parsing");
+    shutDownParsing();
+    
+    sput_fail_unless(parse("testingFiles/DO_Testing/test_complexDO.txt", TESTING) == 1, "Parsed complex nested DO loop ok while streaming");
+    shutDownParsing();
+    
+    sput_fail_unless(parse("testingFiles/test_noClosingBrace.txt", TESTING) == 0, "Will not parse text with no closing brace while streaming");
+    shutDownParsing();
+    
+    sput_fail_unless(parse("testingFiles/test_textAfterClosingBrace.txt", TESTING) == 0, "Will not parse text with input after last brace while streaming");
+    shutDownParsing();
+    
+    sput_fail_unless(parse("testingFiles/system_Testing/test_neverTrueWHILEsyntax.txt", TESTING) == 0, "Will not parse syntax error within WHILE loop while streaming");
+    shutDownParsing();
+    
+    sput_fail_unless(parse("testingFiles/STREAM_Testing/test_unassignedInLongSET.txt", TESTING) == 0, "Unassigned variable at the start of a long SET reported while streaming");
+    shutDownParsing();
+    
+    setStreamingValidation(0);
+}
+
+void testProgramMeasurement()
+{
+    Measurement m;
+    sput_fail_unless(measureProgram("testingFiles/ANALYSIS_Testing/test_measureSquare.txt", &m) == 1, "Measured square");
+    sput_fail_unless(m.segments == 4, "Segments of square counted");
+    sput_fail_unless(m.bounds.minX == SCREEN_WIDTH/2 && m.bounds.maxX == SCREEN_WIDTH/2 + 100 && m.bounds.minY == SCREEN_HEIGHT/2 - 100 &&
+                     m.bounds.maxY == SCREEN_HEIGHT/2, "Bounding box of square found");
+    sput_fail_unless(m.maxPositions == 7 && getMeasurement() == NULL, "Positions counted and measuring switched off afterwards");
+    Measurement history;
+    measureProgram("testingFiles/ANALYSIS_Testing/test_noBackstep.txt", &history);
+    sput_fail_unless(history.maxPositions == 16, "Positions counted for a program that keeps no history");
+    measureProgram("testingFiles/ANALYSIS_Testing/test_boundedBackstep.txt", &history);
+    sput_fail_unless(history.maxPositions == 102, "Positions gone back through taken off the count");
+    measureProgram("testingFiles/ANALYSIS_Testing/test_longHistory.txt", &history);
+    sput_fail_unless(history.maxPositions == 2 * INITIAL_POSITION_CAPACITY, "Positions counted past the size of the position ring");
+    setRevealRate(2);
+    sput_fail_unless(getRevealSeconds(m.segments) == 2, "Reveal time found from the reveal rate");
+    setRevealDuration(3);
+    sput_fail_unless(getRevealSeconds(m.segments) == 3, "Reveal time set by the reveal duration, whatever the size");
+    setRevealRate(DEFAULT_REVEAL_RATE);
+    
+    sput_fail_unless(measureProgram("examples/dandelion.txt", &m) == 1, "Measured example");
+    interpret("examples/dandelion.txt", TESTING);
+    sput_fail_unless(m.segments == getSegmentsAppended(), "Measured the same number of segments as are drawn");
+    shutDownParsing();
+    
+    sput_fail_unless(measureProgram("testingFiles/test_noClosingBrace.txt", &m) == 0, "Program with errors fails to measure");
 }
 
 
@@ -922,7 +1092,7 @@ void testNumberChecking()
 
 
 // independent main function - used in testing
-// command line compile code: gcc `sdl2-config --cflags` -O4 -Wall -pedantic -std=c99 -o parseTest parser.c interpreter.c display.c -lm `sdl2-config --libs`
+// command line compile code: gcc `sdl2-config --cflags` -O4 -Wall -pedantic -std=c99 -D_POSIX_C_SOURCE=200809L -pthread -o parseTest parser.c lexer.c interpreter.c display.c -lm `sdl2-config --libs`
 /*
 int main(void)
 {
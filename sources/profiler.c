@@ -0,0 +1,312 @@
+#include "../includes/parser.h" // the tests run programs through the parser, which includes profiler.h
+
+#define NANOSECONDS_PER_SECOND 1000000000LL
+#define NANOSECONDS_PER_MILLISECOND 1000000.0
+#define PROFILE_SOURCE_LENGTH 1024 // longest source line shown in the listing
+
+// per line and per loop counts for one run of a program. Lines are indexed by line number, loops are kept in the order they were first run
+struct profile {
+    LineProfile *lines;
+    int32_t lineCapacity;
+    int32_t lastLine; // the highest line an instruction has been run on
+
+    LoopProfile *loops;
+    int numOfLoops;
+    int loopCapacity;
+} ;
+
+static int profiling = 0;
+
+
+
+//  SETUP/SHUTDOWN FUNCTIONS  ////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// empties the profile ready for the next run, creating it the first time
+void startProfile()
+{
+    if(getProfilePointer(NULL) == NULL) {
+        Profile p = (Profile) calloc(1, sizeof(struct profile));
+        if(p == NULL) {
+            fprintf(stderr, "ERROR - unable to calloc space for Profile in startProfile()\n");
+            exit(1);
+        }
+        getProfilePointer(p);
+    }
+    freeProfile();
+}
+
+// if passed NULL, returns pointer to the Profile. If passed pointer, sets static pointer to the new pointer
+Profile getProfilePointer(Profile newProfile)
+{
+    static Profile p = NULL;
+    if(newProfile != NULL) {
+        p = newProfile;
+    }
+    return p;
+}
+
+// frees the counts from the last run. The Profile itself is kept for the next run
+void freeProfile()
+{
+    Profile p = getProfilePointer(NULL);
+    if(p == NULL) {
+        return;
+    }
+    free(p->lines);
+    free(p->loops);
+    trackMemory(memProfile, p->lineCapacity * sizeof(LineProfile) + p->loopCapacity * sizeof(LoopProfile), 0);
+    p->lines = NULL;
+    p->loops = NULL;
+    p->lineCapacity = 0;
+    p->lastLine = 0;
+    p->numOfLoops = 0;
+    p->loopCapacity = 0;
+}
+
+
+
+//  RECORDING FUNCTIONS  /////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void markInstructionStart(ProfileMark *mark)
+{
+    clock_gettime(CLOCK_MONOTONIC, &mark->start);
+    mark->segments = getSegmentsDrawn();
+    mark->positions = getPositionsStored();
+}
+
+// adds the cost of an instruction that has just finished to its line. The cost of a loop goes to the loop instead, as everything in its
+// body has already been counted against the body's own lines
+void recordInstruction(ProfileMark *mark, Token *instruction, int64_t loopPasses)
+{
+    int64_t nanoseconds = nanosecondsSince(&mark->start);
+    int64_t segments = getSegmentsDrawn() - mark->segments;
+    int64_t positions = getPositionsStored() - mark->positions;
+
+    LineProfile *line = getLineProfile(instruction->line);
+    line->executions++;
+
+    if(instruction->type == doToken || instruction->type == whileToken) {
+        LoopProfile *loop = getLoopProfile(instruction->line, instruction->column, instruction->type);
+        loop->entries++;
+        loop->passes += loopPasses;
+        loop->nanoseconds += nanoseconds;
+        loop->segments += segments;
+        loop->positions += positions;
+    } else {
+        line->nanoseconds += nanoseconds;
+        line->segments += segments;
+        line->positions += positions;
+    }
+}
+
+// returns the counts for a line, making room for it if it is past the end of the table
+LineProfile *getLineProfile(int32_t line)
+{
+    Profile p = getProfilePointer(NULL);
+    if(line >= p->lineCapacity) {
+        int32_t newCapacity = (p->lineCapacity == 0) ? INITIAL_PROFILE_LINES : p->lineCapacity;
+        while(newCapacity <= line) {
+            newCapacity *= 2;
+        }
+        p->lines = (LineProfile*) realloc(p->lines, newCapacity * sizeof(LineProfile));
+        if(p->lines == NULL) {
+            fprintf(stderr, "ERROR - realloc failed for line profiles in getLineProfile()\n");
+            exit(1);
+        }
+        trackMemory(memProfile, p->lineCapacity * sizeof(LineProfile), newCapacity * sizeof(LineProfile));
+        memset(p->lines + p->lineCapacity, 0, (newCapacity - p->lineCapacity) * sizeof(LineProfile));
+        for(int32_t i = p->lineCapacity; i < newCapacity; i++) {
+            p->lines[i].firstLoop = NO_LOOP;
+        }
+        p->lineCapacity = newCapacity;
+    }
+    if(line > p->lastLine) {
+        p->lastLine = line;
+    }
+    return &p->lines[line];
+}
+
+// returns the counts for the loop starting at the given line and column, adding it if it hasn't been run before
+LoopProfile *getLoopProfile(int32_t line, int32_t column, TokenType type)
+{
+    Profile p = getProfilePointer(NULL);
+    LineProfile *lineProfile = getLineProfile(line);
+
+    for(int i = lineProfile->firstLoop; i != NO_LOOP; i = p->loops[i].nextOnLine) {
+        if(p->loops[i].column == column) {
+            return &p->loops[i];
+        }
+    }
+
+    if(p->numOfLoops == p->loopCapacity) {
+        int newCapacity = (p->loopCapacity == 0) ? 16 : p->loopCapacity * 2;
+        p->loops = (LoopProfile*) realloc(p->loops, newCapacity * sizeof(LoopProfile));
+        if(p->loops == NULL) {
+            fprintf(stderr, "ERROR - realloc failed for loop profiles in getLoopProfile()\n");
+            exit(1);
+        }
+        trackMemory(memProfile, p->loopCapacity * sizeof(LoopProfile), newCapacity * sizeof(LoopProfile));
+        p->loopCapacity = newCapacity;
+    }
+    LoopProfile *loop = &p->loops[p->numOfLoops];
+    memset(loop, 0, sizeof(LoopProfile));
+    loop->line = line;
+    loop->column = column;
+    loop->type = type;
+    loop->nextOnLine = lineProfile->firstLoop;
+    lineProfile->firstLoop = p->numOfLoops;
+    p->numOfLoops++;
+    return loop;
+}
+
+int64_t nanosecondsSince(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) (now.tv_sec - start->tv_sec) * NANOSECONDS_PER_SECOND + (now.tv_nsec - start->tv_nsec);
+}
+
+
+
+//  REPORTING FUNCTIONS  /////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// prints every line of the source next to what was run on it, followed by a table of loops. If the program was loaded from a .tbc file
+// the source isn't available, so only lines that ran anything are printed
+void printProfile(FILE *out, char *filePath)
+{
+    Profile p = getProfilePointer(NULL);
+    if(p == NULL) {
+        return;
+    }
+    FILE *source = checkForBytecodeExtension(filePath) ? NULL : fopen(filePath, "r");
+    char text[PROFILE_SOURCE_LENGTH];
+
+    fprintf(out, "\nProfile of %s\n", filePath);
+    fprintf(out, "%6s %12s %12s %10s %10s | %s\n", "line", "executions", "time (ms)", "segments", "pushes", "source");
+
+    for(int32_t line = 1; ; line++) {
+        int haveText = (source != NULL && fgets(text, PROFILE_SOURCE_LENGTH, source) != NULL);
+        if(!haveText && line > p->lastLine) {
+            break;
+        }
+        if(haveText) {
+              // drop the newline, and the rest of any line too long to show
+            size_t length = strcspn(text, "\r\n");
+            if(text[length] == '\0' && !feof(source)) {
+                int c;
+                while((c = fgetc(source)) != EOF && c != '\n') {}
+            }
+            text[length] = '\0';
+        } else {
+            text[0] = '\0';
+        }
+
+        LineProfile *counts = (line < p->lineCapacity) ? &p->lines[line] : NULL;
+        if(counts != NULL && counts->executions > 0) {
+            fprintf(out, "%6d %12lld %12.3f %10lld %10lld | %s\n", line, (long long) counts->executions, counts->nanoseconds / NANOSECONDS_PER_MILLISECOND,
+                    (long long) counts->segments, (long long) counts->positions, text);
+        } else if(haveText) {
+            fprintf(out, "%6d %12s %12s %10s %10s | %s\n", line, "", "", "", "", text);
+        }
+    }
+    if(source != NULL) {
+        fclose(source);
+    }
+    printLoopProfiles(out);
+    DisplayList dl = getDisplayListPointer(NULL);
+    fprintf(out, "\nSegments: %lld drawn, %lld after merging collinear segments", (long long) dl->segmentsAppended, (long long) (dl->numOfSegments + dl->duplicatesRemoved));
+    if(getDeduplication()) {
+        fprintf(out, ", %lld after removing duplicates", (long long) dl->numOfSegments);
+    }
+    fprintf(out, "\n");
+}
+
+// loop times and counts include everything run inside the loop, including nested loops
+void printLoopProfiles(FILE *out)
+{
+    Profile p = getProfilePointer(NULL);
+    if(p->numOfLoops == 0) {
+        return;
+    }
+    fprintf(out, "\nLoops (totals include nested loops)\n");
+    fprintf(out, "%-6s %-11s %10s %12s %12s %10s %10s\n", "loop", "line:column", "entries", "passes", "time (ms)", "segments", "pushes");
+    for(int i = 0; i < p->numOfLoops; i++) {
+        LoopProfile *loop = &p->loops[i];
+        char position[32];
+        snprintf(position, sizeof(position), "%d:%d", loop->line, loop->column);
+        fprintf(out, "%-6s %-11s %10lld %12lld %12.3f %10lld %10lld\n", (loop->type == doToken) ? "DO" : "WHILE", position,
+                (long long) loop->entries, (long long) loop->passes, loop->nanoseconds / NANOSECONDS_PER_MILLISECOND,
+                (long long) loop->segments, (long long) loop->positions);
+    }
+}
+
+
+
+//  PROFILER SETTINGS  ///////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// switches profiling on or off. When off, the parser skips all of the recording functions
+void setProfiling(int profile)
+{
+    profiling = profile;
+}
+
+int getProfiling()
+{
+    return profiling;
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runProfilerWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testLineProfile(): Checking instructions are counted against the lines they are written on");
+    sput_run_test(testLineProfile);
+    sput_leave_suite();
+
+    sput_enter_suite("testLoopProfile(): Checking loops are counted with everything run inside them");
+    sput_run_test(testLoopProfile);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testLineProfile()
+{
+    setProfiling(1);
+    sput_fail_unless(interpret("testingFiles/PROFILE_Testing/test_profileLines.txt", TESTING) == 1, "Interpreted file while profiling");
+
+    sput_fail_unless(getLineProfile(2)->executions == 1, "SET outside loop counted once");
+    sput_fail_unless(getLineProfile(4)->executions == 4 && getLineProfile(4)->segments == 4, "FD in loop counted on every pass with its segments");
+    sput_fail_unless(getLineProfile(5)->executions == 4 && getLineProfile(5)->positions == 4 && getLineProfile(5)->segments == 0, "RT in loop stores a position and draws nothing");
+    sput_fail_unless(getLineProfile(8)->executions == 1 && getLineProfile(8)->segments == 0 && getLineProfile(8)->positions == 1, "FD with pen up draws nothing");
+    sput_fail_unless(getLineProfile(6)->executions == 0, "Closing brace not counted as an instruction");
+
+    shutDownParsing();
+    setProfiling(0);
+}
+
+void testLoopProfile()
+{
+    setProfiling(1);
+    sput_fail_unless(interpret("testingFiles/PROFILE_Testing/test_profileLines.txt", TESTING) == 1, "Interpreted file while profiling");
+
+    LoopProfile *loop = getLoopProfile(3, 1, doToken);
+    sput_fail_unless(getProfilePointer(NULL)->numOfLoops == 1, "One loop recorded");
+    sput_fail_unless(loop->entries == 1 && loop->passes == 4, "Loop entered once and run four times");
+    sput_fail_unless(loop->segments == 4 && loop->positions == 8, "Loop totals include its body");
+    sput_fail_unless(getLineProfile(3)->executions == 1 && getLineProfile(3)->segments == 0, "Loop body not counted against the loop's own line");
+
+    shutDownParsing();
+    setProfiling(0);
+}
@@ -0,0 +1,536 @@
+#include "../includes/parser.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_VARINT_BYTES 10
+#define MAX_SEGMENT_BYTES (1 + 4 * MAX_VARINT_BYTES)
+#define SEGLOG_PATH_LENGTH 4096
+
+static char *segmentLogPath = NULL; // if set, the segments of the next program interpreted are written here
+
+// a segment log mapped into memory
+struct segmentLog {
+    void *mapping;
+    size_t fileSize;
+    SegmentLogHeader *header;
+    SegmentLogBlock *index;
+} ;
+
+
+
+//  SAVING FUNCTIONS  ////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// writes every segment of the display list to filePath, a block at a time, followed by the block index. Like a .tbc file it is written
+// next to filePath and renamed into place, so a reader never maps half a log. Returns 0 if the file couldn't be written
+int writeSegmentLog(DisplayList dl, char *filePath)
+{
+    SegmentLogHeader header;
+    memset(&header, 0, sizeof(SegmentLogHeader));
+    memcpy(header.magic, SEGLOG_MAGIC, sizeof(header.magic));
+    header.version = SEGLOG_VERSION;
+    header.byteOrderMark = SEGLOG_BYTE_ORDER_MARK;
+    header.quantum = SEGLOG_QUANTUM;
+    header.numOfSegments = dl->numOfSegments;
+    header.numOfBlocks = (dl->numOfSegments + SEGLOG_BLOCK_SEGMENTS - 1) / SEGLOG_BLOCK_SEGMENTS;
+
+    SegmentLogBlock *index = (SegmentLogBlock*) malloc((header.numOfBlocks + 1) * sizeof(SegmentLogBlock));
+    uint8_t *buffer = (uint8_t*) malloc(SEGLOG_BLOCK_SEGMENTS * MAX_SEGMENT_BYTES);
+    size_t tempLength = strlen(filePath) + 8;
+    char *tempPath = (char*) malloc(tempLength);
+    if(index == NULL || buffer == NULL || tempPath == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space to write segment log in writeSegmentLog()\n");
+        exit(1);
+    }
+    snprintf(tempPath, tempLength, "%s.XXXXXX", filePath);
+    int fd = mkstemp(tempPath);
+    if(fd < 0) {
+        free(index);
+        free(buffer);
+        free(tempPath);
+        return 0;
+    }
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    FILE *file = fdopen(fd, "wb");
+    int written = file != NULL;
+      // the header is written again at the end, once the index offset is known
+    written = written && fwrite(&header, sizeof(SegmentLogHeader), 1, file) == 1;
+    uint64_t offset = sizeof(SegmentLogHeader);
+    for(int64_t b = 0; written && b < header.numOfBlocks; b++) {
+        int64_t first = b * SEGLOG_BLOCK_SEGMENTS;
+        int64_t last = (first + SEGLOG_BLOCK_SEGMENTS < dl->numOfSegments) ? first + SEGLOG_BLOCK_SEGMENTS : dl->numOfSegments;
+        size_t size = encodeSegmentBlock(dl, first, last, buffer, &index[b]);
+        written = size > 0 && fwrite(buffer, 1, size, file) == size;
+        index[b].offset = offset;
+        offset += size;
+    }
+      // the index is read in place from the mapped file, so it has to start on a whole number of words
+    static uint8_t padding[sizeof(uint64_t)];
+    size_t paddingSize = (sizeof(uint64_t) - offset % sizeof(uint64_t)) % sizeof(uint64_t);
+    written = written && fwrite(padding, 1, paddingSize, file) == paddingSize;
+    header.indexOffset = offset + paddingSize;
+    written = written && (header.numOfBlocks == 0 || fwrite(index, sizeof(SegmentLogBlock), header.numOfBlocks, file) == (size_t) header.numOfBlocks);
+    written = written && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(SegmentLogHeader), 1, file) == 1;
+    if(file != NULL) {
+        written = (fclose(file) == 0) && written;
+    } else {
+        close(fd);
+    }
+
+    written = written && rename(tempPath, filePath) == 0;
+    if(!written) {
+        unlink(tempPath);
+    }
+    free(index);
+    free(buffer);
+    free(tempPath);
+    return written;
+}
+
+// encodes segments first to last-1 into buffer and fills in everything about the block but its offset. Returns the number of bytes
+// used, or 0 if a segment has a coordinate too large to store
+size_t encodeSegmentBlock(DisplayList dl, int64_t first, int64_t last, uint8_t *buffer, SegmentLogBlock *block)
+{
+    size_t size = 0;
+    int64_t previousX = 0, previousY = 0;
+    Segment s;
+    getSegment(dl, first, &s);
+    block->minX = block->maxX = s.x0;
+    block->minY = block->maxY = s.y0;
+
+    for(int64_t i = first; i < last; i++) {
+        getSegment(dl, i, &s);
+        if(!(fabs(s.x0) <= SEGLOG_MAX_COORDINATE && fabs(s.y0) <= SEGLOG_MAX_COORDINATE &&
+             fabs(s.x1) <= SEGLOG_MAX_COORDINATE && fabs(s.y1) <= SEGLOG_MAX_COORDINATE)) {
+            return 0;
+        }
+        int64_t x0 = quantizeCoordinate(s.x0), y0 = quantizeCoordinate(s.y0);
+        int64_t x1 = quantizeCoordinate(s.x1), y1 = quantizeCoordinate(s.y1);
+
+        uint8_t tag = s.colour & SEGLOG_COLOUR_MASK;
+        int moved = (x0 != previousX || y0 != previousY);
+        buffer[size++] = moved ? (tag | SEGLOG_MOVE_FLAG) : tag;
+        if(moved) {
+            size += writeVarint(buffer + size, x0 - previousX);
+            size += writeVarint(buffer + size, y0 - previousY);
+        }
+        size += writeVarint(buffer + size, x1 - x0);
+        size += writeVarint(buffer + size, y1 - y0);
+        previousX = x1;
+        previousY = y1;
+
+        block->minX = fmin(block->minX, fmin(s.x0, s.x1));
+        block->maxX = fmax(block->maxX, fmax(s.x0, s.x1));
+        block->minY = fmin(block->minY, fmin(s.y0, s.y1));
+        block->maxY = fmax(block->maxY, fmax(s.y0, s.y1));
+    }
+    block->size = size;
+    block->firstSegment = first;
+    block->numOfSegments = last - first;
+    return size;
+}
+
+int64_t quantizeCoordinate(double coordinate)
+{
+    return (int64_t) llround(coordinate * SEGLOG_QUANTUM);
+}
+
+// zigzag encodes value, so numbers near zero of either sign are small, and writes it 7 bits at a time, low bits first, with the top bit
+// of each byte set if another follows. Returns the number of bytes written
+size_t writeVarint(uint8_t *buffer, int64_t value)
+{
+    uint64_t zigzag = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    size_t size = 0;
+    while(zigzag >= 0x80) {
+        buffer[size++] = (uint8_t) (zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    buffer[size++] = (uint8_t) zigzag;
+    return size;
+}
+
+// sets a file the segments of the next program interpreted are written to. Passing NULL switches this off
+void setSegmentLogPath(char *filePath)
+{
+    segmentLogPath = filePath;
+}
+
+char *getSegmentLogPath()
+{
+    return segmentLogPath;
+}
+
+
+
+//  LOADING FUNCTIONS  ///////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// maps a segment log into memory. Returns NULL if the file doesn't exist, was written by a different version or on a different kind of
+// machine, or its header and index don't fit the file. The blocks themselves are checked as they are decoded
+SegmentLog openSegmentLog(char *filePath)
+{
+    int fd = open(filePath, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct stat fileInfo;
+    if(fstat(fd, &fileInfo) != 0 || (size_t) fileInfo.st_size < sizeof(SegmentLogHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t fileSize = (size_t) fileInfo.st_size;
+    void *mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        return NULL;
+    }
+    if(!checkSegmentLogHeader((SegmentLogHeader*) mapping, fileSize)) {
+        munmap(mapping, fileSize);
+        return NULL;
+    }
+
+    SegmentLog log = (SegmentLog) malloc(sizeof(struct segmentLog));
+    if(log == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for segment log in openSegmentLog()\n");
+        exit(1);
+    }
+    log->mapping = mapping;
+    log->fileSize = fileSize;
+    log->header = (SegmentLogHeader*) mapping;
+    log->index = (SegmentLogBlock*) ((char*) mapping + log->header->indexOffset);
+    return log;
+}
+
+// returns 1 if the header belongs to a log this build can read, the index fills the end of the file, and every block it lists lies
+// between the header and the index
+int checkSegmentLogHeader(SegmentLogHeader *header, size_t fileSize)
+{
+    if(memcmp(header->magic, SEGLOG_MAGIC, sizeof(header->magic)) != 0 || header->version != SEGLOG_VERSION) {
+        return 0;
+    }
+    if(header->byteOrderMark != SEGLOG_BYTE_ORDER_MARK || header->quantum != SEGLOG_QUANTUM) {
+        return 0;
+    }
+    if(header->numOfSegments < 0 || header->numOfBlocks < 0 || header->indexOffset < sizeof(SegmentLogHeader) ||
+       header->indexOffset > fileSize || header->indexOffset % sizeof(uint64_t) != 0) {
+        return 0;
+    }
+    if((uint64_t) header->numOfBlocks != (fileSize - header->indexOffset) / sizeof(SegmentLogBlock) ||
+       (fileSize - header->indexOffset) % sizeof(SegmentLogBlock) != 0) {
+        return 0;
+    }
+    SegmentLogBlock *index = (SegmentLogBlock*) ((char*) header + header->indexOffset);
+    int64_t segments = 0;
+    for(int64_t b = 0; b < header->numOfBlocks; b++) {
+        if(index[b].offset < sizeof(SegmentLogHeader) || index[b].offset > header->indexOffset ||
+           index[b].size > header->indexOffset - index[b].offset) {
+            return 0;
+        }
+        if(index[b].firstSegment != segments || index[b].numOfSegments <= 0 || index[b].numOfSegments > SEGLOG_BLOCK_SEGMENTS) {
+            return 0;
+        }
+        segments += index[b].numOfSegments;
+    }
+    return segments == header->numOfSegments;
+}
+
+void closeSegmentLog(SegmentLog log)
+{
+    munmap(log->mapping, log->fileSize);
+    free(log);
+}
+
+int64_t getNumberOfBlocks(SegmentLog log)
+{
+    return log->header->numOfBlocks;
+}
+
+SegmentLogBlock *getSegmentLogBlock(SegmentLog log, int64_t block)
+{
+    return &log->index[block];
+}
+
+// decodes one block and appends its segments to the display list. Returns 0 if the block is damaged, leaving any segments decoded
+// before the damage in the list
+int decodeSegmentBlock(SegmentLog log, int64_t block)
+{
+    SegmentLogBlock *b = &log->index[block];
+    uint8_t *data = (uint8_t*) log->mapping + b->offset;
+    size_t position = 0;
+    int64_t x = 0, y = 0;
+
+    for(int64_t i = 0; i < b->numOfSegments; i++) {
+        if(position >= b->size) {
+            return 0;
+        }
+        uint8_t tag = data[position++];
+        if((tag & ~(SEGLOG_COLOUR_MASK | SEGLOG_MOVE_FLAG)) != 0 || (tag & SEGLOG_COLOUR_MASK) >= NUM_OF_COLOURS) {
+            return 0;
+        }
+        int64_t dx, dy;
+        size_t used;
+        if(tag & SEGLOG_MOVE_FLAG) {
+            if((used = readVarint(data + position, b->size - position, &dx)) == 0) {
+                return 0;
+            }
+            position += used;
+            if((used = readVarint(data + position, b->size - position, &dy)) == 0) {
+                return 0;
+            }
+            position += used;
+            if(!addQuantizedDelta(&x, dx) || !addQuantizedDelta(&y, dy)) {
+                return 0;
+            }
+        }
+        if((used = readVarint(data + position, b->size - position, &dx)) == 0) {
+            return 0;
+        }
+        position += used;
+        if((used = readVarint(data + position, b->size - position, &dy)) == 0) {
+            return 0;
+        }
+        position += used;
+        int64_t endX = x, endY = y;
+        if(!addQuantizedDelta(&endX, dx) || !addQuantizedDelta(&endY, dy)) {
+            return 0;
+        }
+        appendSegment((double) x / SEGLOG_QUANTUM, (double) y / SEGLOG_QUANTUM,
+                      (double) endX / SEGLOG_QUANTUM, (double) endY / SEGLOG_QUANTUM, tag & SEGLOG_COLOUR_MASK);
+        x = endX;
+        y = endY;
+    }
+    return position == b->size;
+}
+
+// moves a quantized coordinate by a distance read from a block. Returns 0, leaving the coordinate alone, if the distance or the new
+// coordinate is further than a log can hold, which only a damaged block can do. Checking the distance first keeps the sum in range
+int addQuantizedDelta(int64_t *coordinate, int64_t delta)
+{
+    if(delta < -2 * SEGLOG_MAX_QUANTIZED || delta > 2 * SEGLOG_MAX_QUANTIZED) {
+        return 0;
+    }
+    int64_t moved = *coordinate + delta;
+    if(moved < -SEGLOG_MAX_QUANTIZED || moved > SEGLOG_MAX_QUANTIZED) {
+        return 0;
+    }
+    *coordinate = moved;
+    return 1;
+}
+
+// reads a varint written by writeVarint(). Returns the number of bytes it took up, or 0 if it runs past the end of the buffer or is too
+// long to be one
+size_t readVarint(uint8_t *buffer, size_t available, int64_t *value)
+{
+    uint64_t zigzag = 0;
+    for(size_t i = 0; i < available && i < MAX_VARINT_BYTES; i++) {
+        zigzag |= (uint64_t) (buffer[i] & 0x7F) << (7 * i);
+        if((buffer[i] & 0x80) == 0) {
+            *value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+
+
+//  REPLAY FUNCTIONS  ////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// reads a segment log into a new display list in the run arena. Returns 0 if the file isn't a segment log or is damaged
+int loadSegmentLog(char *filePath)
+{
+    SegmentLog log = openSegmentLog(filePath);
+    if(log == NULL) {
+        return 0;
+    }
+    createDisplayList();
+    int loaded = 1;
+    for(int64_t b = 0; loaded && b < getNumberOfBlocks(log); b++) {
+        loaded = decodeSegmentBlock(log, b);
+    }
+    closeSegmentLog(log);
+    return loaded;
+}
+
+// draws the segments saved in a segment log without running the program that made them, then holds the window open
+void replaySegmentLog(char *filePath)
+{
+    if(!loadSegmentLog(filePath)) {
+        fprintf(stderr, "ERROR: '%s' is not a segment log for this version of turtle\n", filePath);
+        exit(1);
+    }
+    DisplayList dl = getDisplayListPointer(NULL);
+    if(getFitToWindow() && dl->numOfSegments > 0) {
+        Box drawing = getSegmentBox(dl, 0);
+        for(int64_t i = 1; i < dl->numOfSegments; i++) {
+            Box b = getSegmentBox(dl, i);
+            addToBox(&drawing, &b);
+        }
+        fitViewToDrawing(drawing);
+    }
+    setUpDisplay();
+    if(getImageOutput() == NULL) {
+        revealDisplayList();
+    }
+    holdScreenUntilUserInput(); // with no window, this renders the segments into the image and saves it
+    resetRunArena();
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runSegmentLogWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testSegmentLogRoundTrip(): Checking segments written to a log are read back the same");
+    sput_run_test(testSegmentLogRoundTrip);
+    sput_leave_suite();
+
+    sput_enter_suite("testSegmentLogRejection(): Checking damaged logs are not read");
+    sput_run_test(testSegmentLogRejection);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testSegmentLogRoundTrip()
+{
+    char directory[] = "/tmp/turtleSegLogXXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        fprintf(stderr, "ERROR - unable to make temporary directory in testSegmentLogRoundTrip()\n");
+        exit(1);
+    }
+    char path[SEGLOG_PATH_LENGTH];
+    snprintf(path, SEGLOG_PATH_LENGTH, "%s/drawing.tsl", directory);
+
+    sput_fail_unless(interpret("examples/dandelion.txt", TESTING) == 1, "Example interpreted");
+    DisplayList drawn = getDisplayListPointer(NULL);
+    int64_t numOfSegments = drawn->numOfSegments;
+    Segment *expected = (Segment*) malloc(numOfSegments * sizeof(Segment));
+    if(expected == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for expected segments in testSegmentLogRoundTrip()\n");
+        exit(1);
+    }
+    for(int64_t i = 0; i < numOfSegments; i++) {
+        getSegment(drawn, i, &expected[i]);
+    }
+    sput_fail_unless(writeSegmentLog(drawn, path) == 1, "Display list written as a segment log");
+    shutDownParsing();
+
+    SegmentLog log = openSegmentLog(path);
+    sput_fail_unless(log != NULL && getNumberOfBlocks(log) == (numOfSegments + SEGLOG_BLOCK_SEGMENTS - 1) / SEGLOG_BLOCK_SEGMENTS,
+                     "Segment log opened with one block per SEGLOG_BLOCK_SEGMENTS segments");
+    if(log != NULL) {
+        closeSegmentLog(log);
+    }
+
+    setCoalescing(0);
+    sput_fail_unless(loadSegmentLog(path) == 1, "Segment log loaded");
+    DisplayList loaded = getDisplayListPointer(NULL);
+    int allMatch = loaded->numOfSegments == numOfSegments;
+    for(int64_t i = 0; allMatch && i < numOfSegments; i++) {
+        Segment s;
+        getSegment(loaded, i, &s);
+        allMatch = fabs(s.x0 - expected[i].x0) <= 0.5 / SEGLOG_QUANTUM && fabs(s.y0 - expected[i].y0) <= 0.5 / SEGLOG_QUANTUM &&
+                   fabs(s.x1 - expected[i].x1) <= 0.5 / SEGLOG_QUANTUM && fabs(s.y1 - expected[i].y1) <= 0.5 / SEGLOG_QUANTUM &&
+                   s.colour == expected[i].colour;
+    }
+    sput_fail_unless(allMatch, "Loaded segments match the drawn segments to within the quantum");
+    resetRunArena();
+
+      // one short segment makes a block that isn't a whole number of words long, so the index after it has to be padded
+    createDisplayList();
+    appendSegment(0, 0, 1, 0, red);
+    sput_fail_unless(writeSegmentLog(getDisplayListPointer(NULL), path) == 1, "Single segment written as a segment log");
+    resetRunArena();
+    log = openSegmentLog(path);
+    sput_fail_unless(log != NULL && getSegmentLogBlock(log, 0)->size % sizeof(uint64_t) != 0,
+                     "Segment log with a block of an odd length opened");
+    if(log != NULL) {
+        closeSegmentLog(log);
+    }
+    Segment single;
+    sput_fail_unless(loadSegmentLog(path) == 1 && getNumberOfSegments() == 1, "Segment log with a block of an odd length loaded");
+    getSegment(getDisplayListPointer(NULL), 0, &single);
+    sput_fail_unless(single.x0 == 0 && single.y0 == 0 && single.x1 == 1 && single.y1 == 0 && single.colour == red,
+                     "Segment read back from after the padding");
+    setCoalescing(1);
+    resetRunArena();
+
+    int64_t value = 0;
+    uint8_t buffer[MAX_VARINT_BYTES];
+    size_t size = writeVarint(buffer, INT64_MIN);
+    sput_fail_unless(readVarint(buffer, size, &value) == size && value == INT64_MIN, "Largest negative number survives a varint");
+    sput_fail_unless(readVarint(buffer, size - 1, &value) == 0, "Varint running past its buffer is rejected");
+
+    free(expected);
+    unlink(path);
+    rmdir(directory);
+}
+
+void testSegmentLogRejection()
+{
+    char directory[] = "/tmp/turtleSegLogXXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        fprintf(stderr, "ERROR - unable to make temporary directory in testSegmentLogRejection()\n");
+        exit(1);
+    }
+    char path[SEGLOG_PATH_LENGTH];
+    snprintf(path, SEGLOG_PATH_LENGTH, "%s/drawing.tsl", directory);
+
+    sput_fail_unless(openSegmentLog(path) == NULL, "Missing segment log not opened");
+    sput_fail_unless(openSegmentLog("examples/dandelion.txt") == NULL, "Source file not opened as a segment log");
+
+    interpret("examples/dandelion.txt", TESTING);
+    writeSegmentLog(getDisplayListPointer(NULL), path);
+    shutDownParsing();
+
+      // cut the last block index entry off the end of the file
+    struct stat fileInfo;
+    stat(path, &fileInfo);
+    sput_fail_unless(truncate(path, fileInfo.st_size - sizeof(SegmentLogBlock)) == 0 && openSegmentLog(path) == NULL,
+                     "Segment log with part of its index missing not opened");
+
+      // damage the first tag, so the block can't be decoded
+    interpret("examples/dandelion.txt", TESTING);
+    writeSegmentLog(getDisplayListPointer(NULL), path);
+    shutDownParsing();
+    FILE *file = fopen(path, "r+b");
+    fseek(file, sizeof(SegmentLogHeader), SEEK_SET);
+    fputc(0xFF, file);
+    fclose(file);
+    sput_fail_unless(loadSegmentLog(path) == 0, "Segment log with a damaged block not loaded");
+    resetRunArena();
+
+      // make every distance in a block far larger than any drawing, so adding them up would overflow if they were believed. Each of the
+      // three segments is a tag, an x distance that takes the 9 bytes of hugeDistance and a y distance of 0
+    setCoalescing(0);
+    createDisplayList();
+    appendSegment(0, 0, SEGLOG_MAX_COORDINATE, 0, white);
+    appendSegment(SEGLOG_MAX_COORDINATE, 0, 0, 0, white);
+    appendSegment(0, 0, SEGLOG_MAX_COORDINATE, 0, white);
+    writeSegmentLog(getDisplayListPointer(NULL), path);
+    resetRunArena();
+    uint8_t hugeDistance[] = {0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F}; // 2^62 - 1
+    file = fopen(path, "r+b");
+    for(int i = 0; i < 3; i++) {
+        fseek(file, sizeof(SegmentLogHeader) + 1 + i * (1 + sizeof(hugeDistance) + 1), SEEK_SET);
+        fwrite(hugeDistance, 1, sizeof(hugeDistance), file);
+    }
+    fclose(file);
+    sput_fail_unless(loadSegmentLog(path) == 0, "Segment log with distances beyond the largest coordinate not loaded");
+    setCoalescing(1);
+    resetRunArena();
+
+    unlink(path);
+    rmdir(directory);
+}
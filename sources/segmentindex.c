@@ -0,0 +1,527 @@
+#include "../includes/segmentindex.h"
+#include "../includes/sput.h"
+
+// a packed R-tree over the display list. Segments are sorted along a Morton curve so segments near each other on screen are near each
+// other in order[], then every INDEX_FANOUT of them get a box (level 0), every INDEX_FANOUT of those boxes get a box round them (level
+// 1), and so on up to a single root box. Every level is one array, so a query walks memory in order.
+// Every query first rebuilds the index over the whole display list if anything has been drawn since it was built, so no query ever has
+// to check segments one by one. The arrays are kept from one build to the next and only replaced when the drawing outgrows them
+struct segmentIndex {
+    DisplayList dl;
+    int64_t generation; // the display list's generation when the index was built. If the list has been compacted since, it is rebuilt
+    int64_t numIndexed; // segments 0 to numIndexed-1 are in the tree
+    Box lastBox; // the box of the last segment indexed, which the turtle may since have extended
+    int64_t orderCapacity, nodeCapacity;
+
+    int64_t *order; // the display list index of every indexed segment, in Morton order
+    Box *nodes; // every level one after another, leaves first
+    int64_t levelStart[MAX_INDEX_LEVELS + 1]; // where each level starts in nodes. The level after the root starts at numOfNodes
+    int numOfLevels;
+} ;
+
+
+
+//  SETUP FUNCTIONS  /////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// returns the index over the display list, made in the run arena the first time it's asked for and brought up to date with the
+// segments drawn since. It hangs off the display list so it goes when the list does
+SegmentIndex getSegmentIndex(DisplayList dl)
+{
+    if(dl->index == NULL) {
+        dl->index = (SegmentIndex) runCalloc(sizeof(struct segmentIndex), memSegmentIndex);
+        dl->index->dl = dl;
+        dl->index->generation = dl->generation;
+    }
+    updateSegmentIndex(dl->index);
+    return dl->index;
+}
+
+
+
+//  BUILDING FUNCTIONS  //////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// rebuilds the index over every segment of the display list if any have been drawn since it was built, if the last one it holds has
+// been extended by the turtle's next step, or if the display list has been compacted
+void updateSegmentIndex(SegmentIndex si)
+{
+    DisplayList dl = si->dl;
+    int changed = si->generation != dl->generation || si->numIndexed != dl->numOfSegments;
+    if(!changed && si->numIndexed > 0) {
+        Box last = getSegmentBox(dl, si->numIndexed - 1);
+        changed = last.minX != si->lastBox.minX || last.minY != si->lastBox.minY ||
+                  last.maxX != si->lastBox.maxX || last.maxY != si->lastBox.maxY;
+    }
+    if(changed) {
+        si->generation = dl->generation;
+        buildSegmentIndex(si, dl->numOfSegments);
+    }
+}
+
+// bulk loads the first numOfSegments segments of the display list
+void buildSegmentIndex(SegmentIndex si, int64_t numOfSegments)
+{
+    DisplayList dl = si->dl;
+    si->numIndexed = numOfSegments;
+    si->numOfLevels = 0;
+    if(numOfSegments == 0) {
+        return;
+    }
+    si->lastBox = getSegmentBox(dl, numOfSegments - 1);
+
+    reserveIndexSpace(si, numOfSegments, 0);
+    Box world = getSegmentBox(dl, 0);
+    for(int64_t i = 1; i < numOfSegments; i++) {
+        Box b = getSegmentBox(dl, i);
+        addToBox(&world, &b);
+    }
+    sortSegmentsByMortonKey(si, numOfSegments, world);
+
+      // work out how many boxes each level needs
+    int64_t numOfNodes = 0;
+    int64_t width = numOfSegments;
+    do {
+        width = (width + INDEX_FANOUT - 1) / INDEX_FANOUT;
+        si->levelStart[si->numOfLevels] = numOfNodes;
+        numOfNodes += width;
+        si->numOfLevels++;
+    } while(width > 1);
+    si->levelStart[si->numOfLevels] = numOfNodes;
+    reserveIndexSpace(si, numOfSegments, numOfNodes);
+
+    for(int64_t leaf = 0; leaf < si->levelStart[1]; leaf++) {
+        int64_t first = leaf * INDEX_FANOUT;
+        int64_t last = (first + INDEX_FANOUT < numOfSegments) ? first + INDEX_FANOUT : numOfSegments;
+        Box b = getSegmentBox(dl, si->order[first]);
+        for(int64_t i = first + 1; i < last; i++) {
+            Box s = getSegmentBox(dl, si->order[i]);
+            addToBox(&b, &s);
+        }
+        si->nodes[leaf] = b;
+    }
+    for(int level = 1; level < si->numOfLevels; level++) {
+        int64_t below = si->levelStart[level - 1];
+        int64_t belowWidth = si->levelStart[level] - below;
+        for(int64_t node = 0; node < si->levelStart[level + 1] - si->levelStart[level]; node++) {
+            int64_t first = node * INDEX_FANOUT;
+            int64_t last = (first + INDEX_FANOUT < belowWidth) ? first + INDEX_FANOUT : belowWidth;
+            Box b = si->nodes[below + first];
+            for(int64_t i = first + 1; i < last; i++) {
+                addToBox(&b, &si->nodes[below + i]);
+            }
+            si->nodes[si->levelStart[level] + node] = b;
+        }
+    }
+}
+
+// makes room for numOfSegments segments and numOfNodes boxes. An array that is too small is replaced by one at least twice its size,
+// and the old one left unused in the arena, so rebuilding the index as the drawing grows uses memory in proportion to its final size
+void reserveIndexSpace(SegmentIndex si, int64_t numOfSegments, int64_t numOfNodes)
+{
+    if(numOfSegments > si->orderCapacity) {
+        int64_t capacity = (numOfSegments > si->orderCapacity * 2) ? numOfSegments : si->orderCapacity * 2;
+        trackRunMemory(memSegmentIndex, si->orderCapacity * sizeof(int64_t), 0);
+        si->order = (int64_t*) runAlloc(capacity * sizeof(int64_t), memSegmentIndex);
+        si->orderCapacity = capacity;
+    }
+    if(numOfNodes > si->nodeCapacity) {
+        int64_t capacity = (numOfNodes > si->nodeCapacity * 2) ? numOfNodes : si->nodeCapacity * 2;
+        trackRunMemory(memSegmentIndex, si->nodeCapacity * sizeof(Box), 0);
+        si->nodes = (Box*) runAlloc(capacity * sizeof(Box), memSegmentIndex);
+        si->nodeCapacity = capacity;
+    }
+}
+
+// fills order[] with the segments sorted on the Morton key of their centres, using a radix sort on 8 bits at a time
+void sortSegmentsByMortonKey(SegmentIndex si, int64_t numOfSegments, Box world)
+{
+    uint32_t *keys = (uint32_t*) malloc(numOfSegments * sizeof(uint32_t));
+    uint32_t *sortedKeys = (uint32_t*) malloc(numOfSegments * sizeof(uint32_t));
+    int64_t *sortedOrder = (int64_t*) malloc(numOfSegments * sizeof(int64_t));
+    if(keys == NULL || sortedKeys == NULL || sortedOrder == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space to sort segments in sortSegmentsByMortonKey()\n");
+        exit(1);
+    }
+    trackMemory(memSegmentIndex, 0, numOfSegments * (2 * sizeof(uint32_t) + sizeof(int64_t)));
+
+    double scale = (1 << MORTON_BITS) - 1;
+    double width = (world.maxX > world.minX) ? world.maxX - world.minX : 1;
+    double height = (world.maxY > world.minY) ? world.maxY - world.minY : 1;
+    for(int64_t i = 0; i < numOfSegments; i++) {
+        Box b = getSegmentBox(si->dl, i);
+        uint32_t x = (uint32_t) (((b.minX + b.maxX) / 2 - world.minX) / width * scale);
+        uint32_t y = (uint32_t) (((b.minY + b.maxY) / 2 - world.minY) / height * scale);
+        keys[i] = interleaveBits(x, y);
+        si->order[i] = i;
+    }
+
+    for(int shift = 0; shift < 32; shift += 8) {
+        int64_t counts[257] = {0};
+        for(int64_t i = 0; i < numOfSegments; i++) {
+            counts[((keys[i] >> shift) & 0xFF) + 1]++;
+        }
+        for(int d = 0; d < 256; d++) {
+            counts[d + 1] += counts[d];
+        }
+        for(int64_t i = 0; i < numOfSegments; i++) {
+            int64_t to = counts[(keys[i] >> shift) & 0xFF]++;
+            sortedKeys[to] = keys[i];
+            sortedOrder[to] = si->order[i];
+        }
+        memcpy(keys, sortedKeys, numOfSegments * sizeof(uint32_t));
+        memcpy(si->order, sortedOrder, numOfSegments * sizeof(int64_t));
+    }
+
+    free(keys);
+    free(sortedKeys);
+    free(sortedOrder);
+    trackMemory(memSegmentIndex, numOfSegments * (2 * sizeof(uint32_t) + sizeof(int64_t)), 0);
+}
+
+// interleaves the bits of two 16 bit numbers, x in the even bits and y in the odd bits
+uint32_t interleaveBits(uint32_t x, uint32_t y)
+{
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    y = (y | (y << 8)) & 0x00FF00FF;
+    y = (y | (y << 4)) & 0x0F0F0F0F;
+    y = (y | (y << 2)) & 0x33333333;
+    y = (y | (y << 1)) & 0x55555555;
+    return x | (y << 1);
+}
+
+Box getSegmentBox(DisplayList dl, int64_t index)
+{
+    Segment s;
+    getSegment(dl, index, &s);
+    Box b;
+    b.minX = (s.x0 < s.x1) ? s.x0 : s.x1;
+    b.maxX = (s.x0 < s.x1) ? s.x1 : s.x0;
+    b.minY = (s.y0 < s.y1) ? s.y0 : s.y1;
+    b.maxY = (s.y0 < s.y1) ? s.y1 : s.y0;
+    return b;
+}
+
+// grows box to cover other as well
+void addToBox(Box *box, Box *other)
+{
+    if(other->minX < box->minX) {
+        box->minX = other->minX;
+    }
+    if(other->minY < box->minY) {
+        box->minY = other->minY;
+    }
+    if(other->maxX > box->maxX) {
+        box->maxX = other->maxX;
+    }
+    if(other->maxY > box->maxY) {
+        box->maxY = other->maxY;
+    }
+}
+
+
+
+//  QUERY FUNCTIONS  /////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// calls visit with every segment whose bounding box overlaps area, and returns how many there were. The index is brought up to date
+// first. Segments are found in Morton order, so callers that need them in the order they were drawn should use findSegmentsInArea()
+int64_t querySegmentIndex(SegmentIndex si, Box area, SegmentVisitor visit, void *data)
+{
+    updateSegmentIndex(si);
+    int64_t found = 0;
+    if(si->numOfLevels > 0) {
+        int64_t stack[MAX_INDEX_LEVELS * INDEX_FANOUT];
+        int stackLevel[MAX_INDEX_LEVELS * INDEX_FANOUT];
+        int top = 0;
+        stack[top] = 0;
+        stackLevel[top] = si->numOfLevels - 1;
+        top++;
+
+        while(top > 0) {
+            top--;
+            int64_t node = stack[top];
+            int level = stackLevel[top];
+            if(!checkBoxesOverlap(&si->nodes[si->levelStart[level] + node], &area)) {
+                continue;
+            }
+            int64_t first = node * INDEX_FANOUT;
+            if(level == 0) {
+                int64_t last = (first + INDEX_FANOUT < si->numIndexed) ? first + INDEX_FANOUT : si->numIndexed;
+                for(int64_t i = first; i < last; i++) {
+                    Box b = getSegmentBox(si->dl, si->order[i]);
+                    if(checkBoxesOverlap(&b, &area)) {
+                        visit(si->order[i], data);
+                        found++;
+                    }
+                }
+            } else {
+                int64_t width = si->levelStart[level] - si->levelStart[level - 1];
+                int64_t last = (first + INDEX_FANOUT < width) ? first + INDEX_FANOUT : width;
+                for(int64_t child = last - 1; child >= first; child--) {
+                    stack[top] = child;
+                    stackLevel[top] = level - 1;
+                    top++;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+// finds every segment whose bounding box overlaps area, in the order they were drawn. The query marks what it finds in a bit set, which
+// is then read in order, so drawing order costs a pass over one bit per segment rather than a sort. Sets segments to a malloced list of
+// what was found, to be freed with freeFoundSegments(), and returns its length
+int64_t findSegmentsInArea(SegmentIndex si, Box area, int64_t **segments)
+{
+    updateSegmentIndex(si);
+    int64_t numOfWords = (si->numIndexed + 63) / 64;
+    uint64_t *marks = (uint64_t*) calloc(numOfWords ? numOfWords : 1, sizeof(uint64_t));
+    if(marks == NULL) {
+        fprintf(stderr, "ERROR - unable to calloc space for found segments in findSegmentsInArea()\n");
+        exit(1);
+    }
+    trackMemory(memSegmentIndex, 0, numOfWords * sizeof(uint64_t));
+    int64_t found = querySegmentIndex(si, area, markFoundSegment, marks);
+
+    *segments = (int64_t*) malloc((found ? found : 1) * sizeof(int64_t));
+    if(*segments == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for found segments in findSegmentsInArea()\n");
+        exit(1);
+    }
+    trackMemory(memSegmentIndex, 0, found * sizeof(int64_t));
+    int64_t numFound = 0;
+    for(int64_t word = 0; word < numOfWords; word++) {
+        for(uint64_t bits = marks[word]; bits != 0; bits &= bits - 1) {
+            (*segments)[numFound++] = word * 64 + __builtin_ctzll(bits);
+        }
+    }
+    free(marks);
+    trackMemory(memSegmentIndex, numOfWords * sizeof(uint64_t), 0);
+    return found;
+}
+
+void markFoundSegment(int64_t segment, void *data)
+{
+    ((uint64_t*) data)[segment / 64] |= (uint64_t) 1 << (segment % 64);
+}
+
+void freeFoundSegments(int64_t *segments, int64_t numOfSegments)
+{
+    free(segments);
+    trackMemory(memSegmentIndex, numOfSegments * sizeof(int64_t), 0);
+}
+
+int checkBoxesOverlap(Box *a, Box *b)
+{
+    return a->minX <= b->maxX && b->minX <= a->maxX && a->minY <= b->maxY && b->minY <= a->maxY;
+}
+
+int64_t getNumberIndexed(SegmentIndex si)
+{
+    return si->numIndexed;
+}
+
+
+
+//  CLIPPING FUNCTIONS  //////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// trims the segment to the part inside box (Liang-Barsky). The segment is x0 + t*dx for t from 0 to 1, and each edge of the box
+// either raises the t it enters at or lowers the t it leaves at. Returns 0, leaving the ends alone, if no part of it is inside
+int clipSegmentToBox(double *x0, double *y0, double *x1, double *y1, Box *box)
+{
+    double dx = *x1 - *x0;
+    double dy = *y1 - *y0;
+    double tEnter = 0, tLeave = 1;
+    if(!clipAgainstEdge(-dx, *x0 - box->minX, &tEnter, &tLeave) || !clipAgainstEdge(dx, box->maxX - *x0, &tEnter, &tLeave) ||
+       !clipAgainstEdge(-dy, *y0 - box->minY, &tEnter, &tLeave) || !clipAgainstEdge(dy, box->maxY - *y0, &tEnter, &tLeave)) {
+        return 0;
+    }
+    double startX = *x0, startY = *y0;
+    if(tLeave < 1) {
+        *x1 = startX + tLeave * dx;
+        *y1 = startY + tLeave * dy;
+    }
+    if(tEnter > 0) {
+        *x0 = startX + tEnter * dx;
+        *y0 = startY + tEnter * dy;
+    }
+    return 1;
+}
+
+// p is how fast the segment moves towards the outside of one edge and q how far inside it the start is. Returns 0 if the segment is
+// wholly outside the edge or the part inside has become empty
+int clipAgainstEdge(double p, double q, double *tEnter, double *tLeave)
+{
+    if(p == 0) {
+        return q >= 0; // parallel to the edge, so either all inside it or all outside
+    }
+    double t = q / p;
+    if(p < 0) {
+        if(t > *tLeave) {
+            return 0;
+        }
+        if(t > *tEnter) {
+            *tEnter = t;
+        }
+    } else {
+        if(t < *tEnter) {
+            return 0;
+        }
+        if(t < *tLeave) {
+            *tLeave = t;
+        }
+    }
+    return 1;
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runSegmentIndexWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testSegmentIndexBuilding(): Checking the index is built over the display list as segments are drawn");
+    sput_run_test(testSegmentIndexBuilding);
+    sput_leave_suite();
+
+    sput_enter_suite("testSegmentIndexQueries(): Checking queries find exactly the segments in an area");
+    sput_run_test(testSegmentIndexQueries);
+    sput_leave_suite();
+
+    sput_enter_suite("testSegmentClipping(): Checking segments are trimmed to a box");
+    sput_run_test(testSegmentClipping);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+// adds one short segment to each cell of a gridSize by gridSize grid, with a gap between cells so none touch
+void addSegmentGrid(int gridSize)
+{
+    for(int y = 0; y < gridSize; y++) {
+        for(int x = 0; x < gridSize; x++) {
+            appendSegment(x * 10, y * 10, x * 10 + 5, y * 10 + 5, (uint8_t) ((x + y) % 2));
+        }
+    }
+}
+
+void countVisit(int64_t segment, void *data)
+{
+    (void) segment;
+    (*(int64_t*) data)++;
+}
+
+void markVisit(int64_t segment, void *data)
+{
+    ((uint8_t*) data)[segment] = 1;
+}
+
+void testSegmentIndexBuilding()
+{
+    setCoalescing(0);
+    createDisplayList();
+    DisplayList dl = getDisplayListPointer(NULL);
+    sput_fail_unless(getNumberIndexed(getSegmentIndex(dl)) == 0, "Empty display list has nothing indexed");
+
+    addSegmentGrid(50);
+    SegmentIndex si = getSegmentIndex(dl);
+    sput_fail_unless(getNumberIndexed(si) == 50 * 50, "Every segment indexed, including the last");
+
+    appendSegment(2000, 2000, 2001, 2001, 0);
+    int64_t count = 0;
+    Box corner = {1999, 1999, 2002, 2002};
+    sput_fail_unless(querySegmentIndex(si, corner, countVisit, &count) == 1 && getNumberIndexed(si) == 50 * 50 + 1,
+                     "Segment drawn since the last query indexed before the next");
+
+    dl->coalesce = 1;
+    appendSegment(2001, 2001, 2010, 2010, 0);
+    Box extended = {2005, 2005, 2006, 2006};
+    sput_fail_unless(dl->numOfSegments == 50 * 50 + 1 && querySegmentIndex(si, extended, countVisit, &count) == 1,
+                     "Index rebuilt when the last segment is extended");
+
+    dl->generation++;
+    sput_fail_unless(getNumberIndexed(getSegmentIndex(dl)) == dl->numOfSegments, "Index rebuilt after the display list is compacted");
+    setCoalescing(1);
+    resetRunArena();
+}
+
+void testSegmentIndexQueries()
+{
+    setCoalescing(0);
+    createDisplayList();
+    addSegmentGrid(200);
+    appendSegment(1000, 1000, 1003, 1003, 0);
+    SegmentIndex si = getSegmentIndex(getDisplayListPointer(NULL));
+
+    int64_t count = 0;
+    Box area = {12, 12, 38, 38}; // cells 1 to 3 in each direction
+    sput_fail_unless(querySegmentIndex(si, area, countVisit, &count) == 9 && count == 9, "Query finds the segments in a small area");
+
+    Box all = {-1, -1, 5000, 5000};
+    count = 0;
+    querySegmentIndex(si, all, countVisit, &count);
+    sput_fail_unless(count == 200 * 200 + 1, "Query over everything finds every segment once");
+
+    Box empty = {3000, 3000, 4000, 4000};
+    sput_fail_unless(querySegmentIndex(si, empty, countVisit, &count) == 0, "Query over an empty area finds nothing");
+
+    uint8_t *found = (uint8_t*) calloc(200 * 200 + 1, 1);
+    Box strip = {0, 995, 10000, 1010};
+    querySegmentIndex(si, strip, markVisit, found);
+    int matches = 1;
+    for(int64_t i = 0; i < 200 * 200; i++) {
+        int inStrip = (i / 200) * 10 + 5 >= 995 && (i / 200) * 10 <= 1010;
+        matches = matches && (found[i] == inStrip);
+    }
+    sput_fail_unless(matches && found[200 * 200] == 1, "Query finds exactly the segments overlapping a strip");
+
+    int64_t *inOrder;
+    int64_t numFound = findSegmentsInArea(si, strip, &inOrder);
+    int ordered = 1;
+    for(int64_t i = 0, j = 0; i <= 200 * 200; i++) {
+        if(found[i]) {
+            ordered = ordered && j < numFound && inOrder[j++] == i;
+        }
+    }
+    sput_fail_unless(ordered && numFound == 3 * 200 + 1, "Segments in a strip found in the order they were drawn");
+    freeFoundSegments(inOrder, numFound);
+    free(found);
+    setCoalescing(1);
+    resetRunArena();
+}
+
+void testSegmentClipping()
+{
+    Box screen = {0, 0, 1000, 700};
+    double x0 = 10, y0 = 20, x1 = 30, y1 = 40;
+    sput_fail_unless(clipSegmentToBox(&x0, &y0, &x1, &y1, &screen) == 1 && x0 == 10 && y0 == 20 && x1 == 30 && y1 == 40,
+                     "Segment inside the box left alone");
+
+    x0 = -500; y0 = 350; x1 = 1500; y1 = 350;
+    sput_fail_unless(clipSegmentToBox(&x0, &y0, &x1, &y1, &screen) == 1 && x0 == 0 && x1 == 1000 && y0 == 350 && y1 == 350,
+                     "Segment crossing the box trimmed at both ends");
+
+    x0 = 500; y0 = 350; x1 = 500; y1 = -1e12;
+    sput_fail_unless(clipSegmentToBox(&x0, &y0, &x1, &y1, &screen) == 1 && y0 == 350 && y1 == 0 && x1 == 500,
+                     "Segment leaving the box trimmed at the edge it leaves by");
+
+    x0 = -100; y0 = 100; x1 = 100; y1 = -100;
+    sput_fail_unless(clipSegmentToBox(&x0, &y0, &x1, &y1, &screen) == 1 && x0 == 0 && y0 == 0 && x1 == 0 && y1 == 0,
+                     "Diagonal segment touching a corner clipped to the corner");
+
+    x0 = 1100; y0 = -10; x1 = 2000; y1 = 900;
+    sput_fail_unless(clipSegmentToBox(&x0, &y0, &x1, &y1, &screen) == 0 && x0 == 1100, "Segment outside the box dropped");
+
+    x0 = -100; y0 = 750; x1 = 1100; y1 = 760;
+    sput_fail_unless(clipSegmentToBox(&x0, &y0, &x1, &y1, &screen) == 0, "Segment passing below the box dropped");
+}
@@ -0,0 +1,200 @@
+#include "../includes/parser.h" // the tests use the colours from display.h, which parser.h includes
+#include <pthread.h>
+
+#define RING_TEST_SEGMENTS 200000
+
+// a single producer, single consumer queue of segments. The interpreter's thread only ever writes head and the drawing thread only
+// ever writes tail, so neither needs a lock: each publishes its index with a release store and reads the other's with an acquire load.
+// Each side also keeps the last value it read of the other's index, and only reads it again when that value says the ring is full (or
+// empty), so the two threads rarely touch the same cache line. The indexes count up for ever and are masked to find the slot
+struct segmentRing {
+    RingSegment *slots;
+    uint64_t head; // the next slot the producer writes
+    char headPadding[CACHE_LINE - sizeof(uint64_t)];
+    uint64_t tail; // the next slot the consumer reads
+    char tailPadding[CACHE_LINE - sizeof(uint64_t)];
+    uint64_t cachedTail; // the producer's copy of tail
+    char cachedTailPadding[CACHE_LINE - sizeof(uint64_t)];
+    uint64_t cachedHead; // the consumer's copy of head
+    int closed; // set once the producer has pushed its last segment
+} ;
+
+static SegmentRing currentRing = NULL; // if set, the turtle's moves are pushed here for the drawing thread rather than drawn
+
+
+
+//  SETUP FUNCTIONS  /////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// the ring is made in the run arena, with its indexes on their own cache lines
+SegmentRing createSegmentRing()
+{
+    SegmentRing ring = (SegmentRing) runAllocAligned(sizeof(struct segmentRing), CACHE_LINE, memDisplay);
+    memset(ring, 0, sizeof(struct segmentRing));
+    ring->slots = (RingSegment*) runAllocAligned(SEGMENT_RING_SIZE * sizeof(RingSegment), CACHE_LINE, memDisplay);
+    return ring;
+}
+
+void setSegmentRing(SegmentRing ring)
+{
+    currentRing = ring;
+}
+
+SegmentRing getSegmentRing()
+{
+    return currentRing;
+}
+
+
+
+//  RING FUNCTIONS  //////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// called only by the producer. If the ring is full, waits for the consumer to make room, so the interpreter can't get more than
+// SEGMENT_RING_SIZE segments ahead of the window
+void pushToSegmentRing(SegmentRing ring, RingSegment *segment)
+{
+    uint64_t head = ring->head;
+    while(head - ring->cachedTail == SEGMENT_RING_SIZE) {
+        ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if(head - ring->cachedTail == SEGMENT_RING_SIZE) {
+            waitForSegmentRing();
+        }
+    }
+    ring->slots[head & (SEGMENT_RING_SIZE - 1)] = *segment;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// called only by the consumer. Copies up to maxSegments of the waiting segments into batch and frees their slots in one go. Returns the
+// number copied, which is 0 if the ring is empty
+int popFromSegmentRing(SegmentRing ring, RingSegment *batch, int maxSegments)
+{
+    uint64_t tail = ring->tail;
+    if(ring->cachedHead == tail) {
+        ring->cachedHead = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+    uint64_t waiting = ring->cachedHead - tail;
+    int numOfSegments = (waiting < (uint64_t) maxSegments) ? (int) waiting : maxSegments;
+    for(int i = 0; i < numOfSegments; i++) {
+        batch[i] = ring->slots[(tail + i) & (SEGMENT_RING_SIZE - 1)];
+    }
+    __atomic_store_n(&ring->tail, tail + numOfSegments, __ATOMIC_RELEASE);
+    return numOfSegments;
+}
+
+// called by the producer after its last push
+void closeSegmentRing(SegmentRing ring)
+{
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+// once this returns 1, every segment the producer will push is already in the ring, so finding it empty afterwards means it is finished
+int checkSegmentRingClosed(SegmentRing ring)
+{
+    return __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+}
+
+void waitForSegmentRing()
+{
+    struct timespec wait = {0, RING_WAIT_NANOSECONDS};
+    nanosleep(&wait, NULL);
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runSegmentRingWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testSegmentRingOrder(): Checking segments come out of the ring in the order they went in");
+    sput_run_test(testSegmentRingOrder);
+    sput_leave_suite();
+
+    sput_enter_suite("testSegmentRingThreads(): Checking segments pass between threads through a full ring");
+    sput_run_test(testSegmentRingThreads);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testSegmentRingOrder()
+{
+    SegmentRing ring = createSegmentRing();
+    RingSegment batch[SEGMENT_RING_BATCH];
+    sput_fail_unless(popFromSegmentRing(ring, batch, SEGMENT_RING_BATCH) == 0, "New ring empty");
+
+      // go round the ring more than once so the indexes wrap
+    int pushed = 0, popped = 0, inOrder = 1;
+    for(int round = 0; round < 3; round++) {
+        for(int i = 0; i < SEGMENT_RING_SIZE - 10; i++) {
+            RingSegment s = {pushed, 0, pushed + 1, 0, (uint8_t) (pushed % NUM_OF_COLOURS)};
+            pushToSegmentRing(ring, &s);
+            pushed++;
+        }
+        int numOfSegments;
+        while((numOfSegments = popFromSegmentRing(ring, batch, SEGMENT_RING_BATCH)) > 0) {
+            for(int i = 0; i < numOfSegments; i++) {
+                inOrder = inOrder && batch[i].x0 == popped && batch[i].colour == popped % NUM_OF_COLOURS;
+                popped++;
+            }
+        }
+    }
+    sput_fail_unless(inOrder && popped == pushed, "Every segment popped in order");
+
+    RingSegment s = {1, 2, 3, 4, red};
+    pushToSegmentRing(ring, &s);
+    pushToSegmentRing(ring, &s);
+    sput_fail_unless(popFromSegmentRing(ring, batch, 1) == 1 && popFromSegmentRing(ring, batch, SEGMENT_RING_BATCH) == 1,
+                     "Pops take no more than asked for");
+    sput_fail_unless(checkSegmentRingClosed(ring) == 0, "Ring open until closed");
+    closeSegmentRing(ring);
+    sput_fail_unless(checkSegmentRingClosed(ring) == 1, "Ring closed");
+    resetRunArena();
+}
+
+void *pushTestSegments(void *data)
+{
+    SegmentRing ring = (SegmentRing) data;
+    for(int i = 0; i < RING_TEST_SEGMENTS; i++) {
+        RingSegment s = {i, -i, i * 2.0, 0.5, (uint8_t) (i % NUM_OF_COLOURS)};
+        pushToSegmentRing(ring, &s);
+    }
+    closeSegmentRing(ring);
+    return NULL;
+}
+
+// the producer pushes far more than the ring holds, so it has to wait for the consumer to catch up
+void testSegmentRingThreads()
+{
+    SegmentRing ring = createSegmentRing();
+    pthread_t producer;
+    if(pthread_create(&producer, NULL, pushTestSegments, ring) != 0) {
+        fprintf(stderr, "ERROR - unable to create producer thread in testSegmentRingThreads()\n");
+        exit(1);
+    }
+
+    RingSegment batch[SEGMENT_RING_BATCH];
+    int popped = 0, inOrder = 1;
+    while(1) {
+        int closed = checkSegmentRingClosed(ring);
+        int numOfSegments = popFromSegmentRing(ring, batch, SEGMENT_RING_BATCH);
+        if(numOfSegments == 0 && closed) {
+            break;
+        }
+        for(int i = 0; i < numOfSegments; i++) {
+            inOrder = inOrder && batch[i].x0 == popped && batch[i].y0 == -popped && batch[i].x1 == popped * 2.0 &&
+                      batch[i].colour == popped % NUM_OF_COLOURS;
+            popped++;
+        }
+    }
+    pthread_join(producer, NULL);
+    sput_fail_unless(popped == RING_TEST_SEGMENTS, "Every segment arrived");
+    sput_fail_unless(inOrder, "Segments arrived whole and in order");
+    resetRunArena();
+}
+
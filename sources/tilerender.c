@@ -0,0 +1,400 @@
+#include "../includes/tilerender.h"
+#include "../includes/sput.h"
+#include <pthread.h>
+#include <unistd.h>
+
+// everything the threads rendering one image share. The spatial index finds the segments that may be in view, and only those are
+// binned into the tiles they cross, keeping the order they were drawn in within each tile, then each tile is drawn on its own by whichever thread takes it next. A pixel is only ever drawn by the
+// thread drawing its tile, in the same order as drawing every segment in turn would, so the image is the same however many threads
+// draw it
+struct tileRender {
+    Framebuffer fb;
+    DisplayList dl;
+    Box view;
+    int numOfThreads;
+    int tilesAcross, tilesDown, numOfTiles;
+
+    int64_t *found; // the display list index of each segment the index found in view, in the order they were drawn
+    int64_t numFound;
+    RasterSegment *segments; // each segment found, mapped to pixels
+    int64_t *cursors; // numOfThreads rows of numOfTiles. Each thread's segment count per tile, then where it writes its next one in bins
+    int64_t *binStart; // where each tile's segments start in bins. Has numOfTiles + 1 entries
+    int64_t *bins; // the index of each segment in each tile, tile by tile
+
+    int nextTile; // the next tile for a thread to draw
+    pthread_mutex_t tileLock;
+} ;
+
+// one thread of a render. Threads map and bin their own share of the segments found in view
+struct renderWorker {
+    TileRender render;
+    int thread;
+} ;
+
+static int renderThreads = AUTO_RENDER_THREADS;
+
+
+
+//  SETUP FUNCTIONS  /////////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void setRenderThreads(int numOfThreads)
+{
+    renderThreads = numOfThreads;
+}
+
+int getRenderThreads()
+{
+    return renderThreads;
+}
+
+// small drawings are quicker to render than to start threads for
+int chooseRenderThreads(int64_t numOfSegments)
+{
+    int numOfThreads = renderThreads;
+    if(numOfThreads == AUTO_RENDER_THREADS) {
+        numOfThreads = (numOfSegments < RENDER_PARALLEL_THRESHOLD) ? 1 : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(numOfThreads < 1) {
+        numOfThreads = 1;
+    }
+    return (numOfThreads < MAX_RENDER_THREADS) ? numOfThreads : MAX_RENDER_THREADS;
+}
+
+
+
+//  RENDERING FUNCTIONS  /////////////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+// draws every segment of the display list that crosses view into the framebuffer, scaled so view fills it, in TILE_SIZE tiles spread
+// over the render threads. Draws over what is already there, in the order the segments were drawn. Segments the spatial index finds
+// wholly outside view are never looked at. Returns the number of segments in view
+int64_t renderDisplayList(Framebuffer fb, DisplayList dl, Box view)
+{
+    struct tileRender render;
+    render.fb = fb;
+    render.dl = dl;
+    render.view = view;
+    render.numFound = findSegmentsInArea(getSegmentIndex(dl), view, &render.found);
+    render.numOfThreads = chooseRenderThreads(render.numFound);
+    render.tilesAcross = (fb->width + TILE_SIZE - 1) / TILE_SIZE;
+    render.tilesDown = (fb->height + TILE_SIZE - 1) / TILE_SIZE;
+    render.numOfTiles = render.tilesAcross * render.tilesDown;
+    render.nextTile = 0;
+    pthread_mutex_init(&render.tileLock, NULL);
+
+    size_t segmentsSize = (size_t) render.numFound * sizeof(RasterSegment);
+    size_t cursorsSize = (size_t) render.numOfThreads * render.numOfTiles * sizeof(int64_t);
+    size_t binStartSize = (size_t) (render.numOfTiles + 1) * sizeof(int64_t);
+    render.segments = (RasterSegment*) malloc(segmentsSize ? segmentsSize : 1);
+    render.cursors = (int64_t*) calloc((size_t) render.numOfThreads * render.numOfTiles, sizeof(int64_t));
+    render.binStart = (int64_t*) malloc(binStartSize);
+    if(render.segments == NULL || render.cursors == NULL || render.binStart == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for tile bins in renderDisplayList()\n");
+        exit(1);
+    }
+    trackMemory(memDisplay, 0, segmentsSize + cursorsSize + binStartSize);
+
+    runRenderPhase(&render, mapAndCountSegments);
+
+      // lay the bins out tile by tile and, within each tile, thread by thread, so each tile's segments stay in the order they were drawn
+    int64_t binned = 0;
+    for(int tile = 0; tile < render.numOfTiles; tile++) {
+        render.binStart[tile] = binned;
+        for(int thread = 0; thread < render.numOfThreads; thread++) {
+            int64_t count = render.cursors[(size_t) thread * render.numOfTiles + tile];
+            render.cursors[(size_t) thread * render.numOfTiles + tile] = binned;
+            binned += count;
+        }
+    }
+    render.binStart[render.numOfTiles] = binned;
+    render.bins = (int64_t*) malloc((binned ? binned : 1) * sizeof(int64_t));
+    if(render.bins == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for tile bins in renderDisplayList()\n");
+        exit(1);
+    }
+    trackMemory(memDisplay, 0, binned * sizeof(int64_t));
+
+    runRenderPhase(&render, fillTileBins);
+    runRenderPhase(&render, drawTiles);
+
+    int64_t inView = 0;
+    for(int64_t i = 0; i < render.numFound; i++) {
+        inView += render.segments[i].colour != OUT_OF_VIEW;
+    }
+    freeFoundSegments(render.found, render.numFound);
+    free(render.segments);
+    free(render.cursors);
+    free(render.binStart);
+    free(render.bins);
+    trackMemory(memDisplay, segmentsSize + cursorsSize + binStartSize + binned * sizeof(int64_t), 0);
+    pthread_mutex_destroy(&render.tileLock);
+    return inView;
+}
+
+// runs phase once for each render thread and waits for them all to finish. Thread 0 runs on this thread
+void runRenderPhase(TileRender render, void *(*phase)(void*))
+{
+    struct renderWorker workers[MAX_RENDER_THREADS];
+    pthread_t threads[MAX_RENDER_THREADS];
+    for(int i = 0; i < render->numOfThreads; i++) {
+        workers[i].render = render;
+        workers[i].thread = i;
+    }
+    for(int i = 1; i < render->numOfThreads; i++) {
+        if(pthread_create(&threads[i], NULL, phase, &workers[i]) != 0) {
+            fprintf(stderr, "ERROR - unable to create render thread in runRenderPhase()\n");
+            exit(1);
+        }
+    }
+    phase(&workers[0]);
+    for(int i = 1; i < render->numOfThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// clips and maps the thread's share of the segments found, and counts how many go in each tile
+void *mapAndCountSegments(void *data)
+{
+    struct renderWorker *worker = (struct renderWorker*) data;
+    TileRender render = worker->render;
+    int64_t numOfSegments = render->numFound;
+    int64_t first = numOfSegments * worker->thread / render->numOfThreads;
+    int64_t last = numOfSegments * (worker->thread + 1) / render->numOfThreads;
+    int64_t *counts = render->cursors + (size_t) worker->thread * render->numOfTiles;
+    for(int64_t i = first; i < last; i++) {
+        Segment s;
+        getSegment(render->dl, render->found[i], &s);
+        RasterSegment *r = &render->segments[i];
+        if(!clipSegmentToBox(&s.x0, &s.y0, &s.x1, &s.y1, &render->view)) {
+            r->colour = OUT_OF_VIEW;
+            continue;
+        }
+        mapToImage(render->view, render->fb->width, render->fb->height, s.x0, s.y0, &r->x0, &r->y0);
+        mapToImage(render->view, render->fb->width, render->fb->height, s.x1, s.y1, &r->x1, &r->y1);
+        r->colour = s.colour;
+        binSegment(render, r, i, counts, NULL);
+    }
+    return NULL;
+}
+
+// puts the thread's share of the segments in their tiles' bins, in the places worked out from the counts
+void *fillTileBins(void *data)
+{
+    struct renderWorker *worker = (struct renderWorker*) data;
+    TileRender render = worker->render;
+    int64_t numOfSegments = render->numFound;
+    int64_t first = numOfSegments * worker->thread / render->numOfThreads;
+    int64_t last = numOfSegments * (worker->thread + 1) / render->numOfThreads;
+    int64_t *cursor = render->cursors + (size_t) worker->thread * render->numOfTiles;
+    for(int64_t i = first; i < last; i++) {
+        if(render->segments[i].colour != OUT_OF_VIEW) {
+            binSegment(render, &render->segments[i], i, cursor, render->bins);
+        }
+    }
+    return NULL;
+}
+
+// takes tiles one at a time until they have all been drawn
+void *drawTiles(void *data)
+{
+    struct renderWorker *worker = (struct renderWorker*) data;
+    TileRender render = worker->render;
+    Pen pen;
+    while(1) {
+        pthread_mutex_lock(&render->tileLock);
+        int tile = render->nextTile++;
+        pthread_mutex_unlock(&render->tileLock);
+        if(tile >= render->numOfTiles) {
+            return NULL;
+        }
+        drawTile(render, tile, &pen);
+    }
+}
+
+// goes along the segment a column of tiles at a time (or a row, if it is mostly down), finding the rows (columns) of tiles it passes
+// through in each. With no bins, counts the segment in each of those tiles' cursors. With bins, writes it to each tile's next place
+void binSegment(TileRender render, RasterSegment *s, int64_t segment, int64_t *cursor, int64_t *bins)
+{
+    int xMajor = abs(s->x1 - s->x0) >= abs(s->y1 - s->y0);
+    int alongStart = xMajor ? s->x0 : s->y0, alongEnd = xMajor ? s->x1 : s->y1;
+    int acrossStart = xMajor ? s->y0 : s->x0, acrossEnd = xMajor ? s->y1 : s->x1;
+    if(alongEnd < alongStart) {
+        int temp = alongStart; alongStart = alongEnd; alongEnd = temp;
+        temp = acrossStart; acrossStart = acrossEnd; acrossEnd = temp;
+    }
+    int alongTiles = xMajor ? render->tilesAcross : render->tilesDown;
+    int acrossTiles = xMajor ? render->tilesDown : render->tilesAcross;
+    double gradient = (alongEnd == alongStart) ? 0 : (double) (acrossEnd - acrossStart) / (alongEnd - alongStart);
+
+    int firstTile = (alongStart < 0) ? 0 : alongStart / TILE_SIZE;
+    int lastTile = (alongEnd / TILE_SIZE < alongTiles) ? alongEnd / TILE_SIZE : alongTiles - 1;
+    for(int along = firstTile; along <= lastTile; along++) {
+        int from = (alongStart > along * TILE_SIZE) ? alongStart : along * TILE_SIZE;
+        int to = (alongEnd < (along + 1) * TILE_SIZE - 1) ? alongEnd : (along + 1) * TILE_SIZE - 1;
+        double acrossFrom = acrossStart + gradient * (from - alongStart);
+        double acrossTo = acrossStart + gradient * (to - alongStart);
+        int low = (int) floor(fmin(acrossFrom, acrossTo)) - TILE_MARGIN;
+        int high = (int) ceil(fmax(acrossFrom, acrossTo)) + TILE_MARGIN;
+        low = (low < 0) ? 0 : low / TILE_SIZE;
+        high = (high / TILE_SIZE < acrossTiles) ? high / TILE_SIZE : acrossTiles - 1;
+        for(int across = low; across <= high; across++) {
+            int tile = xMajor ? across * render->tilesAcross + along : along * render->tilesAcross + across;
+            if(bins == NULL) {
+                cursor[tile]++;
+            } else {
+                bins[cursor[tile]++] = segment;
+            }
+        }
+    }
+}
+
+// draws the tile's segments in order, through a pen that can only draw inside the tile
+void drawTile(TileRender render, int tile, Pen *pen)
+{
+    Framebuffer fb = render->fb;
+    int left = (tile % render->tilesAcross) * TILE_SIZE;
+    int top = (tile / render->tilesAcross) * TILE_SIZE;
+    int right = (left + TILE_SIZE - 1 < fb->width - 1) ? left + TILE_SIZE - 1 : fb->width - 1;
+    int bottom = (top + TILE_SIZE - 1 < fb->height - 1) ? top + TILE_SIZE - 1 : fb->height - 1;
+    setPenArea(pen, left, top, right, bottom);
+
+    int colour = -1;
+    for(int64_t i = render->binStart[tile]; i < render->binStart[tile + 1]; i++) {
+        RasterSegment *s = &render->segments[render->bins[i]];
+        if(s->colour != colour) {
+            colour = s->colour;
+            uint8_t r, g, b;
+            getColourRGB((Clr) colour, &r, &g, &b);
+            setPenColour(pen, r, g, b);
+        }
+        drawPenLine(fb, pen, s->x0, s->y0, s->x1, s->y1);
+    }
+}
+
+// converts a point in the turtle's world to a pixel in an image of the given size showing view
+void mapToImage(Box view, int width, int height, double x, double y, int *imageX, int *imageY)
+{
+    *imageX = (int) ((x - view.minX) * width / (view.maxX - view.minX));
+    *imageY = (int) ((y - view.minY) * height / (view.maxY - view.minY));
+}
+
+
+
+//  WHITE BOX TESTING FUNCTIONS  /////////////////////////////////////////////////////////////
+/*..........................................................................................*/
+
+void runTileRenderWhiteBoxTests()
+{
+    sput_start_testing();
+
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testTileBinning(): Checking segments are binned into the tiles they cross");
+    sput_run_test(testTileBinning);
+    sput_leave_suite();
+
+    sput_enter_suite("testTiledRendering(): Checking tiled rendering matches drawing every segment in turn");
+    sput_run_test(testTiledRendering);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testTileBinning()
+{
+    struct tileRender render;
+    render.tilesAcross = 4;
+    render.tilesDown = 3;
+    render.numOfTiles = 12;
+    int64_t counts[12] = {0};
+
+    RasterSegment across = {10, 100, 250, 100, white};
+    binSegment(&render, &across, 0, counts, NULL);
+    sput_fail_unless(counts[4] == 1 && counts[5] == 1 && counts[6] == 1 && counts[7] == 1 && counts[0] == 0 && counts[8] == 0,
+                     "Straight line binned into the row of tiles it runs along");
+
+    memset(counts, 0, sizeof(counts));
+    RasterSegment diagonal = {0, 0, 191, 191, white};
+    binSegment(&render, &diagonal, 0, counts, NULL);
+    sput_fail_unless(counts[0] == 1 && counts[5] == 1 && counts[10] == 1 && counts[3] == 0 && counts[8] == 0,
+                     "Diagonal binned into the tiles it passes through, not every tile round it");
+    sput_fail_unless(counts[1] == 1 && counts[4] == 1, "Tiles it passes near binned too");
+
+    memset(counts, 0, sizeof(counts));
+    RasterSegment down = {200, -50, 200, 500, white};
+    binSegment(&render, &down, 0, counts, NULL);
+    sput_fail_unless(counts[3] == 1 && counts[7] == 1 && counts[11] == 1 && counts[2] == 0, "Line past the edges binned into the tiles inside");
+
+    int64_t bins[3];
+    int64_t cursor[12] = {0};
+    cursor[3] = 0; cursor[7] = 1; cursor[11] = 2;
+    binSegment(&render, &down, 42, cursor, bins);
+    sput_fail_unless(bins[0] == 42 && bins[2] == 42 && cursor[11] == 3, "Segment written to each of its tiles' bins");
+}
+
+// renders scattered segments in every colour both through the tiles on several threads and by drawing each in turn
+void testTiledRendering()
+{
+    setCoalescing(0);
+    createDisplayList();
+    DisplayList dl = getDisplayListPointer(NULL);
+    uint32_t seed = 2024;
+    for(int i = 0; i < 5000; i++) {
+        double coordinates[4];
+        for(int j = 0; j < 4; j++) {
+            seed = seed * 1103515245u + 12345u;
+            coordinates[j] = (double) ((seed >> 8) % 1400) - 200 + (seed & 0xFF) / 256.0;
+        }
+        appendSegment(coordinates[0], coordinates[1], coordinates[2], coordinates[3], (uint8_t) (i % NUM_OF_COLOURS));
+    }
+    appendSegment(-1e6, 350, 1e6, 351, red);
+
+    Box view = {100, 50, 900, 650};
+    createFramebuffer(640, 480);
+    Framebuffer fb = getFramebufferPointer(NULL);
+    size_t imageSize = (size_t) 640 * 480 * BYTES_PER_PIXEL;
+    uint8_t *serial = (uint8_t*) malloc(imageSize);
+    if(serial == NULL) {
+        fprintf(stderr, "ERROR - unable to malloc space for test image in testTiledRendering()\n");
+        exit(1);
+    }
+
+    for(int antialias = 0; antialias <= 1; antialias++) {
+        setAntialiasing(antialias);
+        clearFramebuffer(fb, 0, 0, 0);
+        int64_t inView = 0;
+        for(int64_t i = 0; i < dl->numOfSegments; i++) {
+            Segment s;
+            getSegment(dl, i, &s);
+            if(clipSegmentToBox(&s.x0, &s.y0, &s.x1, &s.y1, &view)) {
+                int x0, y0, x1, y1;
+                mapToImage(view, 640, 480, s.x0, s.y0, &x0, &y0);
+                mapToImage(view, 640, 480, s.x1, s.y1, &x1, &y1);
+                uint8_t r, g, b;
+                getColourRGB((Clr) s.colour, &r, &g, &b);
+                setFramebufferColour(fb, r, g, b);
+                drawFramebufferLine(fb, x0, y0, x1, y1);
+                inView++;
+            }
+        }
+        memcpy(serial, fb->pixels, imageSize);
+
+        setRenderThreads(1);
+        clearFramebuffer(fb, 0, 0, 0);
+        sput_fail_unless(renderDisplayList(fb, dl, view) == inView && memcmp(serial, fb->pixels, imageSize) == 0,
+                         antialias ? "Anti-aliased tiles on one thread match drawing in turn" : "Tiles on one thread match drawing in turn");
+        setRenderThreads(7);
+        clearFramebuffer(fb, 0, 0, 0);
+        sput_fail_unless(renderDisplayList(fb, dl, view) == inView && memcmp(serial, fb->pixels, imageSize) == 0,
+                         antialias ? "Anti-aliased tiles on seven threads match drawing in turn" : "Tiles on seven threads match drawing in turn");
+    }
+    setAntialiasing(0);
+    setRenderThreads(AUTO_RENDER_THREADS);
+    sput_fail_unless(chooseRenderThreads(10) == 1, "Small drawings rendered on one thread");
+
+    free(serial);
+    setCoalescing(1);
+    resetRunArena();
+}
+
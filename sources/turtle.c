@@ -1,5 +1,7 @@
 
 #include "../includes/turtle.h"
+#include <errno.h>
+#include <limits.h>
 
 #define TEST_STR_LEN 100
 
@@ -8,6 +10,7 @@ int main(int argc, char *argv[])
 {
     srand(time(NULL));
 
+    argc = processOptions(argc, argv);
     checkInput(argc, argv, NO_TESTING);
 
     int startMode = getStartMode(argc, argv);
@@ -16,6 +19,9 @@ int main(int argc, char *argv[])
         case NO_TESTING :
             runFullProgram(argv[1]);
             break;
+        case REPLAY :
+            replaySegmentLog(argv[2]);
+            break;
         case TEST_WHITEBOX :
             runWhiteBoxTesting();
             break;
@@ -43,6 +49,14 @@ int main(int argc, char *argv[])
   // set up everything and either parse or interpret the file depending on user input
 void runFullProgram(char *filePath)
 {
+    if(getEstimateOnly()) {
+        Measurement m;
+        int measuredOK = measureProgram(filePath, &m);
+        printMeasurement(stdout, filePath, &m);
+        printf(measuredOK ? "Success\n" : "Failure\n");
+        return;
+    }
+    
     printf("Enter 0 to parse, 1 to interpret: \n");
     int interpretFile = 0;
     
@@ -54,10 +68,30 @@ void runFullProgram(char *filePath)
     int processedOK = 0;
     
     if(interpretFile) {
+          // measure the program first so the display list can be made the right size and the view fitted round the drawing
+        Measurement m;
+        if(getFitToWindow() && measureProgram(filePath, &m)) {
+            setSegmentCapacityHint(m.segments);
+            if(m.segments > 0) {
+                fitViewToDrawing(m.bounds);
+            }
+        }
         processedOK = interpret(filePath, NO_TESTING);
+        if(getProfiling()) {
+            printProfile(stdout, filePath);
+        }
+        if(getMemoryReport()) {
+            printMemoryReport(stdout, "end of run");
+        }
         holdScreenUntilUserInput(); // if interpretting, SDL is initialised so hold the window open after completion
     } else {   
         processedOK = parse(filePath, NO_TESTING);
+        if(getProfiling()) {
+            printProfile(stdout, filePath);
+        }
+        if(getMemoryReport()) {
+            printMemoryReport(stdout, "end of run");
+        }
     }
     
     shutDownParsing();
@@ -93,7 +127,19 @@ int checkInput(int argc, char *argv[], int testMode)
         fclose(fp);
     }
     
-    // if 3 arguments, check for valid testing input
+    // if 3 arguments, check for valid testing input or a segment log to replay
+    if(argc == 3 && strcmp(argv[1],"replay") == 0) {
+        FILE *fp = fopen(argv[2], "rb");
+        if(fp == NULL) {
+            if(testMode == NO_TESTING) {
+                fprintf(stderr, "ERROR: Unable to locate file at '%s'\n", argv[2]);
+                exitWithCommandLineError();
+            }
+            return 0;
+        }
+        fclose(fp);
+        return 1;
+    }
     if(argc == 3) {
         if(strcmp(argv[1],"test") != 0) {
             if(testMode == NO_TESTING) {
@@ -114,11 +160,127 @@ int checkInput(int argc, char *argv[], int testMode)
 
 void exitWithCommandLineError()
 {
-    fprintf(stderr,"please run the turtle program with one of the command line arguments as follows:\n\nTo parse a .txt file and draw a shape:\n./turtle <FILENAME>.txt\n\nFor testing enter one of the below:\n./turtle test all\n./turtle test white\n./turtle test black\n./turtle test sys\n");
+    fprintf(stderr,"please run the turtle program with one of the command line arguments as follows:\n\nTo parse a .txt file (or a saved .tbc file) and draw a shape:\n./turtle [OPTIONS] <FILENAME>.txt\n\nTo draw a saved segment log:\n./turtle replay <FILENAME>.tsl\n\nFor testing enter one of the below:\n./turtle test all\n./turtle test white\n./turtle test black\n./turtle test sys\n\nOptions:\n--lex-threads <N>   lex the file in N chunks on N threads (0 picks automatically)\n--stream            when only parsing, read the file as it is parsed instead of all at once\n--cache-dir <DIR>   save validated programs to DIR and load them from there on later runs\n--emit-tbc <FILE>   save the validated program to FILE as bytecode\n--profile           print each line of the program with the instructions, time, segments and position pushes spent on it\n--compact-positions store the positions BKSTP goes back to as floats, halving their memory\n--compact-segments  keep the drawn line segments as floats, halving their memory\n--dedup             remove segments that are drawn again later in the same colour\n--seglog <FILE>     save the drawn segments to FILE so they can be replayed without running the program\n--huge-pages        ask for the program's working memory to be backed by huge pages\n--fit               measure the program first and scale the window to fit the whole drawing\n--estimate          print the drawing's size, segment count, BKSTP history and run time without drawing it\n--output <FILE>     draw into FILE (.png or .ppm) instead of a window, as fast as possible\n--image-size <W>x<H> the size of the --output image (1000x700 unless given)\n--render-threads <N> render the --output image in tiles on N threads (0 picks automatically)\n--antialias         smooth the edges of lines drawn into the --output image\n--reveal-rate <N>   reveal the drawing in the window at N segments a second (100 unless given)\n--reveal-seconds <S> reveal the whole drawing in the window over S seconds, whatever its size (0 shows it at once)\n--mem-report        print the memory used by each part of the program, and the process's peak, when it finishes\n--mem-report-every <N> also print the memory report every N instructions\n");
     exit(1);
 
 }
 
+// applies any options (arguments beginning with "--") and removes them from argv so the remaining arguments can be checked as normal. Returns the new argc
+int processOptions(int argc, char *argv[])
+{
+    int remaining = 1;
+    char *imagePath = NULL;
+    int imageWidth = SCREEN_WIDTH, imageHeight = SCREEN_HEIGHT;
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--", 2) != 0) {
+            argv[remaining] = argv[i];
+            remaining++;
+        } else if(strcmp(argv[i], "--lex-threads") == 0 && i+1 < argc) {
+            i++;
+            long long threads;
+            if(!readOptionNumber(argv[i], AUTO_LEX_THREADS, MAX_LEX_THREADS, &threads)) {
+                fprintf(stderr, "ERROR: Lex thread count '%s' should be a whole number from 0 to %d\n", argv[i], MAX_LEX_THREADS);
+                exitWithCommandLineError();
+            }
+            setLexThreads((int) threads);
+        } else if(strcmp(argv[i], "--stream") == 0) {
+            setStreamingValidation(1);
+        } else if(strcmp(argv[i], "--cache-dir") == 0 && i+1 < argc) {
+            i++;
+            setCacheDirectory(argv[i]);
+        } else if(strcmp(argv[i], "--emit-tbc") == 0 && i+1 < argc) {
+            i++;
+            setEmitPath(argv[i]);
+        } else if(strcmp(argv[i], "--profile") == 0) {
+            setProfiling(1);
+        } else if(strcmp(argv[i], "--compact-positions") == 0) {
+            setCompactPositions(1);
+        } else if(strcmp(argv[i], "--compact-segments") == 0) {
+            setCompactSegments(1);
+        } else if(strcmp(argv[i], "--dedup") == 0) {
+            setDeduplication(1);
+        } else if(strcmp(argv[i], "--seglog") == 0 && i+1 < argc) {
+            i++;
+            setSegmentLogPath(argv[i]);
+        } else if(strcmp(argv[i], "--fit") == 0) {
+            setFitToWindow(1);
+        } else if(strcmp(argv[i], "--estimate") == 0) {
+            setEstimateOnly(1);
+        } else if(strcmp(argv[i], "--mem-report") == 0) {
+            setMemoryReport(1);
+        } else if(strcmp(argv[i], "--mem-report-every") == 0 && i+1 < argc) {
+            i++;
+            long long instructions;
+            if(!readOptionNumber(argv[i], 1, LLONG_MAX, &instructions)) {
+                fprintf(stderr, "ERROR: Memory report interval '%s' should be a whole number of instructions above 0\n", argv[i]);
+                exitWithCommandLineError();
+            }
+            setMemoryReport(1);
+            setMemoryReportInterval(instructions);
+        } else if(strcmp(argv[i], "--huge-pages") == 0) {
+            setHugePages(1);
+        } else if(strcmp(argv[i], "--output") == 0 && i+1 < argc) {
+            i++;
+            imagePath = argv[i];
+        } else if(strcmp(argv[i], "--render-threads") == 0 && i+1 < argc) {
+            i++;
+            long long threads;
+            if(!readOptionNumber(argv[i], AUTO_RENDER_THREADS, MAX_RENDER_THREADS, &threads)) {
+                fprintf(stderr, "ERROR: Render thread count '%s' should be a whole number from 0 to %d\n", argv[i], MAX_RENDER_THREADS);
+                exitWithCommandLineError();
+            }
+            setRenderThreads((int) threads);
+        } else if(strcmp(argv[i], "--antialias") == 0) {
+            setAntialiasing(1);
+        } else if(strcmp(argv[i], "--reveal-rate") == 0 && i+1 < argc) {
+            i++;
+            char *end;
+            double rate = strtod(argv[i], &end);
+            if(*end != '\0' || !(rate > 0)) {
+                fprintf(stderr, "ERROR: Reveal rate '%s' should be a number of segments a second above 0\n", argv[i]);
+                exitWithCommandLineError();
+            }
+            setRevealRate(rate);
+        } else if(strcmp(argv[i], "--reveal-seconds") == 0 && i+1 < argc) {
+            i++;
+            char *end;
+            double seconds = strtod(argv[i], &end);
+            if(*end != '\0' || !(seconds >= 0)) {
+                fprintf(stderr, "ERROR: Reveal duration '%s' should be a number of seconds, 0 or above\n", argv[i]);
+                exitWithCommandLineError();
+            }
+            setRevealDuration(seconds);
+        } else if(strcmp(argv[i], "--image-size") == 0 && i+1 < argc) {
+            i++;
+            if(sscanf(argv[i], "%dx%d", &imageWidth, &imageHeight) != 2 || imageWidth < 1 || imageHeight < 1 ||
+               imageWidth > MAX_IMAGE_SIDE || imageHeight > MAX_IMAGE_SIDE) {
+                fprintf(stderr, "ERROR: Image size '%s' should be WIDTHxHEIGHT, each from 1 to %d\n", argv[i], MAX_IMAGE_SIDE);
+                exitWithCommandLineError();
+            }
+        } else {
+            fprintf(stderr, "ERROR: Unrecognised option '%s'\n", argv[i]);
+            exitWithCommandLineError();
+        }
+    }
+    if(imagePath != NULL) {
+        setImageOutput(imagePath, imageWidth, imageHeight);
+    }
+    return remaining;
+}
+
+// reads the whole of an option's argument as a whole number. Returns 0 if it isn't one, or is outside min to max
+int readOptionNumber(char *text, long long min, long long max, long long *value)
+{
+    char *end;
+    errno = 0;
+    long long number = strtoll(text, &end, 10);
+    if(end == text || *end != '\0' || errno == ERANGE || number < min || number > max) {
+        return 0;
+    }
+    *value = number;
+    return 1;
+}
+
 // processes the user input and returns the type of mode to start the program in
 int getStartMode(int argc, char *argv[])
 {
@@ -127,7 +289,10 @@ int getStartMode(int argc, char *argv[])
         return NO_TESTING;
     }
     
-    // if three arguments, choose testing type based on argv[2]
+    // if three arguments, either replay the segment log in argv[2] or choose testing type based on argv[2]
+    if(argc == 3 && strcmp(argv[1],"replay") == 0) {
+        return REPLAY;
+    }
     if(argc == 3) {
         if(strcmp(argv[2],"white") == 0) {
             return TEST_WHITEBOX;
@@ -156,8 +321,20 @@ int getStartMode(int argc, char *argv[])
 void runWhiteBoxTesting()
 {
     runCommandLineTests();
+    runArenaWhiteBoxTests();
+    runDisplayListWhiteBoxTests();
+    runSegmentIndexWhiteBoxTests();
+    runFramebufferWhiteBoxTests();
+    runSegmentRingWhiteBoxTests();
+    runTileRenderWhiteBoxTests();
+    runLexerWhiteBoxTests();
+    runBytecodeWhiteBoxTests();
     runParserWhiteBoxTests();
+    runProfilerWhiteBoxTests();
+    runExpressionWhiteBoxTests();
+    runAnalysisWhiteBoxTests();
     runInterpreterWhiteBoxTests();
+    runSegmentLogWhiteBoxTests();
 }
 
 void runBlackBoxTesting()
@@ -220,6 +397,19 @@ void testCommandLine()
     strcpy(argv[2], "testwrong");
     sput_fail_unless(checkInput(argc, argv, TESTING) == 0, "Input check OK when 3 arguments and third is neither 'all', 'black' or 'white'");
     
+    strcpy(argv[1], "--lex-threads");
+    strcpy(argv[2], "4");
+    sput_fail_unless(processOptions(3, argv) == 1 && getLexThreads() == 4, "Options are applied and removed from the argument list");
+    setLexThreads(AUTO_LEX_THREADS);
+    
+    long long number = 0;
+    sput_fail_unless(readOptionNumber("12", 1, 64, &number) == 1 && number == 12, "Number option read");
+    sput_fail_unless(readOptionNumber("0", 1, 64, &number) == 0 && readOptionNumber("65", 1, 64, &number) == 0 &&
+                     readOptionNumber("-3", 1, 64, &number) == 0, "Number options outside their range rejected");
+    sput_fail_unless(readOptionNumber("", 1, 64, &number) == 0 && readOptionNumber("four", 1, 64, &number) == 0 &&
+                     readOptionNumber("4x", 1, 64, &number) == 0, "Number options that aren't whole numbers rejected");
+    sput_fail_unless(readOptionNumber("99999999999999999999", 1, LLONG_MAX, &number) == 0, "Number option too large to read rejected");
+    
     for(int i = 0; i < 3; i++) {
         free(argv[i]);
     }